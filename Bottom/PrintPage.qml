@@ -3,7 +3,7 @@ import "qrc:/Controls"
 
 BottomPage {
     id: printPage
-    contentHeightPlus: 100
+    contentHeightPlus: 250
 
     Item {
         anchors.left: parent.left
@@ -356,5 +356,61 @@ BottomPage {
                 value: tglFan.toggled
             }
         }
+
+        Label {
+            id: lblLayers
+            anchors.top: itmFan.bottom
+            anchors.topMargin: 30
+            isDimmable: true
+            text: "Shown layers:"
+            anchors.horizontalCenter: parent.horizontalCenter
+        }
+
+        Slider {
+            id: sldrFirstLayer
+            anchors.top: lblLayers.bottom
+            anchors.topMargin: 10
+            anchors.left: parent.left
+            anchors.right: parent.right
+            height: 50
+            isDimmable: true
+            enabled: renderer.toolPathLoaded
+            total: Math.max(renderer.tpLayerCount - 1, 1)
+            snapInterval: total
+            snapThreshold: 0
+            value: 0
+
+            onValueChanged: {
+                if (sldrLastLayer.value < value)
+                    sldrLastLayer.value = value
+                renderer.showLayerRange(value, sldrLastLayer.value)
+            }
+        }
+
+        Slider {
+            id: sldrLastLayer
+            anchors.top: sldrFirstLayer.bottom
+            anchors.topMargin: 10
+            anchors.left: parent.left
+            anchors.right: parent.right
+            height: 50
+            isDimmable: true
+            enabled: renderer.toolPathLoaded
+            total: Math.max(renderer.tpLayerCount - 1, 1)
+            snapInterval: total
+            snapThreshold: 0
+
+            // Show the whole toolpath again when a new one is loaded
+            onTotalChanged: {
+                sldrFirstLayer.value = 0
+                value = total
+            }
+
+            onValueChanged: {
+                if (sldrFirstLayer.value > value)
+                    sldrFirstLayer.value = value
+                renderer.showLayerRange(sldrFirstLayer.value, value)
+            }
+        }
     }
 }
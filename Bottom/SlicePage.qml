@@ -43,9 +43,23 @@ BottomPage {
             ListElement { title: "Bed Length"; setting: "bedLength"; }
             ListElement { title: "Bed Height"; setting: "bedHeight"; }
             ListElement { title: "Infill Density"; setting: "infillDensity"; }
+            ListElement { title: "Infill Pattern (0 Lines, 1 Grid, 2 Triangles, 3 Cubic, 4 Gyroid)"; setting: "infillPattern"; }
+            ListElement { title: "Seam Placement (0 Nearest, 1 Back, 2 Sharpest Corner)"; setting: "seamPlacement"; }
+            ListElement { title: "Travel Optimize Time (ms per Layer)"; setting: "travelOptimizeTime"; }
+            ListElement { title: "Travel Optimize Moves (Thousands per Layer)"; setting: "travelOptimizeMoves"; }
             ListElement { title: "Layer Height"; setting: "layerHeight"; }
+            ListElement { title: "Adaptive Layers (0 Off, 1 On)"; setting: "adaptiveLayers"; }
+            ListElement { title: "Minimum Layer Height"; setting: "minLayerHeight"; }
+            ListElement { title: "Maximum Layer Height"; setting: "maxLayerHeight"; }
+            ListElement { title: "Support (0 Off, 1 On)"; setting: "support"; }
+            ListElement { title: "Support Overhang Angle"; setting: "supportAngle"; }
+            ListElement { title: "Support Distance"; setting: "supportDistance"; }
+            ListElement { title: "Support Density"; setting: "supportDensity"; }
             ListElement { title: "Skirt Line Count"; setting: "skirtLineCount"; }
             ListElement { title: "Skirt Distance"; setting: "skirtDistance"; }
+            ListElement { title: "Raft Layer Count"; setting: "raftLayerCount"; }
+            ListElement { title: "Raft Margin"; setting: "raftMargin"; }
+            ListElement { title: "Raft Density"; setting: "raftDensity"; }
             ListElement { title: "Print Speed"; setting: "printSpeed"; }
             ListElement { title: "Infill Speed"; setting: "infillSpeed"; }
             ListElement { title: "Top/Bottom Speed"; setting: "topBottomSpeed"; }
@@ -56,6 +70,7 @@ BottomPage {
             ListElement { title: "Shell Thickness"; setting: "shellThickness"; }
             ListElement { title: "Top Bottom Thickness"; setting: "topBottomThickness"; }
             ListElement { title: "Print Temperature"; setting: "printTemperature"; }
+            ListElement { title: "Infill and Toolpath Memory Budget (MB, 0 Unlimited)"; setting: "toolpathMemoryBudget"; }
         }
 
         Component {
@@ -2,6 +2,7 @@
 #include "Misc/globalsettings.h"
 #include "clipper.hpp"
 #include "pmvector.h"
+#include "spillfile.h"
 #include <iostream>
 #include <vector>
 #include <map>
@@ -15,6 +16,10 @@
 #include <stack>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
 
 using namespace ChopperEngine;
 using namespace ClipperLib;
@@ -53,10 +58,6 @@ const float FilamentWidth = 2.8f;
 #define TOOLPATH_TESTS
 #endif
 
-// Below are some experimental features disabled by default
-// Uncomment to combine a few layers' worth of infill segment
-//#define COMBINE_INFILL
-
 void ChopperEngine::SlicerLog(std::string message)
 {
     if (slicerLogger != nullptr)
@@ -153,7 +154,7 @@ struct MovingSegment : public ToolSegment
     MovingSegment(ToolSegType _type, const IntPoint& _p1, const IntPoint& _p2, cInt Z, const int _speed)
         : ToolSegment(_type), p1(_p1, Z), p2(_p2, Z), speed(_speed) {}
 
-    cInt MoveDistance()
+    virtual cInt MoveDistance()
     {
         return (cInt)(std::sqrt(std::pow((long)p2.X - (long)p1.X, 2) +
                          std::pow((long)p2.Y - (long)p1.Y, 2) + std::pow((long)p2.Z - (long)p1.Z, 2)));
@@ -189,13 +190,14 @@ struct ExtrudeSegment : public MovingSegment
     ExtrudeSegment(const LineSegment& line, cInt Z, const int _speed)
         : MovingSegment(ToolSegType::Extruded, IntPoint3(line.p1, Z), IntPoint3(line.p2, Z), _speed) {}
 
-    double ExtrusionDistance()
+    // The thickness is that of the extruded layer in mm
+    double ExtrusionDistance(double thickness)
     {
-        if (GlobalSettings::LayerHeight.Get() == 0)
+        if (thickness == 0)
             return 0;
 
         // First we need to calculate the volume of the segment
-        double volume = (MoveDistance() / scaleFactor) * GlobalSettings::LayerHeight.Get() / NozzleWidth;
+        double volume = (MoveDistance() / scaleFactor) * thickness / NozzleWidth;
 
         // We then need to calculate how much smaller the extrusion is from the filament so that
         // we know how much filament to use to get the desired amount of extrusion
@@ -207,6 +209,27 @@ struct ExtrudeSegment : public MovingSegment
     }
 };
 
+struct ArcSegment : public ExtrudeSegment
+{
+    // This is an extruded move along a circle that is written as a single G2 or G3
+    // command instead of the many short lines it replaces
+
+    IntPoint centre;
+    bool clockwise;
+    double sweep; // The angle covered by the arc in radians
+
+    ArcSegment(const IntPoint& _p1, const IntPoint& _p2, const IntPoint& _centre,
+               bool _clockwise, double _sweep, cInt Z, const int _speed)
+        : ExtrudeSegment(_p1, _p2, Z, _speed), centre(_centre), clockwise(_clockwise), sweep(_sweep) {}
+
+    cInt MoveDistance() override
+    {
+        // The extruded length is that of the arc and not of the chord between its ends
+        double radius = std::sqrt(std::pow((double)p1.X - centre.X, 2) + std::pow((double)p1.Y - centre.Y, 2));
+        return (cInt)(radius * sweep);
+    }
+};
+
 enum class SegmentType
 {
     OutlineSegment,
@@ -215,7 +238,8 @@ enum class SegmentType
     BottomSegment,
     SupportSegment,
     SkirtSegment,
-    RaftSegment
+    RaftSegment,
+    ThinWallSegment
 };
 
 struct LayerSegment
@@ -252,6 +276,8 @@ struct LayerComponent
     std::vector<TrigLineSegment> initialLineList;
     std::map<std::size_t, std::size_t> faceToLineIdxs;
     std::vector<LayerIsland> islandList;
+    // The union of all islands as they were sliced, before any shells were taken off
+    Paths outlinePaths;
     int layerSpeed = 100; // TODO
     int moveSpeed = 100; // TODO
     std::vector<TravelSegment> initialLayerMoves;
@@ -273,6 +299,28 @@ static inline void getTrigPointFloats(Triangle &trig, double *arr, uint8_t pnt)
 
 static LayerComponent* layerComponents = nullptr;
 
+// The z position each layer is sliced at and the thickness of each layer, both in mm
+static std::vector<double> layerZ;
+static std::vector<double> layerHeights;
+
+// The raft layers come first and lie below the mesh, which is lifted by their thickness when printed
+static std::size_t raftLayerCount = 0;
+static double raftThickness = 0;
+
+// The z position of the nozzle when printing a layer, which is the top of the layer
+// The first layer is squished by half its height to stick to the bed, every later layer
+// keeps that same offset so the nozzle always rises by exactly the thickness it extrudes
+static inline cInt LayerPrintZ(std::size_t layerIdx)
+{
+    return (layerZ[layerIdx] + raftThickness + layerHeights[layerIdx] - layerHeights[0] / 2) * scaleFactor;
+}
+
+// Determine whether two z positions are less than a distance apart, allowing for rounding errors
+static inline bool WithinHeight(double lowZ, double highZ, double distance)
+{
+    return highZ - lowZ < distance - 1e-6;
+}
+
 static inline Vertex &VertAtIdx(std::size_t idx)
 {
     if (idx > sliceMesh->vertexCount)
@@ -309,7 +357,7 @@ static void MultiRunFunction(MultiFunction function,
                              std::size_t startIdx, std::size_t endIdx)
 {
     cInt idsLeft = endIdx - startIdx + 1;
-    std::size_t lastIdx = 0;
+    std::size_t lastIdx = startIdx;
 
     unsigned int cores = std::thread::hardware_concurrency();
     if (cores == 0)
@@ -392,13 +440,160 @@ static void MultiRunFunction(MultiFunction function,
         threads[i].join();
 }
 
+// The size of the z ranges the height limits of adaptive layers are collected in, as part of the minimum height
+const double AdaptiveBinFraction = 0.5;
+
+// Determine the z position and thickness of each layer. With adaptive layers the thickness follows the slope
+// of the surface of the mesh, the staircase effect of a layer of thickness h on a surface with normal n sticks
+// out h * |n.z| from it. Layers are made as thick as possible whilst keeping that within half the layer height
+// setting, so walls get thick layers and shallow slopes thin ones.
+static void CalculateLayerHeights()
+{
+    layerZ.clear();
+    layerHeights.clear();
+
+    double height = GlobalSettings::LayerHeight.Get();
+    double minHeight = GlobalSettings::MinLayerHeight.Get();
+    double maxHeight = GlobalSettings::MaxLayerHeight.Get();
+    double topZ = sliceMesh->MaxVec.z;
+    std::size_t fixedCount = (std::size_t)(sliceMesh->MaxVec.z / GlobalSettings::LayerHeight.Get()) + 1;
+
+    if (GlobalSettings::AdaptiveLayers.Get() < 1 || minHeight <= 0 || maxHeight < minHeight)
+    {
+        for (std::size_t i = 0; i < fixedCount; i++)
+        {
+            layerZ.push_back((double)i * height);
+            layerHeights.push_back(height);
+        }
+
+        return;
+    }
+
+    // Collect the thickest layer each z range allows for in bins
+    double maxCusp = height / 2;
+    double binSize = minHeight * AdaptiveBinFraction;
+    std::size_t binCount = (std::size_t)(topZ / binSize) + 1;
+    std::vector<double> heightLimits(binCount, maxHeight);
+
+    for (std::size_t j = 0; j < sliceMesh->trigCount; j++)
+    {
+        Triangle &trig = sliceMesh->trigs[j];
+
+        double x[3], y[3], z[3];
+        getTrigPointFloats(trig, x, 0);
+        getTrigPointFloats(trig, y, 1);
+        getTrigPointFloats(trig, z, 2);
+
+        // The z part of the normal of the triangle
+        double ax = x[1] - x[0], ay = y[1] - y[0], az = z[1] - z[0];
+        double bx = x[2] - x[0], by = y[2] - y[0], bz = z[2] - z[0];
+        double nx = ay * bz - az * by, ny = az * bx - ax * bz, nz = ax * by - ay * bx;
+        double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+        if (length == 0)
+            continue;
+
+        double slope = std::abs(nz) / length;
+        double limit = (slope * maxHeight > maxCusp) ? std::max(minHeight, maxCusp / slope) : maxHeight;
+
+        double minZ = std::max(0.0, std::min(z[0], std::min(z[1], z[2])));
+        double maxZ = std::max(z[0], std::max(z[1], z[2]));
+        std::size_t lastBin = std::min(binCount - 1, (std::size_t)(maxZ / binSize));
+        for (std::size_t b = (std::size_t)(minZ / binSize); b <= lastBin; b++)
+            heightLimits[b] = std::min(heightLimits[b], limit);
+    }
+
+    // The first layer keeps the configured height to stick to the bed
+    layerZ.push_back(0);
+    layerHeights.push_back(height);
+
+    for (double z = height; z <= topZ; z += layerHeights.back())
+    {
+        // Every bin the layer would span limits its thickness
+        double layerHeight = maxHeight;
+        for (std::size_t b = (std::size_t)(z / binSize); b < binCount && b * binSize < z + layerHeight; b++)
+            layerHeight = std::min(layerHeight, heightLimits[b]);
+
+        layerZ.push_back(z);
+        layerHeights.push_back(layerHeight);
+    }
+
+    SlicerLog("Adaptive layers: " + std::to_string(layerZ.size()) + " layers instead of " + std::to_string(fixedCount));
+}
+
+// The raft layers are thicker than the normal layers to make up for an uneven bed
+const double RaftLayerHeightFactor = 1.5;
+
+// Put the raft layers in front of the layers of the mesh, they are sliced below it so they start out empty
+static void AddRaftLayers()
+{
+    raftLayerCount = std::max(0, GlobalSettings::RaftLayerCount.Get());
+    double height = GlobalSettings::LayerHeight.Get() * RaftLayerHeightFactor;
+    raftThickness = raftLayerCount * height;
+
+    for (std::size_t i = raftLayerCount; i-- > 0;)
+    {
+        layerZ.insert(layerZ.begin(), (double)i * height - raftThickness);
+        layerHeights.insert(layerHeights.begin(), height);
+    }
+}
+
+// The vertices of the mesh snapped to the integer grid the slicer works on
+struct GridVertex
+{
+    cInt x, y, z;
+};
+
+static std::vector<GridVertex> gridVertices;
+
+static void SnapVerticesMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+{
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        const float *floats = &sliceMesh->vertexFloats[i * 3];
+        gridVertices[i].x = std::llround((double)floats[0] * scaleFactor);
+        gridVertices[i].y = std::llround((double)floats[1] * scaleFactor);
+        gridVertices[i].z = std::llround((double)floats[2] * scaleFactor);
+    }
+
+    *doneFlag = true;
+}
+
+// Divide and round to the nearest integer, the denominator has to be positive
+static inline cInt RoundedDivide(cInt numerator, cInt denominator)
+{
+    if (numerator >= 0)
+        return (numerator + denominator / 2) / denominator;
+    else
+        return -((-numerator + denominator / 2) / denominator);
+}
+
+// Calculate where an edge crosses the given z, the edge has to span it
+// The edge is always walked from its lowest vertex index so both triangles that share it
+// get exactly the same point, otherwise their lines could not be stitched together
+static inline IntPoint EdgePointAtZ(std::size_t vertIdx1, std::size_t vertIdx2, cInt z)
+{
+    const GridVertex &v1 = gridVertices[std::min(vertIdx1, vertIdx2)];
+    const GridVertex &v2 = gridVertices[std::max(vertIdx1, vertIdx2)];
+
+    cInt rise = z - v1.z;
+    cInt height = v2.z - v1.z;
+    if (height < 0)
+    {
+        rise = -rise;
+        height = -height;
+    }
+
+    return IntPoint(v1.x + RoundedDivide((v2.x - v1.x) * rise, height),
+                    v1.y + RoundedDivide((v2.y - v1.y) * rise, height));
+}
+
 static void SliceTrigsToLayersMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
 {
     SlicerLog(std::string("Slicing trigs: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
 
     for (std::size_t i = startIdx; i < endIdx; i++)
     {
-        double zPoint = (double)i * GlobalSettings::LayerHeight.Get();
+        cInt zPoint = std::llround(layerZ[i] * scaleFactor);
         std::vector<TrigLineSegment> &lineList = layerComponents[i].initialLineList;
         lineList.reserve(50); // Maybe a nice amount?
 
@@ -406,108 +601,30 @@ static void SliceTrigsToLayersMF(std::size_t startIdx, std::size_t endIdx, bool*
         {
             Triangle &trig = sliceMesh->trigs[j];
 
-            // Check if the triangle contains the current layer's z
-            double z[3];
-            getTrigPointFloats(trig, z, 2);
-            double minZ = std::min(z[0], std::min(z[1], z[2]));
-            double maxZ = std::max(z[0], std::max(z[1], z[2]));
-            if (minZ != maxZ && zPoint <= maxZ && zPoint >= minZ)
-            {
-                // Determine at which points the z is on the triangle
-
-                // We need to determine which two sides of the triangle intersect with the z point
-                // point A should be the point where these two sides connect
-                // point B and C should therefore be the other two points
-                uint8_t a, b, c;
-                bool set = false;
-                if (zPoint == z[0])
-                {
-                    if (zPoint == z[1])
-                    {
-                        a = 2;
-                        b = 0;
-                        c = 1;
-                        set = true;
-                    }
-                    else if (zPoint == z[2])
-                    {
-                        a = 1;
-                        b = 2;
-                        c = 0;
-                        set = true;
-                    }
-                }
-                else if (zPoint == z[1] && zPoint == z[2])
-                {
-                    a = 0;
-                    b = 1;
-                    c = 2;
-                    set = true;
-                }
+            // Vertices on the layer's z count as below it, so a triangle that only touches the z
+            // with a vertex or an edge is sliced by one of its neighbours and never by both
+            bool above[3];
+            for (uint8_t k = 0; k < 3; k++)
+                above[k] = gridVertices[trig.vertIdxs[k]].z > zPoint;
 
-                if (!set)
-                {
-                    bool oneTwo = false;
-                    bool oneThree = false;
-                    bool twoThree = false;
-
-                    if ((zPoint <= z[0] && zPoint >= z[1]) || (zPoint >= z[0] && zPoint <= z[1]))
-                        oneTwo = true;
-                    if ((zPoint <= z[0] && zPoint >= z[2]) || (zPoint >= z[0] && zPoint <= z[2]))
-                        oneThree = true;
-                    if ((zPoint <= z[1] && zPoint >= z[2]) || (zPoint >= z[1] && zPoint <= z[2]))
-                        twoThree = true;
-
-                    if (oneTwo && oneThree)
-                    {
-                        a = 0;
-                        b = 1;
-                        c = 2;
-                    }
-                    else if (oneTwo && twoThree)
-                    {
-                        a = 1;
-                        b = 2;
-                        c = 0;
-                    }
-                    else
-                    {
-                        a = 2;
-                        b = 0;
-                        c = 1;
-                    }
-                }
+            if (above[0] == above[1] && above[1] == above[2])
+                continue;
 
-                double x[3], y[3];
-                getTrigPointFloats(trig, x, 0);
-                getTrigPointFloats(trig, y, 1);
-
-                // First calculate the relationship of z to x on the one side of the triangle
-                double zToX1 = (z[a] != z[b]) ? ((x[a] - x[b]) / (z[a] - z[b])) : 0;
-                // Then calculate the relationship of z to y on the one side of the triangle
-                double zToY1 = (z[a]  != z[b]) ? ((y[a] - y[b]) / (z[a] - z[b])) : 0;
-                // Then calculate the relationship of z to x on the other side of the triangle
-                double zToX2 = (z[a]  != z[c]) ? ((x[a] - x[c]) / (z[a] - z[c])) : 0;
-                // Then calculate the relationship of z to y on the other side of the triangle
-                double zToY2 = (z[a]  != z[c]) ? ((y[a] - y[c]) / (z[a] - z[c])) : 0;
-
-                // Now calculate the z rise above pointB
-                double zRise1 = zPoint - z[b];
-                // And also the z rise above pointC
-                double zRise2 = zPoint - z[c];
-
-                // We can now calculatet the x and y points on both sides of the triangle using the z rises that were calculated above
-                IntPoint p1 = IntPoint((cInt)((x[b] + zToX1 * zRise1) * scaleFactor),
-                                       (cInt)((y[b] + zToY1 * zRise1) * scaleFactor));
-                IntPoint p2 = IntPoint((cInt)((x[c] + zToX2 * zRise2) * scaleFactor),
-                                       (cInt)((y[c] + zToY2 * zRise2) * scaleFactor));
-
-                if (p1 != p2)
-                {
-                    // Add the line and keep of track of which face it relates to
-                    layerComponents[i].faceToLineIdxs.insert(std::make_pair(j, lineList.size()));
-                    lineList.push_back(TrigLineSegment(p1, p2, j));
-                }
+            // Exactly two sides of the triangle cross the z, each gives one end of the line
+            IntPoint points[2];
+            uint8_t pointCount = 0;
+            for (uint8_t k = 0; k < 3; k++)
+            {
+                uint8_t next = (k + 1) % 3;
+                if (above[k] != above[next])
+                    points[pointCount++] = EdgePointAtZ(trig.vertIdxs[k], trig.vertIdxs[next], zPoint);
+            }
+
+            if (points[0] != points[1])
+            {
+                // Add the line and keep of track of which face it relates to
+                layerComponents[i].faceToLineIdxs.insert(std::make_pair(j, lineList.size()));
+                lineList.push_back(TrigLineSegment(points[0], points[1], j));
             }
         }
     }
@@ -519,7 +636,12 @@ static inline void SliceTrigsToLayers()
 {
     SlicerLog("Slicing triangles into layers");
 
+    gridVertices.resize(sliceMesh->vertexCount);
+    MultiRunFunction(SnapVerticesMF, 0, sliceMesh->vertexCount);
+
     MultiRunFunction(SliceTrigsToLayersMF, 0, layerCount);
+
+    std::vector<GridVertex>().swap(gridVertices);
 }
 
 static inline long SquaredDist(const IntPoint& p1, const IntPoint& p2)
@@ -566,8 +688,7 @@ static inline void ToolpathLines()
         LayerSegment &seg = isle.segments.emplace<LayerSegment>(SegmentType::OutlineSegment);
 
         // Move to the new z position
-        // We need half a layerheight for the filament
-        cInt newZ = (GlobalSettings::LayerHeight.Get() * scaleFactor) * ((double)(i) + 0.5);
+        cInt newZ = LayerPrintZ(i);
         curLayer.initialLayerMoves.emplace_back(lastPoint, lastZ, newZ, curLayer.layerSpeed);
         lastZ = newZ;
 
@@ -593,7 +714,7 @@ static bool InALine(const IntPoint &p1, const IntPoint &p2, const IntPoint &p3)
 
     IntPoint A = p1 - p2;
     IntPoint B = p3 - p2;
-    double dotP = A.X * A.X + B.Y * B.Y;
+    double dotP = (double)A.X * B.X + (double)A.Y * B.Y;
     double magA = std::sqrt(A.X * A.X + A.Y * A.Y);
     double magB = std::sqrt(B.X * B.X + B.Y * B.Y);
 
@@ -610,78 +731,354 @@ static bool InALine(const IntPoint &p1, const IntPoint &p2, const IntPoint &p3)
         return true;
 }
 
-static inline void OptimizePaths(Paths& paths)
+// Statistics that are kept for the simplification of all the paths in a job
+static std::atomic<std::size_t> simplifyPointsIn(0);
+static std::atomic<std::size_t> simplifyPointsOut(0);
+static std::atomic<long long> simplifyMicros(0);
+
+static inline double SquaredDistToLine(const IntPoint &p, const IntPoint &a, const IntPoint &b)
+{
+    // Get the squared distance from p to the closest point on the linesegment from a to b
+    double dX = (double)b.X - a.X;
+    double dY = (double)b.Y - a.Y;
+    double pX = (double)p.X - a.X;
+    double pY = (double)p.Y - a.Y;
+    double lenSq = dX * dX + dY * dY;
+
+    if (lenSq == 0)
+        return pX * pX + pY * pY;
+
+    double t = std::max(0.0, std::min(1.0, (pX * dX + pY * dY) / lenSq));
+    return std::pow(pX - t * dX, 2) + std::pow(pY - t * dY, 2);
+}
+
+// Simplify a closed path with the Douglas-Peucker algorithm so that no removed point deviates
+// more than the allowed amount from the result and then remove the lines that are still too short
+static void SimplifyPath(Path &path, double maxDev, double minLength)
 {
-    for (std::size_t i = 0; i < paths.size(); i++)
+    std::size_t count = path.size();
+    if (count < 4)
+        return;
+
+    // A closed path is split at its first point and the point furthest from it
+    std::size_t farIdx = 0;
+    cInt farDist = 0;
+    for (std::size_t i = 1; i < count; i++)
     {
-        Path &path = paths[i];
-        Path optiPath;
-        optiPath.reserve(path.size());
+        cInt dist = SquaredDist(path[0], path[i]);
+        if (dist > farDist)
+        {
+            farDist = dist;
+            farIdx = i;
+        }
+    }
 
-        if (path.size() < 3)
-            continue;
+    if (farIdx == 0)
+        return;
+
+    std::vector<bool> keep(count, false);
+    keep[0] = true;
+    keep[farIdx] = true;
+
+    // Each range is split at the point furthest from the line between its ends
+    // untill all the points are close enough, the last range wraps back to the first point
+    const double maxDevSq = maxDev * maxDev;
+    std::stack<std::pair<std::size_t, std::size_t>> ranges;
+    ranges.emplace(0, farIdx);
+    ranges.emplace(farIdx, count);
+
+    while (!ranges.empty())
+    {
+        std::size_t first = ranges.top().first;
+        std::size_t last = ranges.top().second;
+        ranges.pop();
+
+        const IntPoint &a = path[first];
+        const IntPoint &b = path[(last == count) ? 0 : last];
+        double worstDist = 0;
+        std::size_t worstIdx = first;
+
+        for (std::size_t i = first + 1; i < last; i++)
+        {
+            double dist = SquaredDistToLine(path[i], a, b);
+            if (dist > worstDist)
+            {
+                worstDist = dist;
+                worstIdx = i;
+            }
+        }
+
+        if (worstDist > maxDevSq)
+        {
+            keep[worstIdx] = true;
+            ranges.emplace(first, worstIdx);
+            ranges.emplace(worstIdx, last);
+        }
+    }
+
+    // Collect the kept points whilst skipping those too close to the previous one, in a separate
+    // path so the original stays untouched when the result turns out too small
+    const cInt minLengthSq = (cInt)(minLength * minLength);
+    Path simplified;
+    simplified.reserve(count);
+    simplified.push_back(path[0]);
+    for (std::size_t i = 1; i < count; i++)
+    {
+        if (keep[i] && SquaredDist(simplified.back(), path[i]) >= minLengthSq)
+            simplified.push_back(path[i]);
+    }
 
-        // Go through each point and check if the next one is either
-        // too close or part of an almost straight line
-        std::size_t j = 0;
-        while (true)
+    // The closing line can also be too short
+    if (simplified.size() > 3 && SquaredDist(simplified.back(), simplified[0]) < minLengthSq)
+        simplified.pop_back();
+
+    // Do not let tiny polygons collapse
+    if (simplified.size() < 3)
+        return;
+
+    simplified.shrink_to_fit();
+    path.swap(simplified);
+}
+
+static inline void SimplifyPaths(Paths& paths)
+{
+    double maxDev = GlobalSettings::SimplifyDeviation.Get() * scaleFactor;
+    double minLength = GlobalSettings::SimplifyMinLength.Get() * scaleFactor;
+
+    if (maxDev <= 0 && minLength <= 0)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t pointsIn = 0;
+    std::size_t pointsOut = 0;
+
+    for (Path &path : paths)
+    {
+        pointsIn += path.size();
+        SimplifyPath(path, maxDev, minLength);
+        pointsOut += path.size();
+    }
+
+    simplifyPointsIn += pointsIn;
+    simplifyPointsOut += pointsOut;
+    simplifyMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+}
+
+static inline void LogSimplification(std::string stage)
+{
+    SlicerLog(stage + " simplification kept " + std::to_string(simplifyPointsOut) + " of "
+              + std::to_string(simplifyPointsIn) + " points in "
+              + std::to_string(simplifyMicros / 1000.0) + "ms of thread time");
+
+    simplifyPointsIn = 0;
+    simplifyPointsOut = 0;
+    simplifyMicros = 0;
+}
+
+// A uniform grid over the two end points of a list of open paths, used to find the closest path end
+// without comparing every path against every other one
+struct PathEndGrid
+{
+    const Paths &paths;
+    cInt cellSize;
+    cInt minCellX, minCellY, maxCellX, maxCellY;
+    std::unordered_map<unsigned long long, std::vector<std::size_t>> cells;
+    std::vector<bool> used;
+
+    PathEndGrid(const Paths &paths, cInt cellSize) :
+        paths(paths), cellSize(std::max(cellSize, (cInt)1)), used(paths.size(), false)
+    {
+        minCellX = minCellY = std::numeric_limits<cInt>::max();
+        maxCellX = maxCellY = std::numeric_limits<cInt>::min();
+
+        for (std::size_t i = 0; i < paths.size(); i++)
+        {
+            if (paths[i].empty())
+            {
+                used[i] = true;
+                continue;
+            }
+
+            // The ends are numbered twice the path index for the front and one more for the back
+            AddEnd(paths[i].front(), i * 2);
+            AddEnd(paths[i].back(), i * 2 + 1);
+        }
+    }
+
+    inline cInt CellOf(cInt coord) const
+    {
+        return (coord >= 0) ? coord / cellSize : -((-coord + cellSize - 1) / cellSize);
+    }
+
+    inline unsigned long long CellKey(cInt cellX, cInt cellY) const
+    {
+        return ((unsigned long long)cellX << 32) ^ (unsigned long long)(cellY & 0xFFFFFFFF);
+    }
+
+    void AddEnd(const IntPoint &point, std::size_t endIdx)
+    {
+        cInt cellX = CellOf(point.X), cellY = CellOf(point.Y);
+        minCellX = std::min(minCellX, cellX);
+        minCellY = std::min(minCellY, cellY);
+        maxCellX = std::max(maxCellX, cellX);
+        maxCellY = std::max(maxCellY, cellY);
+
+        cells[CellKey(cellX, cellY)].push_back(endIdx);
+    }
+
+    void TestCell(cInt cellX, cInt cellY, const IntPoint &point, cInt &bestDist, long &bestEnd) const
+    {
+        auto cellItr = cells.find(CellKey(cellX, cellY));
+        if (cellItr == cells.end())
+            return;
+
+        for (std::size_t endIdx : cellItr->second)
         {
-            IntPoint p1 = path[j];
+            if (used[endIdx / 2])
+                continue;
+
+            const Path &path = paths[endIdx / 2];
+            cInt dist = SquaredDist(point, (endIdx % 2 == 0) ? path.front() : path.back());
 
-            const cInt minDiff = (cInt)(0.075 * 0.075 * scaleFactor * scaleFactor);
-            if (j == path.size()-1)
+            // Prefer the lowest end on ties so the result does not depend on the order in the cell
+            if (dist < bestDist || (dist == bestDist && bestEnd != -1 && (long)endIdx < bestEnd))
             {
-                // The last point should be checked differently to avoid checking the first point again
-                IntPoint p2 = path[0];
-                if ((SquaredDist(p1, p2) >= minDiff) && (!InALine(p1, p2, path[1])))
-                    optiPath.push_back(p2);
+                bestDist = dist;
+                bestEnd = endIdx;
+            }
+        }
+    }
+
+    // Find the closest end of an unused path that is less than the given squared distance away
+    // by searching rings of cells around the point, returns -1 if there is none
+    long FindClosestEnd(const IntPoint &point, cInt maxDist) const
+    {
+        cInt cellX = CellOf(point.X), cellY = CellOf(point.Y);
+        cInt maxRing = std::max(std::max(cellX - minCellX, maxCellX - cellX),
+                                std::max(cellY - minCellY, maxCellY - cellY));
 
+        cInt bestDist = maxDist;
+        long bestEnd = -1;
+        for (cInt ring = 0; ring <= maxRing; ring++)
+        {
+            // Everything in this ring and beyond is at least this far away
+            cInt ringDist = std::max(ring - 1, (cInt)0) * cellSize;
+            if (ring > 0 && ringDist * ringDist >= bestDist)
                 break;
+
+            for (cInt x = cellX - ring; x <= cellX + ring; x++)
+            {
+                TestCell(x, cellY - ring, point, bestDist, bestEnd);
+                if (ring > 0)
+                    TestCell(x, cellY + ring, point, bestDist, bestEnd);
             }
-            else
+
+            for (cInt y = cellY - ring + 1; y < cellY + ring; y++)
             {
-                std::size_t k = j + 1;
-                IntPoint p2 = path[k];
+                TestCell(cellX - ring, y, point, bestDist, bestEnd);
+                TestCell(cellX + ring, y, point, bestDist, bestEnd);
+            }
+        }
 
-                // Skip past all the very close points
-                while ((k < path.size()-1) && (SquaredDist(p1, p2) < minDiff))
-                {
-                    k++;
-                    p2 = path[k];
-                }
+        return bestEnd;
+    }
+};
 
-                // Skip past points almost in line with their following
-                // and previous points
-                bool inLine = true;
-                while ((k < path.size()-1) && inLine)
-                {
-                    IntPoint p3 = path[(k == path.size()) ? 0 : k + 1];
+// Join open paths into chains, by repeatedly connecting the end of a chain to the closest end of another path
+// Normally a chain is closed once its ends are less than the minimum gap apart and left open when no path
+// is found within three times that gap. When forcing, chains are extended as long as a path end is closer
+// than the start of the chain, and are closed after that whatever gap is left
+static void ChainOpenPaths(Paths &openPaths, cInt minDiff, bool force, Paths &closedPaths, Paths &stillOpen)
+{
+    if (openPaths.empty())
+        return;
 
-                    if (InALine(p1, p2, p3))
-                    {
-                        k++;
-                        p2 = path[k];
-                    }
-                    else
-                        inLine = false;
-                }
+    // Without a limit on the gap the cells are sized to hold about one path end each
+    cInt cellSize = std::sqrt(3 * minDiff);
+    if (force)
+    {
+        IntRect bounds = { std::numeric_limits<cInt>::max(), std::numeric_limits<cInt>::max(),
+                           std::numeric_limits<cInt>::min(), std::numeric_limits<cInt>::min() };
+        for (const Path &path : openPaths)
+        {
+            for (const IntPoint &point : { path.front(), path.back() })
+            {
+                bounds.left = std::min(bounds.left, point.X);
+                bounds.top = std::min(bounds.top, point.Y);
+                bounds.right = std::max(bounds.right, point.X);
+                bounds.bottom = std::max(bounds.bottom, point.Y);
+            }
+        }
 
-                if (k >= path.size())
-                    j = path.size()-1;
-                else
-                    j = k;
+        cInt extent = std::max(bounds.right - bounds.left, bounds.bottom - bounds.top);
+        cellSize = std::max(cellSize, extent / (cInt)std::ceil(std::sqrt(2.0 * openPaths.size())));
+    }
+
+    PathEndGrid grid(openPaths, cellSize);
+
+    // The paths a chain is made of and whether each is walked backwards, only copied together once it is done
+    std::vector<std::pair<std::size_t, bool>> chain;
+
+    for (std::size_t a = 0; a < openPaths.size(); a++)
+    {
+        if (grid.used[a])
+            continue;
+
+        grid.used[a] = true;
+        chain.clear();
+        chain.emplace_back(a, false);
 
-                // We can now add the valid point and search for the next one
-                optiPath.push_back(p2);
+        const IntPoint &chainFront = openPaths[a].front();
+        IntPoint chainBack = openPaths[a].back();
+        std::size_t chainSize = openPaths[a].size();
+        bool closed = true;
+
+        while (force || SquaredDist(chainFront, chainBack) > minDiff)
+        {
+            cInt maxDist = force ? SquaredDist(chainFront, chainBack) : minDiff * 3;
+            long bestEnd = grid.FindClosestEnd(chainBack, maxDist);
+
+            if (bestEnd == -1)
+            {
+                // We will try to force it closed later
+                closed = force;
+                if (force)
+                    std::cout << "Forced close: " << a << std::endl;
+                break;
             }
+
+            // Connecting to the back of a path means walking it backwards
+            std::size_t pathIdx = bestEnd / 2;
+            bool reversed = (bestEnd % 2 == 1);
+            grid.used[pathIdx] = true;
+            chain.emplace_back(pathIdx, reversed);
+
+            chainBack = reversed ? openPaths[pathIdx].front() : openPaths[pathIdx].back();
+            chainSize += openPaths[pathIdx].size();
         }
 
-        // Finally we can move to the optimized path
-        optiPath.shrink_to_fit();
-        paths[i] = optiPath;
+        Paths &target = closed ? closedPaths : stillOpen;
+        target.emplace_back();
+        Path &chainPath = target.back();
+        chainPath.reserve(chainSize);
+
+        for (const std::pair<std::size_t, bool> &link : chain)
+        {
+            const Path &path = openPaths[link.first];
+            if (link.second)
+                chainPath.insert(chainPath.end(), path.rbegin(), path.rend());
+            else
+                chainPath.insert(chainPath.end(), path.begin(), path.end());
+        }
     }
+
+    openPaths.clear();
 }
 
+static std::atomic<std::size_t> openPathCount(0);
+static std::atomic<long long> chainMicros(0);
+
 static void CalculateIslandsFromInitialLinesMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
 {
     SlicerLog(std::string("Calculating islands: ") + std::to_string(startIdx)
@@ -799,126 +1196,27 @@ static void CalculateIslandsFromInitialLinesMF(std::size_t startIdx, std::size_t
 
         const cInt minDiff = (cInt)(0.05 * 0.05 * scaleFactor * scaleFactor);
 
-        //Paths toForceClose;
-        Paths toClose;
+        auto chainStart = std::chrono::steady_clock::now();
+        openPathCount += openPaths.size();
 
         // First try to close up little gaps or create longer chains
-        for (std::size_t a = 0; a < openPaths.size(); a++)
-        {
-            if (openPaths[a].size() == 0)
-                continue;
-
-            closedPaths.emplace_back(openPaths[a]);
-            Path &closedPath = closedPaths.back();
-            openPaths[a].clear();
-
-            while (SquaredDist(closedPath.front(), closedPath.back()) > minDiff)
-            {
-                cInt bestDiff = minDiff * 3;
-                long bestIdx = -1;
-                bool bestSwapped = false;
-
-                for (std::size_t b = a + 1; b < openPaths.size(); b++)
-                {
-                    if (openPaths[b].size() == 0)
-                        continue;
-
-                    const Path &testPath = openPaths[b];
-                    if (SquaredDist(closedPath.back(), testPath.front()) < bestDiff)
-                    {
-                        bestIdx = b;
-                        bestDiff = SquaredDist(closedPath.back(), testPath.front());
-                        bestSwapped = false;
-                    }
-                    else if (SquaredDist(closedPath.back(), testPath.back()) < bestDiff)
-                    {
-                        bestIdx = b;
-                        bestDiff = SquaredDist(closedPath.back(), testPath.back());
-                        bestSwapped = true;
-                    }
-                }
-
-                if (bestIdx == -1)
-                {
-                    // We will try to force it closed later
-                    toClose.emplace_back(std::move(closedPath));
-                    closedPaths.pop_back();
-
-                    break;
-                }
-                else
-                {
-                    if (bestSwapped)
-                        std::reverse(openPaths[bestIdx].begin(), openPaths[bestIdx].end());
-
-                    closedPath.reserve(closedPath.size() + openPaths[bestIdx].size());
-                    closedPath.insert(closedPath.begin(), openPaths[bestIdx].begin(), openPaths[bestIdx].end());
-                    openPaths[bestIdx].clear();
-                }
-            }
-        }
+        Paths toClose;
+        ChainOpenPaths(openPaths, minDiff, false, closedPaths, toClose);
 
         if (toClose.size() > 0)
             std::cout << "To force: " << toClose.size()
                       << " closed: " << closedPaths.size() << std::endl;
 
         // Finally pair up the chains that need to be forced close
-        for (std::size_t a = 0; a < toClose.size(); a++)
-        {
-            if (toClose[a].size() == 0)
-                continue;
+        Paths unused;
+        ChainOpenPaths(toClose, minDiff, true, closedPaths, unused);
 
-            closedPaths.emplace_back(toClose[a]);
-            Path &forcedPath = closedPaths.back();
-            toClose[a].clear();
+        chainMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - chainStart).count();
 
-            while (true)
-            {
-                cInt bestDiff = SquaredDist(forcedPath.front(), forcedPath.back());
-                long bestIdx = -1;
-                bool bestSwapped = false;
-
-                for (std::size_t b = a + 1; b < toClose.size(); b++)
-                {
-                    if (toClose[b].size() == 0)
-                        continue;
-
-                    const Path &testPath = toClose[b];
-                    if (SquaredDist(forcedPath.back(), testPath.front()) < bestDiff)
-                    {
-                        bestIdx = b;
-                        bestDiff = SquaredDist(forcedPath.back(), testPath.front());
-                        bestSwapped = false;
-                    }
-                    else if (SquaredDist(forcedPath.back(), testPath.back()) < bestDiff)
-                    {
-                        bestIdx = b;
-                        bestDiff = SquaredDist(forcedPath.back(), testPath.back());
-                        bestSwapped = true;
-                    }
-                }
-
-                if (bestIdx == -1)
-                {
-                    // Close is up
-                    std::cout << "Forced close: " << a << std::endl;
-                    break;
-                }
-                else
-                {
-                    if (bestSwapped)
-                        std::reverse(toClose[bestIdx].begin(), toClose[bestIdx].end());
-
-                    forcedPath.reserve(forcedPath.size() + toClose[bestIdx].size());
-                    forcedPath.insert(forcedPath.begin(), toClose[bestIdx].begin(), toClose[bestIdx].end());
-                    toClose[bestIdx].clear();
-                }
-            }
-        }
-
-#ifndef TEST_NO_OPTIMIZE
-        OptimizePaths(closedPaths);
-#endif
+#ifndef TEST_NO_OPTIMIZE
+        SimplifyPaths(closedPaths);
+#endif
 
         // We now need to put the newly created polygons through clipper sothat it can detect holes for us
         // and then make proper islands with the returned data
@@ -928,12 +1226,15 @@ static void CalculateIslandsFromInitialLinesMF(std::size_t startIdx, std::size_t
         clipper.AddPaths(closedPaths, PolyType::ptSubject, true);
         clipper.Execute(ClipType::ctUnion, resultTree, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
         clipper.Execute(ClipType::ctUnion, resultTree);
+        PolyTreeToPaths(resultTree, layerComp.outlinePaths);
 
         // We need to itterate through the tree recursively because of its child structure
         ProcessPolyNode(&resultTree, layerComp.islandList);
 
-        // Optimize memory usage
+        // Optimize memory usage, the initial lines are not needed anymore once the islands are known
         layerComp.islandList.shrink_to_fit();
+        std::vector<TrigLineSegment>().swap(lineList);
+        layerComp.faceToLineIdxs.clear();
     }
 
     *doneFlag = true;
@@ -943,14 +1244,70 @@ static inline void CalculateIslandsFromInitialLines()
 {
     SlicerLog("Calculating initial islands");
 
+    openPathCount = 0;
+    chainMicros = 0;
+
     MultiRunFunction(CalculateIslandsFromInitialLinesMF, 0, layerCount);
+
+    LogSimplification("Island");
+    SlicerLog("Gaps: " + std::to_string(openPathCount) + " open paths joined in "
+              + std::to_string(chainMicros / 1000.0) + "ms of thread time");
+}
+
+// Walls narrower than this are too thin to print at all, wider ones that can not fit
+// an outer shell are filled with solid lines instead
+const cInt MinThinWallWidth = (cInt)(NozzleWidth * scaleFactor / 4);
+
+static std::atomic<std::size_t> thinWallCount(0);
+static std::atomic<long long> outlineMicros(0);
+
+// Determine the parts of an island that are lost when it is shrunk to the centre of the outer shell,
+// by growing the shrunk outline again and looking at what is left of the original
+static void FindThinWalls(ClipperOffset &offset, const Paths &islandPaths, const Paths &shrunkPaths,
+                          cInt halfNozzle, Paths &thinWalls)
+{
+    Paths grown;
+    offset.Clear();
+    offset.AddPaths(shrunkPaths, JoinType::jtMiter, EndType::etClosedPolygon);
+    offset.Execute(grown, halfNozzle);
+
+    // Most islands survive the shrinking as is, which is cheaper to find by area than by clipping
+    double lostArea = 0;
+    for (const Path &path : islandPaths)
+        lostArea += Area(path);
+    for (const Path &path : grown)
+        lostArea -= Area(path);
+
+    if (lostArea < (double)MinThinWallWidth * NozzleWidth * scaleFactor)
+        return;
+
+    Paths lost;
+    Clipper clipper;
+    clipper.AddPaths(islandPaths, PolyType::ptSubject, true);
+    clipper.AddPaths(grown, PolyType::ptClip, true);
+    clipper.Execute(ClipType::ctDifference, lost, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
+
+    // Remove the slivers left along the outline and in the corners
+    offset.Clear();
+    offset.AddPaths(lost, JoinType::jtMiter, EndType::etClosedPolygon);
+    offset.Execute(lost, -MinThinWallWidth / 2);
+    offset.Clear();
+    offset.AddPaths(lost, JoinType::jtMiter, EndType::etClosedPolygon);
+    offset.Execute(thinWalls, MinThinWallWidth / 2);
 }
 
 static void GenerateOutlineSegmentsMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
 {
     SlicerLog(std::string("Outline: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
 
-    cInt halfNozzle = -(NozzleWidth * scaleFactor / 2.0);
+    auto start = std::chrono::steady_clock::now();
+    cInt nozzle = NozzleWidth * scaleFactor;
+    cInt halfNozzle = nozzle / 2;
+    std::size_t shellCount = std::ceil(GlobalSettings::ShellThickness.Get());
+    std::size_t thinWalls = 0;
+
+    // Every shell is offset from the one before it, so a single offsetter can be reused for all of them
+    ClipperOffset offset;
 
     for (std::size_t i = startIdx; i < endIdx; i++)
     {
@@ -968,32 +1325,57 @@ static void GenerateOutlineSegmentsMF(std::size_t startIdx, std::size_t endIdx,
             // than the sliced outline, ths is sothat the dimensions
             // do not change once extruded
             Paths outline;
-            ClipperOffset offset;
+            offset.Clear();
             offset.AddPaths(isle.outlinePaths, JoinType::jtMiter, EndType::etClosedPolygon);
-            offset.Execute(outline, halfNozzle);
+            offset.Execute(outline, -halfNozzle);
+
+            // Parts of the island that are too thin for the outer shell would otherwise not be printed at all
+            Paths thinWallPaths;
+            FindThinWalls(offset, isle.outlinePaths, outline, halfNozzle, thinWallPaths);
 
-            for (std::size_t j = 0; j < GlobalSettings::ShellThickness.Get(); j++)
+            for (std::size_t j = 0; j < shellCount && !outline.empty(); j++)
             {
                 // Place the newly created outline in its own segment
                 LayerSegment &outlineSegment = isle.segments.emplace<LayerSegment>(SegmentType::OutlineSegment);
                 outlineSegment.segmentSpeed = layerComp.layerSpeed;
-                outlineSegment.outlinePaths = outline;
-                cInt dist = halfNozzle - (cInt)(NozzleWidth * scaleFactor * (j + 1));
+                outlineSegment.outlinePaths = std::move(outline);
+#ifndef TEST_NO_OPTIMIZE
+                SimplifyPaths(outlineSegment.outlinePaths);
+#endif
 
-                //We now shrink the outline with one extrusion width for the next shell if any
+                // We now shrink the outline with one extrusion width for the next shell if any,
+                // an empty result means that no further shells or infill fit inside
                 offset.Clear();
-                offset.AddPaths(isle.outlinePaths, JoinType::jtMiter, EndType::etClosedPolygon);
-                offset.Execute(outline, dist);
+                offset.AddPaths(outlineSegment.outlinePaths, JoinType::jtMiter, EndType::etClosedPolygon);
+                offset.Execute(outline, -nozzle);
+            }
+
+            if (!thinWallPaths.empty())
+            {
+                SegmentWithInfill &thinWallSegment = isle.segments.emplace<SegmentWithInfill>(SegmentType::ThinWallSegment);
+                thinWallSegment.segmentSpeed = layerComp.layerSpeed;
+                thinWallSegment.outlinePaths = std::move(thinWallPaths);
+                thinWalls++;
             }
 
             // We now need to store the smallest outline as the new layer outline for infill trimming purposes
             // the current outline though is just half an extrusion width to small
+            if (outline.empty())
+            {
+                isle.outlinePaths.clear();
+                continue;
+            }
+
             offset.Clear();
             offset.AddPaths(outline, JoinType::jtMiter, EndType::etClosedPolygon);
-            offset.Execute(isle.outlinePaths, NozzleWidth * scaleFactor);
+            offset.Execute(isle.outlinePaths, nozzle);
         }
     }
 
+    thinWallCount += thinWalls;
+    outlineMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
     *doneFlag = true;
 }
 
@@ -1005,7 +1387,14 @@ static inline void GenerateOutlineSegments()
     if (GlobalSettings::ShellThickness.Get() < 1)
         return;
 
+    thinWallCount = 0;
+    outlineMicros = 0;
+
     MultiRunFunction(GenerateOutlineSegmentsMF, 0, layerCount);
+
+    LogSimplification("Shell");
+    SlicerLog("Shells: " + std::to_string(thinWallCount) + " thin walls in "
+              + std::to_string(outlineMicros / 1000.0) + "ms of thread time");
 }
 
 #ifdef TEST_ISLAND_DETECTION
@@ -1054,9 +1443,13 @@ static inline void CalculateDensityDividers()
 {
     densityDividers.clear();
 
-    CalculateDensityDivider(15.0f);
+    if (GlobalSettings::InfillDensity.Get() > 0)
+        CalculateDensityDivider(GlobalSettings::InfillDensity.Get());
     CalculateDensityDivider(100.0f);
-    CalculateDensityDivider(10.0f);
+    if (GlobalSettings::SupportDensity.Get() > 0)
+        CalculateDensityDivider(GlobalSettings::SupportDensity.Get());
+    if (GlobalSettings::RaftDensity.Get() > 0)
+        CalculateDensityDivider(GlobalSettings::RaftDensity.Get());
 }
 #endif
 
@@ -1142,7 +1535,8 @@ static inline void GenerateInfillGrids()
 
     GenerateInfillGrid(15.0f);
     GenerateInfillGrid(100.0f);
-    GenerateInfillGrid(10.0f);
+    GenerateInfillGrid(GlobalSettings::SupportDensity.Get());
+    GenerateInfillGrid(GlobalSettings::RaftDensity.Get());
 }
 #endif
 
@@ -1153,9 +1547,19 @@ static inline void CalculateTopBottomSegments()
     // TODO: implement seperate top and bottom thickness
     cInt partNozzle = (NozzleWidth * scaleFactor / 10.0);
 
-    std::size_t tBCount = std::ceil(GlobalSettings::TopBottomThickness.Get() / GlobalSettings::LayerHeight.Get());
+    // Layers can have different heights so the layers that are part of the top or bottom are
+    // determined by their distance instead of their count
+    double tBThickness = GlobalSettings::TopBottomThickness.Get();
+
+    // The raft layers come first and are still empty, the mesh starts on the layer after them
+    const std::size_t first = raftLayerCount;
+    if (first >= layerCount)
+        return;
 
-    // We can run the top and bottom segment generation in 2 threads because they are independant
+    // We can run the top and bottom segment generation in 2 threads because they are independant,
+    // only the top thread adds segments to the islands whilst the bottom one stores its outlines for
+    // each island to add them afterwards
+    std::vector<std::vector<Paths>> bottomOutlines(layerCount);
 
     std::thread topThread([=]()
     {
@@ -1171,16 +1575,16 @@ static inline void CalculateTopBottomSegments()
         Clipper clipper;
         ClipperOffset offset;
 
-        if (tBCount > 0) // TODO: top
+        if (tBThickness > 0) // TODO: top
         {
-            for (std::size_t i = 1; i < layerCount - tBCount; i++)
+            for (std::size_t i = first + 1; i < layerCount && !WithinHeight(layerZ[i], layerZ[layerCount - 1], tBThickness); i++)
             {
                 SlicerLog("Top: " + std::to_string(i));
 
                 //First we need to calculate the intersection of the top few layers above it
                 Paths aboveIntersection;
 
-                for (std::size_t j = i + 1; j < std::min(i + tBCount + 1, layerCount); j++)
+                for (std::size_t j = i + 1; j < layerCount && WithinHeight(layerZ[i + 1], layerZ[j], tBThickness); j++)
                 {
                     Paths combinedIsles;
 
@@ -1232,7 +1636,7 @@ static inline void CalculateTopBottomSegments()
                 }
             }
 
-            for (std::size_t i = layerCount - 1; i > layerCount - tBCount - 1; i--)
+            for (std::size_t i = layerCount - 1; i < layerCount && i >= first && WithinHeight(layerZ[i], layerZ[layerCount - 1], tBThickness); i--)
             {
                 SlicerLog("Top: " + std::to_string(i));
 
@@ -1250,7 +1654,7 @@ static inline void CalculateTopBottomSegments()
         }
     });
 
-    std::thread bottomThread([=](){
+    std::thread bottomThread([=, &bottomOutlines](){
         // To calculate the bottom segments we need to go from the top down,
         // take each island as a subject, take the outline of the layer below
         // as a clipper and perform a difference operation. The result will
@@ -1261,19 +1665,16 @@ static inline void CalculateTopBottomSegments()
         Clipper clipper;
         ClipperOffset offset;
 
-        if (tBCount > 0) // TODO: bottom
+        if (tBThickness > 0) // TODO: bottom
         {
-            for (std::size_t i = layerCount - 2; i > tBCount - 1; i--)
+            for (std::size_t i = layerCount - 2; i < layerCount && i > first && !WithinHeight(layerZ[first], layerZ[i], tBThickness); i--)
             {
-                if (i < 1)
-                    continue;
-
                 SlicerLog("Bottom: " + std::to_string(i));
 
                 // First we need to calculate the intersection of the bottom few layers below it
                 Paths belowIntersection;
 
-                for (std::size_t j = i - 1; j > std::max(i - 1 - tBCount, (std::size_t)0); j--)
+                for (std::size_t j = i - 1; j > first && WithinHeight(layerZ[j], layerZ[i - 1], tBThickness); j--)
                 {
                     Paths combinedIsles;
 
@@ -1304,39 +1705,28 @@ static inline void CalculateTopBottomSegments()
                 offset.AddPaths(belowIntersection, JoinType::jtMiter, EndType::etClosedPolygon);
                 offset.Execute(belowIntersection, partNozzle);
 
-                for (LayerIsland &isle : layerComponents[i].islandList)
+                std::vector<LayerIsland> &isles = layerComponents[i].islandList;
+                bottomOutlines[i].resize(isles.size());
+
+                for (std::size_t k = 0; k < isles.size(); k++)
                 {
-                    SegmentWithInfill &bottomSegment = isle.segments.emplace<SegmentWithInfill>(SegmentType::BottomSegment);
                     clipper.Clear();
-                    clipper.AddPaths(isle.outlinePaths, PolyType::ptSubject, true);
+                    clipper.AddPaths(isles[k].outlinePaths, PolyType::ptSubject, true);
                     clipper.AddPaths(belowIntersection, PolyType::ptClip, true);
-                    clipper.Execute(ClipType::ctDifference, bottomSegment.outlinePaths);
-
-                    if (bottomSegment.outlinePaths.size() > 0)
-                    {
-                        // All non initial layer bottom segments are probably bridges
-                        // TODO: implement bridge speed
-                        bottomSegment.segmentSpeed = GlobalSettings::TravelSpeed.Get();
-                        // Extrude more for a bridge
-                        bottomSegment.infillMultiplier = 2.0f;
-                    }
-                    else
-                        isle.segments.pop_back();
+                    clipper.Execute(ClipType::ctDifference, bottomOutlines[i][k]);
                 }
             }
 
             // Every island in the bottom layer is obviously a bottom segment
-            for (std::size_t i = 0; i < tBCount; i++)
+            for (std::size_t i = first; i < layerCount && WithinHeight(layerZ[first], layerZ[i], tBThickness); i++)
             {
                 SlicerLog("Bottom: " + std::to_string(i));
 
-                for (LayerIsland &isle : layerComponents[i].islandList)
-                {
-                    SegmentWithInfill &bottomSegment = isle.segments.emplace<SegmentWithInfill>(SegmentType::BottomSegment);
-                    bottomSegment.outlinePaths = isle.outlinePaths;
-                    // Initial bottom segments should not be bridges
-                    bottomSegment.segmentSpeed = GlobalSettings::InfillSpeed.Get();
-                }
+                std::vector<LayerIsland> &isles = layerComponents[i].islandList;
+                bottomOutlines[i].resize(isles.size());
+
+                for (std::size_t k = 0; k < isles.size(); k++)
+                    bottomOutlines[i][k] = isles[k].outlinePaths;
             }
         }
     });
@@ -1344,6 +1734,36 @@ static inline void CalculateTopBottomSegments()
     // Wait for the threads to finish
     topThread.join();
     bottomThread.join();
+
+    for (std::size_t i = first; i < layerCount; i++)
+    {
+        // The islands of the first layers are bottom segments as a whole
+        bool initialBottom = WithinHeight(layerZ[first], layerZ[i], tBThickness);
+
+        for (std::size_t k = 0; k < bottomOutlines[i].size(); k++)
+        {
+            if (bottomOutlines[i][k].empty())
+                continue;
+
+            LayerIsland &isle = layerComponents[i].islandList[k];
+            SegmentWithInfill &bottomSegment = isle.segments.emplace<SegmentWithInfill>(SegmentType::BottomSegment);
+            bottomSegment.outlinePaths = std::move(bottomOutlines[i][k]);
+
+            if (initialBottom)
+            {
+                // Initial bottom segments should not be bridges
+                bottomSegment.segmentSpeed = GlobalSettings::InfillSpeed.Get();
+            }
+            else
+            {
+                // All non initial layer bottom segments are probably bridges
+                // TODO: implement bridge speed
+                bottomSegment.segmentSpeed = GlobalSettings::TravelSpeed.Get();
+                // Extrude more for a bridge
+                bottomSegment.infillMultiplier = 2.0f;
+            }
+        }
+    }
 }
 
 static void CalculateInfillSegmentsMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
@@ -1395,151 +1815,362 @@ static inline void CalculateInfillSegments()
     MultiRunFunction(CalculateInfillSegmentsMF, 0, layerCount);
 }
 
-static inline void CalculateSupportSegments()
+// The overhangs of each layer, and the part of each layer that has to stay free of support
+static std::vector<Paths> layerOverhangs;
+static std::vector<Paths> layerSupportFree;
+
+static void CalculateOverhangsMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
 {
-    // TODO: implement this
+    SlicerLog(std::string("Overhangs: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
+
+    double overhangSlope = std::tan(GlobalSettings::SupportAngle.Get() / 180.0 * PI);
+    cInt supportDistance = GlobalSettings::SupportDistance.Get() * scaleFactor;
+    cInt minOverhang = NozzleWidth * scaleFactor / 8;
+
+    ClipperOffset offset;
+    Clipper clipper;
+
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        const LayerComponent &layerComp = layerComponents[i];
+
+        // The support keeps its distance from the model
+        offset.Clear();
+        offset.AddPaths(layerComp.outlinePaths, JoinType::jtMiter, EndType::etClosedPolygon);
+        offset.Execute(layerSupportFree[i], supportDistance);
+
+        // The first layer of the mesh rests on the bed or the raft
+        if (i <= raftLayerCount)
+            continue;
+
+        // The layer below supports everything that does not stick out over it further than the overhang angle allows
+        Paths supported;
+        offset.Clear();
+        offset.AddPaths(layerComponents[i - 1].outlinePaths, JoinType::jtMiter, EndType::etClosedPolygon);
+        offset.Execute(supported, layerHeights[i] * overhangSlope * scaleFactor);
+
+        Paths overhang;
+        clipper.Clear();
+        clipper.AddPaths(layerComp.outlinePaths, PolyType::ptSubject, true);
+        clipper.AddPaths(supported, PolyType::ptClip, true);
+        clipper.Execute(ClipType::ctDifference, overhang, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
+
+        if (overhang.empty())
+            continue;
+
+        // Remove the slivers that are left along walls that are just within the angle
+        offset.Clear();
+        offset.AddPaths(overhang, JoinType::jtMiter, EndType::etClosedPolygon);
+        offset.Execute(overhang, -minOverhang);
+        offset.Clear();
+        offset.AddPaths(overhang, JoinType::jtMiter, EndType::etClosedPolygon);
+        offset.Execute(layerOverhangs[i], minOverhang);
+    }
+
+    *doneFlag = true;
 }
 
-#ifdef COMBINE_INFILL
-static inline void CombineInfillSegments()
+static void GenerateSupportIslandsMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
 {
-    SlicerLog("Combining infill segments");
+    SlicerLog(std::string("Support: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
 
-    // To combine the infill segments we have to go through each layer, for each infill segment int that layer we need to perform
-    // an intersection test with all the above layers infill segments. The combined segments should then be separated from its original
-    // segments in both the first and the second layer, the same operation should then be performed with the result and all the infill
-    // segments above it untill it has been done for the amount of layers specified int global values. The bottom one of the infill segment
-    // will be completely removed from its layer. The extrusion multiplier of each segment will be determined by how many layers of infill
-    // it represents
+    cInt halfNozzle = NozzleWidth * scaleFactor / 2;
 
-    std::size_t combCount = GlobalSettings::InfillCombinationCount.Get();
-    if (combCount < 2)
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        // The support area of the layer was stored in place of the area that had to stay free
+        Paths &supportArea = layerSupportFree[i];
+        if (supportArea.empty())
+            continue;
+
+        // The support is shrunk just like the outlines so it does not grow once extruded
+        PolyTree supportTree;
+        ClipperOffset offset;
+        offset.AddPaths(supportArea, JoinType::jtMiter, EndType::etClosedPolygon);
+        offset.Execute(supportTree, -halfNozzle);
+
+        // Each separate part of the support becomes an island of its own so the toolpath can order it
+        std::vector<LayerIsland> supportIsles;
+        ProcessPolyNode(&supportTree, supportIsles);
+
+        for (LayerIsland &isle : supportIsles)
+        {
+            SegmentWithInfill &supportSeg = isle.segments.emplace<SegmentWithInfill>(SegmentType::SupportSegment);
+            supportSeg.segmentSpeed = GlobalSettings::InfillSpeed.Get();
+            supportSeg.outlinePaths = isle.outlinePaths;
+
+            layerComponents[i].islandList.emplace_back(std::move(isle));
+        }
+    }
+
+    *doneFlag = true;
+}
+
+static inline void CalculateSupportSegments()
+{
+    if (GlobalSettings::Support.Get() < 1 || layerCount < raftLayerCount + 3)
         return;
 
+    SlicerLog("Calculating support segments");
+
+    layerOverhangs.assign(layerCount, Paths());
+    layerSupportFree.assign(layerCount, Paths());
+
+    // Finding the overhangs only needs the layer itself and the one below
+    MultiRunFunction(CalculateOverhangsMF, 0, layerCount);
+
+    // The support then grows downwards from the overhangs until it reaches the model, the raft or the bed, one
+    // layer is left empty between the support and the overhang above it so the two do not fuse together
+    Paths supportArea;
+    Clipper clipper;
+    std::size_t supportedLayers = 0;
+
+    for (std::size_t i = layerCount; i-- > raftLayerCount;)
+    {
+        clipper.Clear();
+        clipper.AddPaths(supportArea, PolyType::ptSubject, true);
+        if (i + 2 < layerCount)
+            clipper.AddPaths(layerOverhangs[i + 2], PolyType::ptSubject, true);
+        clipper.AddPaths(layerSupportFree[i], PolyType::ptClip, true);
+        clipper.Execute(ClipType::ctDifference, supportArea, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
+
+        layerSupportFree[i] = supportArea;
+        if (!supportArea.empty())
+            supportedLayers++;
+    }
+
+    MultiRunFunction(GenerateSupportIslandsMF, 0, layerCount);
+
+    SlicerLog("Support: " + std::to_string(supportedLayers) + " layers with support");
+
+    // Free the memory
+    std::vector<Paths>().swap(layerOverhangs);
+    std::vector<Paths>().swap(layerSupportFree);
+}
+
+static void CombineInfillSegmentsMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+{
+    SlicerLog(std::string("Combine infill: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
+
+    // The layers are combined in groups of the combination count from the bottom up, the infill that all the layers
+    // in a group have in common is removed from each of them and then extruded only on the topmost layer of the group
+    // with the thickness of all the layers in the group. Because the groups do not overlap they can be processed
+    // in parallel.
+
+    std::size_t combCount = GlobalSettings::InfillCombinationCount.Get();
     Clipper clipper;
 
-    for (std::size_t i = layerCount - 1; i > 0; i -= combCount)
+    for (std::size_t g = startIdx; g < endIdx; g++)
     {
-        Paths belowInfill;
+        std::size_t firstLayer = raftLayerCount + g * combCount;
+        std::size_t topLayer = std::min(firstLayer + combCount, layerCount) - 1;
+
+        SlicerLog("Combine infill: " + std::to_string(g));
 
-        //This will indicate how many layers have been combined
-        short combinedLayerCount = 1;
+        if (topLayer <= firstLayer)
+            continue;
+
+        // First determine the infill that all the layers in the group have in common
+        Paths commonInfill;
 
-        // Then figure out to what extent it intersects with the layers below
-        for (std::size_t j = i - 1; j > i - combCount && j > 0; j--)
+        for (std::size_t j = firstLayer; j <= topLayer; j++)
         {
             // Fist combine all the infill segments for the layer
             Paths combinedInfill;
+            clipper.Clear();
 
-            for (LayerIsland &isle : layerComponents[i].islandList)
+            for (LayerIsland &isle : layerComponents[j].islandList)
             {
                 for (LayerSegment *seg : isle.segments)
                 {
-                    if (seg->type != SegmentType::InfillSegment)
-                        continue;
-
-                    clipper.Clear();
-                    clipper.AddPaths(combinedInfill, PolyType::ptSubject, true);
-                    clipper.AddPaths(seg->outlinePaths, PolyType::ptClip, true);
-                    clipper.Execute(ClipType::ctUnion, combinedInfill);
+                    if (seg->type == SegmentType::InfillSegment)
+                        clipper.AddPaths(seg->outlinePaths, PolyType::ptSubject, true);
                 }
             }
 
-            if (belowInfill.size() > 0)
+            clipper.Execute(ClipType::ctUnion, combinedInfill, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
+
+            if (j == firstLayer)
+                commonInfill = combinedInfill;
+            else
             {
-                // Then determine which part intersects with the previous layer's infill
+                // Then determine which part intersects with the previous layers' infill
                 clipper.Clear();
-                clipper.AddPaths(belowInfill, PolyType::ptClip, true);
-                clipper.AddPaths(combinedInfill, PolyType::ptSubject, true);
-                clipper.Execute(ClipType::ctIntersection, combinedInfill);
+                clipper.AddPaths(commonInfill, PolyType::ptSubject, true);
+                clipper.AddPaths(combinedInfill, PolyType::ptClip, true);
+                clipper.Execute(ClipType::ctIntersection, commonInfill);
             }
-            else
-                belowInfill = combinedInfill;
 
-            combinedLayerCount++;
+            if (commonInfill.size() < 1)
+                break;
         }
 
-        for (LayerIsland &mainIsle : layerComponents[i].islandList)
-        {
-            Paths commonInfill;
+        if (commonInfill.size() < 1)
+            continue;
 
-            // Start by setting all the infill in the current island as the base
-            for (LayerSegment *layerSeg : mainIsle.segments)
+        // We should now subtract the common infill from all the layers in the group
+        for (std::size_t j = firstLayer; j <= topLayer; j++)
+        {
+            for (LayerIsland &isle : layerComponents[j].islandList)
             {
-                if (layerSeg->type != SegmentType::InfillSegment)
-                    continue;
+                for (LayerSegment *seg : isle.segments)
+                {
+                    if (seg->type != SegmentType::InfillSegment)
+                        continue;
 
-                clipper.Clear();
-                clipper.AddPaths(commonInfill, PolyType::ptClip, true);
-                clipper.AddPaths(layerSeg->outlinePaths, PolyType::ptSubject, true);
-                clipper.Execute(ClipType::ctUnion, commonInfill);
+                    // Remove the common infill from the layersegment
+                    clipper.Clear();
+                    clipper.AddPaths(seg->outlinePaths, PolyType::ptSubject, true);
+                    clipper.AddPaths(commonInfill, PolyType::ptClip, true);
+                    clipper.Execute(ClipType::ctDifference, seg->outlinePaths);
+                }
             }
+        }
 
-            // Then determine which part intersects with the previous layer's infill
+        // And finally add it back to the islands of the topmost layer with a thickness
+        // that will account for all the layers
+        for (LayerIsland &isle : layerComponents[topLayer].islandList)
+        {
+            Paths isleInfill;
             clipper.Clear();
+            clipper.AddPaths(isle.outlinePaths, PolyType::ptSubject, true);
             clipper.AddPaths(commonInfill, PolyType::ptClip, true);
-            clipper.AddPaths(belowInfill, PolyType::ptSubject, true);
-            clipper.Execute(ClipType::ctIntersection, commonInfill);
+            clipper.Execute(ClipType::ctIntersection, isleInfill);
 
-            if (commonInfill.size() < 1)
+            if (isleInfill.size() < 1)
                 continue;
 
-            // We should now subtract the common infill from all the affected layers and then add it to the topmost layer
-            // again but with it thickness that will account for all the layers
+            SegmentWithInfill &infillSegment = isle.segments.emplace<SegmentWithInfill>(SegmentType::InfillSegment);
+            infillSegment.infillMultiplier = (layerZ[topLayer] + layerHeights[topLayer] - layerZ[firstLayer]) /
+                    layerHeights[topLayer];
+            infillSegment.segmentSpeed = GlobalSettings::InfillSpeed.Get();
+            infillSegment.outlinePaths = std::move(isleInfill);
+        }
+    }
 
-            for (std::size_t j = i; j > i - combCount && j > 0; j--)
-            {
-                for (LayerIsland &isle : layerComponents[j].islandList)
-                {
-                    for (LayerSegment *seg : isle.segments)
-                    {
-                        if (seg->type != SegmentType::InfillSegment)
-                            continue;
+    *doneFlag = true;
+}
 
-                        // Remove the common infill from the layersegment
-                        clipper.Clear();
-                        clipper.AddPaths(seg->outlinePaths, PolyType::ptSubject, true);
-                        clipper.AddPaths(commonInfill, PolyType::ptClip, true);
-                        clipper.Execute(ClipType::ctDifference, seg->outlinePaths);
-                    }
-                }
-            }
+static inline void CombineInfillSegments()
+{
+    std::size_t combCount = GlobalSettings::InfillCombinationCount.Get();
+    if (combCount < 2)
+        return;
 
-            // Finally add the new segment to the topmost layer
-            if (commonInfill.size() < 1)
-                continue;
+    SlicerLog("Combining infill segments");
 
-            SegmentWithInfill &infillSegment = mainIsle.segments.emplace<SegmentWithInfill>(SegmentType::InfillSegment);
-            infillSegment.infillMultiplier = combCount; // TODO: maybe different variable
-            infillSegment.segmentSpeed = GlobalSettings::InfillSpeed.Get();
-            infillSegment.outlinePaths = commonInfill;
-        }
+    // The groups start at the first layer of the mesh, the raft layers are never combined
+    if (raftLayerCount >= layerCount)
+        return;
+
+    MultiRunFunction(CombineInfillSegmentsMF, 0, (layerCount - raftLayerCount + combCount - 1) / combCount);
+}
+
+// The union of everything on the first layer of the mesh, which the raft and the skirt are both placed around
+static Paths firstLayerOutline;
+
+static inline void CalculateFirstLayerOutline()
+{
+    firstLayerOutline.clear();
+    if (raftLayerCount >= layerCount)
+        return;
+
+    const LayerComponent &firstLayer = layerComponents[raftLayerCount];
+
+    Clipper clipper;
+    clipper.AddPaths(firstLayer.outlinePaths, PolyType::ptSubject, true);
+
+    // The support islands are not part of the sliced outline of the layer
+    for (const LayerIsland &isle : firstLayer.islandList)
+    {
+        if (!isle.segments.empty() && (*isle.segments.begin())->type == SegmentType::SupportSegment)
+            clipper.AddPaths(isle.outlinePaths, PolyType::ptClip, true);
     }
+
+    clipper.Execute(ClipType::ctUnion, firstLayerOutline, PolyFillType::pftNonZero, PolyFillType::pftNonZero);
 }
-#endif
 
 static inline void GenerateRaft()
 {
-    // TODO: implement this
     SlicerLog("Generating raft");
+
+    if (raftLayerCount < 1 || firstLayerOutline.empty())
+        return;
+
+    // The raft sticks out of the first layer by the margin, the same amount on every raft layer
+    cInt margin = GlobalSettings::RaftMargin.Get() * scaleFactor;
+    cInt halfNozzle = NozzleWidth * scaleFactor / 2;
+
+    PolyTree raftTree;
+    ClipperOffset offset;
+    offset.AddPaths(firstLayerOutline, JoinType::jtMiter, EndType::etClosedPolygon);
+    offset.Execute(raftTree, margin - halfNozzle);
+
+    for (std::size_t i = 0; i < raftLayerCount; i++)
+    {
+        std::vector<LayerIsland> raftIsles;
+        ProcessPolyNode(&raftTree, raftIsles);
+
+        for (LayerIsland &isle : raftIsles)
+        {
+            // The lower layers are coarse, the top layer is solid to give the first layer of the mesh a flat surface
+            SegmentWithInfill &raftSeg = isle.segments.emplace<SegmentWithInfill>(SegmentType::RaftSegment);
+            raftSeg.segmentSpeed = layerComponents[i].layerSpeed;
+            raftSeg.outlinePaths = isle.outlinePaths;
+            raftSeg.fillDensity = (i + 1 == raftLayerCount) ? 100.0f : GlobalSettings::RaftDensity.Get();
+
+            layerComponents[i].islandList.emplace_back(std::move(isle));
+        }
+    }
 }
 
+// The largest distance the rounded corners of the skirt may lie from a true circle
+const double SkirtRoundTolerance = 0.01;
+
 static inline void GenerateSkirt()
 {
-    //  TODO: implement this
     SlicerLog("Generating skirt");
-}
 
-#ifndef FAILSAFE_INFILL
-struct SectPoint
-{
-    IntPoint point;
-    const Path *path;
+    int lineCount = GlobalSettings::SkirtLineCount.Get();
+    if (lineCount < 1 || firstLayerOutline.empty())
+        return;
 
-    SectPoint (cInt x, cInt y, const Path *path_)
-        : point(x, y), path(path_) {}
-};
+    // The skirt goes around whatever is printed on the first layer, which is the raft if there is one
+    cInt nozzle = NozzleWidth * scaleFactor;
+    cInt distance = GlobalSettings::SkirtDistance.Get() * scaleFactor + nozzle / 2;
+    if (raftLayerCount > 0)
+        distance += GlobalSettings::RaftMargin.Get() * scaleFactor;
+
+    ClipperOffset offset;
+    offset.ArcTolerance = SkirtRoundTolerance * scaleFactor;
+    offset.AddPaths(firstLayerOutline, JoinType::jtRound, EndType::etClosedPolygon);
+
+    // The loops are printed from the outside in, any holes in the offset outline are left out
+    LayerComponent &layerComp = layerComponents[0];
+    LayerIsland isle;
+    LayerSegment &skirtSeg = isle.segments.emplace<LayerSegment>(SegmentType::SkirtSegment);
+    skirtSeg.segmentSpeed = layerComp.layerSpeed;
 
+    for (int i = lineCount - 1; i >= 0; i--)
+    {
+        Paths loops;
+        offset.Execute(loops, distance + (cInt)i * nozzle);
+
+        for (Path &loop : loops)
+        {
+            if (Orientation(loop))
+                skirtSeg.outlinePaths.push_back(std::move(loop));
+        }
+
+        if (isle.outlinePaths.empty())
+            isle.outlinePaths = skirtSeg.outlinePaths;
+    }
+
+    if (!skirtSeg.outlinePaths.empty())
+        layerComp.islandList.emplace_back(std::move(isle));
+}
+
+#ifndef FAILSAFE_INFILL
 static inline cInt xOnAxis(const IntPoint &p, bool right)
 {
     if (right)
@@ -1548,11 +2179,6 @@ static inline cInt xOnAxis(const IntPoint &p, bool right)
         return p.X + p.Y;
 }
 
-static bool CompForY(const SectPoint &a, const SectPoint &b)
-{
-    return (a.point.Y < b.point.Y);
-}
-
 static bool Clockwise(const IntPoint &A, const IntPoint &B, const IntPoint &C)
 {
     // http://gamedev.stackexchange.com/questions/45412/understanding-math-used-to-determine-if-vector-is-clockwise-counterclockwise-f
@@ -1562,32 +2188,148 @@ static bool Clockwise(const IntPoint &A, const IntPoint &B, const IntPoint &C)
     return (v1.Y*v2.X < v1.X*v2.Y);
 }
 
-static void FillInPaths(const Paths &outlines, std::vector<LineSegment> &infillLines,
-                        float density, bool right)
+struct ScanEdge
 {
-    // All infill is aligned acording to the x-axis so we work with
-    // the diagonal lines through the x-axis spaced according to the
-    // divider value
-    // This means we project each point of each poin to the axis and work
-    // with the infill lines between 2 points that are then projected back
-    // to these lines of the path. All paths are stored according to the index
-    // of the diagonal line on the x-axis and then connected from bottom
-    // to top.
-
-    // By using 45 degrees we can avoid the use of trig functions
-    // If other  angles need support these trig values should be
-    // cached for densities
+    // This is an edge of an outline in the rotated coordinate system of the infill lines
+    // that knows which infill lines it crosses
 
-    double divider = densityDividers[density];
-
-    // We store all intersections on the same diagonal line as to
-    // connect them into lines later
-    std::map<cInt, std::vector<SectPoint>> sectMap;
+    const Path *path;
+    std::size_t pathIdx; // The index of the edge's first point in the path
+    std::size_t order; // The position of the edge in the outlines
+    cInt firstLine, lastLine;
+    double leftMost, xDist;
+    IntPoint leftP, rightP;
+    bool swapped;
+};
 
-    for (const Path &path : outlines)
+// Calculate where the edge intersects the infill line with the given index and return false if this
+// is a corner that should not be added
+static bool IntersectEdge(const ScanEdge &edge, cInt idx, double divider, bool right, IntPoint &sect)
+{
+    const Path &path = *edge.path;
+    std::size_t i = edge.pathIdx;
+    IntPoint p1 = path[i];
+    IntPoint p2 = (i < path.size()-1) ? path[i + 1] : path[0];
+
+    double yRise = edge.rightP.Y - edge.leftP.Y;
+    double xRise = edge.rightP.X - edge.leftP.X;
+    double xDiff = (idx * divider) - edge.leftMost;
+    double xPerc = xDiff / edge.xDist;
+
+    // Intersections at the ends of linesegments are corners which are confusing
+    // because they create the same point twice and som corners touch a line
+    // inside a polygon while others are where it exists a polygon.
+    //
+    // At an exit corner the direction of the angle between the two lines on the
+    // point is the same as the direction to the line through the points whilst
+    // for touching corners they differ. We should only place one point for an
+    // exit corner and no points for an inside one because an inside one does
+    // signal a break in the line.
+
+    // Skip past perfect intersection on p1 and check
+    // if perfect intersection on p2 are inside or outside
+    if ((!edge.swapped && (xPerc == 0.0)) || (edge.swapped && (xPerc == 1.0)))
+        return false;
+    else if ((edge.swapped && (xPerc == 0.0)) || (!edge.swapped && (xPerc == 1.0)))
     {
-        if (path.size() < 3)
-            continue;
+        IntPoint p3;
+        if (i < path.size()-2)
+            p3 = path[i + 2];
+        else if (i < path.size()-1)
+            p3 = path[0];
+        else
+            p3 = path[1];
+
+        //v1 = p2 to p1;
+        //v2 = p2 to p3;
+
+        // Get the closest point on the line to p1
+        IntPoint pA;
+        IntPoint v = p1 - p2;
+        if (v.X == 0)
+        {
+            cInt delta = v.Y;
+            pA.Y = p2.Y + delta;
+            pA.X = (right) ? (p2.X + delta) : (p2.X - delta);
+        }
+        else
+        {
+            cInt delta = v.X;
+            pA.X = p2.X + delta;
+            pA.Y = (right) ? (p2.Y + delta) : (p2.Y - delta);
+        }
+
+        // Determine if it is CW from v1 to v2
+        // and it should the opposite the other way
+        bool clockV1ToV2 = Clockwise(p2, p1, p3);
+
+        if (Clockwise(p2, p1, pA) != clockV1ToV2)
+            return false;
+
+        // Get the closest point on the line to p3
+        v = p3 - p2;
+        if (v.X == 0)
+        {
+            cInt delta = v.Y;
+            pA.Y = p2.Y + delta;
+            pA.X = (right) ? (p2.X + delta) : (p2.X - delta);
+        }
+        else
+        {
+            cInt delta = v.X;
+            pA.X = p2.X + delta;
+            pA.Y = (right) ? (p2.Y + delta) : (p2.Y - delta);
+        }
+
+        // opposite (see above)
+        if (Clockwise(p2, p3, pA) == clockV1ToV2)
+            return false;
+    }
+
+    sect.X = edge.leftP.X + (cInt)(xPerc * xRise);
+    sect.Y = edge.leftP.Y + (cInt)(xPerc * yRise);
+    return true;
+}
+
+static bool CompForY(const IntPoint &a, const IntPoint &b)
+{
+    return (a.Y < b.Y);
+}
+
+// Statistics that are kept for the infill lines of all the segments in a job
+static std::atomic<std::size_t> solidFillLines(0);
+static std::atomic<long long> solidFillMicros(0);
+static std::atomic<std::size_t> sparseFillLines(0);
+static std::atomic<long long> sparseFillMicros(0);
+
+static void FillInPaths(const Paths &outlines, std::vector<LineSegment> &infillLines,
+                        float density, bool right)
+{
+    // All infill is aligned acording to the x-axis so we work with
+    // the diagonal lines through the x-axis spaced according to the
+    // divider value
+    // This means we project each point of each poin to the axis and work
+    // with the infill lines between 2 points that are then projected back
+    // to these lines of the path.
+    // The lines are then swept from left to right whilst keeping a table of the
+    // edges that are active on the current line. The intersections on each line
+    // are connected from bottom to top.
+
+    // By using 45 degrees we can avoid the use of trig functions
+    // If other  angles need support these trig values should be
+    // cached for densities
+
+    auto start = std::chrono::steady_clock::now();
+    double divider = densityDividers.at(density);
+
+    // Build the edge table of all the edges that cross at least one line
+    std::vector<ScanEdge> edges;
+    std::size_t maxSects = 0;
+
+    for (const Path &path : outlines)
+    {
+        if (path.size() < 3)
+            continue;
 
         for (std::size_t i = 0; i < path.size(); i++)
         {
@@ -1595,169 +2337,141 @@ static void FillInPaths(const Paths &outlines, std::vector<LineSegment> &infillL
             IntPoint p1 = path[i];
             IntPoint p2 = (i < path.size()-1) ? path[i + 1] : path[0];
 
+            ScanEdge edge;
+            edge.path = &path;
+            edge.pathIdx = i;
+
             double leftMost = xOnAxis(p1, right);
             double rightMost = xOnAxis(p2, right);
-            IntPoint leftP, rightP;
-            bool swapped;
 
             if (rightMost < leftMost)
             {
-                cInt temp = leftMost;
-                leftMost = rightMost;
-                rightMost = temp;
-
-                leftP = p2;
-                rightP = p1;
-                swapped = true;
+                std::swap(leftMost, rightMost);
+                edge.leftP = p2;
+                edge.rightP = p1;
+                edge.swapped = true;
             }
             else
             {
-                leftP = p1;
-                rightP = p2;
-                swapped = false;
-            }
-
-            // We add a small rounding margin to prevent loss of seemingly obvious line
-            cInt leftIdx = std::ceil(leftMost / divider);
-            cInt rightIdx = std::floor(rightMost / divider);
-
-            double yRise = rightP.Y - leftP.Y;
-            double xRise = rightP.X - leftP.X;
-            double xDist = rightMost - leftMost;
-
-            // Intersections at the ends of linesegments are corners which are confusing
-            // because they create the same point twice and som corners touch a line
-            // inside a polygon while others are where it exists a polygon.
-            //
-            // At an exit corner the direction of the angle between the two lines on the
-            // point is the same as the direction to the line through the points whilst
-            // for touching corners they differ. We should only place one point for an
-            // exit corner and no points for an inside one because an inside one does
-            // signal a break in the line.
-
-            // Now get all the points of intersection on this line
-            for (cInt idx = leftIdx; idx <= rightIdx; idx++) {
-                double xDiff = (idx * divider) - leftMost;
-                double xPerc = xDiff / xDist;
-
-                // Skip past perfect intersection on p1 and check
-                // if perfect intersection on p2 are inside or outside
-                if ((!swapped && (xPerc == 0.0)) || (swapped && (xPerc == 1.0)))
-                    continue;
-                else if ((swapped && (xPerc == 0.0)) || (!swapped && (xPerc == 1.0)))
-                {
-                    IntPoint p3;
-                    if (i < path.size()-2)
-                        p3 = path[i + 2];
-                    else if (i < path.size()-1)
-                        p3 = path[0];
-                    else
-                        p3 = path[1];
+                edge.leftP = p1;
+                edge.rightP = p2;
+                edge.swapped = false;
+            }
 
-                    //v1 = p2 to p1;
-                    //v2 = p2 to p3;
+            edge.firstLine = std::ceil(leftMost / divider);
+            edge.lastLine = std::floor(rightMost / divider);
 
-                    // Get the closest point on the line to p1
-                    IntPoint pA;
-                    IntPoint v = p1 - p2;
-                    if (v.X == 0)
-                    {
-                        cInt delta = v.Y;
-                        pA.Y = p2.Y + delta;
-                        pA.X = (right) ? (p2.X + delta) : (p2.X - delta);
-                    }
-                    else
-                    {
-                        cInt delta = v.X;
-                        pA.X = p2.X + delta;
-                        pA.Y = (right) ? (p2.Y + delta) : (p2.Y - delta);
-                    }
+            if (edge.firstLine > edge.lastLine)
+                continue;
 
-                    // Determine if it is CW from v1 to v2
-                    // and it should the opposite the other way
-                    bool clockV1ToV2 = Clockwise(p2, p1, p3);
+            edge.leftMost = leftMost;
+            edge.xDist = rightMost - leftMost;
+            edge.order = edges.size();
+            maxSects += edge.lastLine - edge.firstLine + 1;
+            edges.push_back(edge);
+        }
+    }
 
-                    if (Clockwise(p2, p1, pA) != clockV1ToV2)
-                        continue;
+    if (edges.size() < 2)
+        return;
 
-                    // Get the closest point on the line to p3
-                    v = p3 - p2;
-                    if (v.X == 0)
-                    {
-                        cInt delta = v.Y;
-                        pA.Y = p2.Y + delta;
-                        pA.X = (right) ? (p2.X + delta) : (p2.X - delta);
-                    }
-                    else
-                    {
-                        cInt delta = v.X;
-                        pA.X = p2.X + delta;
-                        pA.Y = (right) ? (p2.Y + delta) : (p2.Y - delta);
-                    }
+    // The edges become active in the order of their first line
+    std::stable_sort(edges.begin(), edges.end(), [](const ScanEdge &a, const ScanEdge &b) {
+        return a.firstLine < b.firstLine;
+    });
 
-                    // opposite (see above)
-                    if (Clockwise(p2, p3, pA) == clockV1ToV2)
-                        continue;
-                }
+    // Every line gets its own range of the flat buffer with the lines of that infill line
+    // stored from bottom to top
+    std::vector<LineSegment> lineBuf;
+    lineBuf.reserve(maxSects / 2);
+    std::vector<std::size_t> lineStarts;
+    std::size_t maxLevels = 0;
+
+    // The active edges are kept in the order they appear on the outlines sothat
+    // the points on every line are sorted exactly the same way every time
+    std::vector<std::size_t> active;
+    std::vector<IntPoint> sects;
+    std::size_t nextEdge = 0;
+    cInt idx = edges.front().firstLine;
+
+    while (nextEdge < edges.size() || !active.empty())
+    {
+        // Skip the empty space between outlines
+        if (active.empty())
+            idx = std::max(idx, edges[nextEdge].firstLine);
 
-                cInt xVal = leftP.X + (cInt)(xPerc * xRise);
-                cInt yVal = leftP.Y + (cInt)(xPerc * yRise);
-                sectMap[idx].emplace_back(xVal, yVal, &path);               
-            }
-        }
-    }
+        // Remove the edges that have been passed
+        active.erase(std::remove_if(active.begin(), active.end(), [&](std::size_t e) {
+            return edges[e].lastLine < idx;
+        }), active.end());
 
-    // Now go through all the points on each line and create the segments
+        // Add the edges that start on this line
+        while (nextEdge < edges.size() && edges[nextEdge].firstLine == idx)
+        {
+            auto pos = std::lower_bound(active.begin(), active.end(), edges[nextEdge].order,
+                                        [&](std::size_t e, std::size_t order) {
+                return edges[e].order < order;
+            });
+            active.insert(pos, nextEdge);
+            nextEdge++;
+        }
 
-    // We need to group all lines on roughly the same level to avoid jumping
-    // up and down between them.
-    // Therefore an intial list is kept of all non-bottom lines and then added
-    // to the standard list going zig zag
-    std::map<std::size_t, std::vector<LineSegment>> higherLines;
+        // Now get all the points of intersection on this line
+        sects.clear();
+        for (std::size_t e : active)
+        {
+            IntPoint sect;
+            if (IntersectEdge(edges[e], idx, divider, right, sect))
+                sects.push_back(sect);
+        }
 
-    for (auto pair : sectMap)
-    {
-        std::vector<SectPoint> &points = pair.second;
-        if (points.size() < 2)
-            continue;
+        if (sects.size() >= 2)
+        {
+            std::sort(sects.begin(), sects.end(), CompForY);
 
-        std::sort(points.begin(), points.end(), CompForY);
+            lineStarts.push_back(lineBuf.size());
+            for (std::size_t i = 0; i + 1 < sects.size(); i += 2)
+                lineBuf.emplace_back(sects[i], sects[i + 1]);
 
-        // Add the bottom lines
-        infillLines.emplace_back(points[0].point, points[1].point);
+            maxLevels = std::max(maxLevels, sects.size() / 2);
+        }
 
-        // Store the higher lines for later adding
-        for (std::size_t i = 2; i < points.size(); i += 2)
-            higherLines[i].emplace_back(points[i].point, points[i + 1].point);
+        idx++;
     }
 
-    // Now add back the higher lines from right to left (because we just went from left ro right)
-    // and then the other way etc. untill all have been added
-
-    // Reserve enough space for all the lines
-    std::size_t fullSize = infillLines.size();
-    for (auto pair : higherLines)
-        fullSize += pair.second.size();
-    infillLines.reserve(fullSize);
+    lineStarts.push_back(lineBuf.size());
+    infillLines.reserve(infillLines.size() + lineBuf.size());
 
-    bool rightToLeft = true;
-    for (auto pair : higherLines)
+    // We need to group all lines on roughly the same level to avoid jumping
+    // up and down between them.
+    // Therefore the bottom lines are added first from left to right, the higher lines
+    // are then added level by level going zig zag
+    bool rightToLeft = false;
+    for (std::size_t level = 0; level < maxLevels; level++)
     {
-        std::vector<LineSegment> &lines = pair.second;
-
-        if (rightToLeft)
+        std::size_t lineCount = lineStarts.size() - 1;
+        for (std::size_t j = 0; j < lineCount; j++)
         {
-            for (std::size_t i = lines.size(); i > 0; i--)
-                infillLines.push_back(lines[i - 1]);
-
-            rightToLeft = false;
+            std::size_t k = (rightToLeft) ? (lineCount - 1 - j) : j;
+            if (lineStarts[k] + level < lineStarts[k + 1])
+                infillLines.push_back(lineBuf[lineStarts[k] + level]);
         }
-        else
-        {
-            std::move(lines.begin(), lines.end(), std::back_inserter(infillLines));
 
-            rightToLeft = true;
-        }
+        rightToLeft = (level == 0) || !rightToLeft;
+    }
+
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+    if (density >= 100.0f)
+    {
+        solidFillLines += lineBuf.size();
+        solidFillMicros += micros;
+    }
+    else
+    {
+        sparseFillLines += lineBuf.size();
+        sparseFillMicros += micros;
     }
 }
 #else
@@ -1782,70 +2496,287 @@ static inline void ClipLinesToPaths(std::vector<LineSegment> &lines, const Paths
 }
 #endif
 
-static void TrimInfillMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+#ifndef FAILSAFE_INFILL
+struct PatternLines
 {
-    SlicerLog(std::string("Trim infill: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
+    // These are the open lines of a sparse infill pattern that cover the whole mesh, patterns that change
+    // with height store a set of lines for each phase of the height at which they repeat
 
-    // Even layers go right
-    bool right = (std::div(startIdx, 2).rem == 0);
+    std::vector<Paths> phases;
+    std::vector<std::vector<IntRect>> bounds;
+    double phaseHeight = 0; // In mm, 0 for patterns that do not change with height
+};
 
-    for (std::size_t i = startIdx; i < endIdx; i++)
+// The patterns are generated once per job for each density and angle and are then only read
+// when the infill of every layer is clipped from them
+static std::map<std::pair<float, float>, PatternLines> patternCache;
+
+static inline IntRect PathBounds(const Path &path)
+{
+    IntRect rect;
+    rect.left = rect.right = path[0].X;
+    rect.top = rect.bottom = path[0].Y;
+
+    for (const IntPoint &p : path)
     {
-        SlicerLog("Trim infill: " + std::to_string(i));
+        rect.left = std::min(rect.left, p.X);
+        rect.right = std::max(rect.right, p.X);
+        rect.top = std::min(rect.top, p.Y);
+        rect.bottom = std::max(rect.bottom, p.Y);
+    }
 
-        for (LayerIsland &isle : layerComponents[i].islandList)
+    return rect;
+}
+
+static inline void StorePhase(PatternLines &pattern, Paths &lines)
+{
+    std::vector<IntRect> bounds;
+    bounds.reserve(lines.size());
+    for (const Path &line : lines)
+        bounds.push_back(PathBounds(line));
+
+    pattern.phases.emplace_back(std::move(lines));
+    pattern.bounds.emplace_back(std::move(bounds));
+}
+
+// Generate straight parallel lines at the given angle (in degrees) that are spaced as far apart as needed
+// and cover the mesh with an extra spacing around it to allow for shifting. All lines go
+// through multiples of the spacing from the origin so that they line up across layers and islands.
+static void GenerateLinePattern(float density, float angle, double spacing)
+{
+    PatternLines &pattern = patternCache[std::make_pair(density, angle)];
+    double rad = angle / 180.0 * PI;
+    double dX = std::cos(rad), dY = std::sin(rad);
+    double nX = -dY, nY = dX;
+
+    // Project the corners of the mesh onto the direction of and normal to the lines
+    double minX = sliceMesh->MinVec.x * scaleFactor - spacing;
+    double maxX = sliceMesh->MaxVec.x * scaleFactor + spacing;
+    double minY = sliceMesh->MinVec.y * scaleFactor - spacing;
+    double maxY = sliceMesh->MaxVec.y * scaleFactor + spacing;
+    double minD = std::numeric_limits<double>::max(), maxD = std::numeric_limits<double>::lowest();
+    double minN = minD, maxN = maxD;
+
+    for (double x : {minX, maxX})
+    {
+        for (double y : {minY, maxY})
         {
-            for (LayerSegment *segment : isle.segments)
-            {
-                if (SegmentWithInfill* seg = dynamic_cast<SegmentWithInfill*>(segment))
-                {
-                    bool goRight = right;
-                    float density;
+            minD = std::min(minD, x * dX + y * dY);
+            maxD = std::max(maxD, x * dX + y * dY);
+            minN = std::min(minN, x * nX + y * nY);
+            maxN = std::max(maxN, x * nX + y * nY);
+        }
+    }
 
-                    switch (seg->type)
-                    {
-                    case SegmentType::InfillSegment:
-                        // If the segment is an infill segment then we need to trim the correlating infill grid to fill it
-                        density = 15.0f; // TODO
-                        break;
-                    case SegmentType::BottomSegment: case SegmentType::TopSegment:
-                        // If this is a top or bottom segment then we need to trim the solid infill grid to fill it
-                        density = 100.0f;
-                        break;
-                    case SegmentType::SupportSegment:
-                        // If this is a support segment then we need to trim the support infill grid to fill it
-                        density = 10.0f; // TODO
-                        goRight = false;
-                        break;
-                    default:
-                        std::cout << "Unhandled infill segment of type number: " << (int)seg->type << std::endl;
-                        break;
-                    }
+    Paths lines;
+    for (cInt k = (cInt)std::floor(minN / spacing); k <= (cInt)std::ceil(maxN / spacing); k++)
+    {
+        double n = k * spacing;
+        Path line;
+        line.emplace_back((cInt)(n * nX + minD * dX), (cInt)(n * nY + minD * dY));
+        line.emplace_back((cInt)(n * nX + maxD * dX), (cInt)(n * nY + maxD * dY));
+        lines.emplace_back(std::move(line));
+    }
 
-#ifdef FAILSAFE_INFILL
-                    ClipLinesToPaths(seg->fillLines, (goRight) ? InfillGridMap[density].rightList :
-                                                              InfillGridMap[density].leftList, seg->outlinePaths);
-#else
-                    FillInPaths(seg->outlinePaths, seg->fillLines, density, goRight);
-#endif
+    StorePhase(pattern, lines);
+}
 
-                    seg->fillDensity = density;
+// Generate the curves where a gyroid surface with the given period intersects every phase of its height
+// https://en.wikipedia.org/wiki/Gyroid: sin(x)cos(y) + sin(y)cos(z) + sin(z)cos(x) = 0
+static void GenerateGyroidPattern(float density, double period)
+{
+    PatternLines &pattern = patternCache[std::make_pair(density, 0.0f)];
+
+    // Use enough phases for even the thinnest layer to get its own curves
+    double minHeight = *std::min_element(layerHeights.begin(), layerHeights.end());
+    std::size_t phaseCount = std::max((std::size_t)1, (std::size_t)std::round(period / scaleFactor / minHeight));
+    pattern.phaseHeight = period / scaleFactor / phaseCount;
+
+    const double scale = 2 * PI / period;
+    const std::size_t stepsPerPeriod = 16;
+    double minX = sliceMesh->MinVec.x * scaleFactor - period;
+    double maxX = sliceMesh->MaxVec.x * scaleFactor + period;
+    double minY = sliceMesh->MinVec.y * scaleFactor - period;
+    double maxY = sliceMesh->MaxVec.y * scaleFactor + period;
+
+    for (std::size_t phase = 0; phase < phaseCount; phase++)
+    {
+        double z = 2 * PI * phase / phaseCount;
+        double sinZ = std::sin(z), cosZ = std::cos(z);
+
+        // Where cos(z) dominates the curves run along x and we solve for y at every x,
+        // otherwise they run along y and we solve for x at every y. Both cases reduce to
+        // A*cos(v) + B*sin(v) = C, which is R*cos(v - atan2(B, A)) = C
+        bool alongX = std::abs(sinZ) <= std::abs(cosZ);
+        double minU = (alongX) ? minX : minY, maxU = (alongX) ? maxX : maxY;
+        double minV = (alongX) ? minY : minX, maxV = (alongX) ? maxY : maxX;
+
+        cInt firstK = (cInt)std::floor(minV * scale / (2 * PI)) - 1;
+        cInt lastK = (cInt)std::ceil(maxV * scale / (2 * PI)) + 1;
+        std::size_t steps = (std::size_t)std::ceil((maxU - minU) * scale / (2 * PI) * stepsPerPeriod);
+
+        Paths lines;
+        for (cInt k = firstK; k <= lastK; k++)
+        {
+            for (int side : {-1, 1})
+            {
+                Path curve;
+                curve.reserve(steps + 1);
+
+                for (std::size_t j = 0; j <= steps; j++)
+                {
+                    double u = minU + (maxU - minU) * j / steps;
+                    double uS = u * scale;
+                    double A = (alongX) ? std::sin(uS) : sinZ;
+                    double B = (alongX) ? cosZ : std::cos(uS);
+                    double C = (alongX) ? (-sinZ * std::cos(uS)) : (-std::sin(uS) * cosZ);
+                    double R = std::sqrt(A * A + B * B);
+                    double v = (std::atan2(B, A) + side * std::acos(std::max(-1.0, std::min(1.0, C / R)))
+                                + 2 * PI * k) / scale;
+
+                    if (alongX)
+                        curve.emplace_back((cInt)u, (cInt)v);
+                    else
+                        curve.emplace_back((cInt)v, (cInt)u);
                 }
+
+                lines.emplace_back(std::move(curve));
             }
         }
 
-        right = !right;
+        StorePhase(pattern, lines);
     }
+}
 
-    *doneFlag = true;
+static inline void GenerateInfillPatterns()
+{
+    SlicerLog("Generating infill patterns");
+
+    patternCache.clear();
+
+    float density = GlobalSettings::InfillDensity.Get();
+    if (density <= 0)
+        return;
+
+    // Each direction of a pattern needs to be spaced further apart to keep the same density
+    double divider = densityDividers.at(density);
+
+    switch ((InfillPattern)GlobalSettings::InfillPattern.Get())
+    {
+    case InfillPattern::Grid:
+        GenerateLinePattern(density, 45.0f, divider * 2);
+        GenerateLinePattern(density, 135.0f, divider * 2);
+        break;
+    case InfillPattern::Triangles: case InfillPattern::Cubic:
+        GenerateLinePattern(density, 45.0f, divider * 3);
+        GenerateLinePattern(density, 105.0f, divider * 3);
+        GenerateLinePattern(density, 165.0f, divider * 3);
+        break;
+    case InfillPattern::Gyroid:
+        // Every period has two curves
+        GenerateGyroidPattern(density, divider * 2);
+        break;
+    default:
+        // Lines are calculated directly for each segment
+        break;
+    }
 }
 
-static inline void TrimInfill()
+// Clip all the cached patterns for a density to the outline of a segment, patterns can be shifted
+// sideways along their normal for the given height
+static void ClipPatternToPaths(std::vector<LineSegment> &lines, float density, double z, bool shiftWithZ,
+                               const Paths &outline)
 {
-    SlicerLog("Trimming infill");
+    IntRect outBounds;
+    bool first = true;
+    for (const Path &path : outline)
+    {
+        if (path.size() < 1)
+            continue;
+
+        IntRect rect = PathBounds(path);
+        if (first)
+            outBounds = rect;
+        else
+        {
+            outBounds.left = std::min(outBounds.left, rect.left);
+            outBounds.right = std::max(outBounds.right, rect.right);
+            outBounds.top = std::min(outBounds.top, rect.top);
+            outBounds.bottom = std::max(outBounds.bottom, rect.bottom);
+        }
+
+        first = false;
+    }
+
+    if (first)
+        return;
+
+    const cInt minLength2 = (cInt)(NozzleWidth * scaleFactor * NozzleWidth * scaleFactor);
+    Clipper clipper;
+    PolyTree result;
+
+    for (const auto &pair : patternCache)
+    {
+        if (pair.first.first != density)
+            continue;
+
+        const PatternLines &pattern = pair.second;
+        std::size_t phase = (pattern.phaseHeight > 0) ?
+                    ((std::size_t)std::round(z / pattern.phaseHeight) % pattern.phases.size()) : 0;
+
+        // Cubic infill moves every direction along its normal as the layers go up, the outline
+        // is rather moved the other way so that the cached lines can be used as they are
+        IntPoint shift(0, 0);
+        if (shiftWithZ)
+        {
+            double rad = pair.first.second / 180.0 * PI;
+            double dist = z * scaleFactor / std::sqrt(2.0);
+            shift = IntPoint((cInt)(-std::sin(rad) * dist), (cInt)(std::cos(rad) * dist));
+        }
+
+        clipper.Clear();
+
+        for (std::size_t j = 0; j < pattern.phases[phase].size(); j++)
+        {
+            const IntRect &rect = pattern.bounds[phase][j];
+            if (rect.right + shift.X < outBounds.left || rect.left + shift.X > outBounds.right ||
+                    rect.bottom + shift.Y < outBounds.top || rect.top + shift.Y > outBounds.bottom)
+                continue;
+
+            if (shiftWithZ)
+            {
+                Path shifted = pattern.phases[phase][j];
+                for (IntPoint &p : shifted)
+                {
+                    p.X += shift.X;
+                    p.Y += shift.Y;
+                }
+
+                clipper.AddPath(shifted, PolyType::ptSubject, false);
+            }
+            else
+                clipper.AddPath(pattern.phases[phase][j], PolyType::ptSubject, false);
+        }
+
+        clipper.AddPaths(outline, PolyType::ptClip, true);
+        clipper.Execute(ClipType::ctIntersection, result);
+
+        for (PolyNode *node : result.Childs)
+        {
+            const Path &contour = node->Contour;
+            if (contour.size() < 2)
+                continue;
+
+            // Skip very short pieces that only clip a corner
+            if (contour.size() == 2 && SquaredDist(contour[0], contour[1]) < minLength2)
+                continue;
 
-    MultiRunFunction(TrimInfillMF, 0, layerCount);
+            for (std::size_t k = 0; k < contour.size() - 1; k++)
+                lines.emplace_back(contour[k], contour[k + 1]);
+        }
+    }
 }
+#endif
 
 const cInt MoveHigher = scaleFactor / 10;
 
@@ -1858,17 +2789,20 @@ const cInt MoveHigher = scaleFactor / 10;
     return (p3.Y - p1.Y)*(p2.X - p1.X) == (p2.Y - p1.Y)*(p3.X - p1.X);
 }*/
 
+// Travel moves shorter than this are not retracted
+const cInt MinRetractTravel = 10 * scaleFactor;
+// Moves that leave the part would leave a string across the gap, so those are retracted from a much shorter distance
+const cInt MinExitRetractTravel = (cInt)(1.5 * scaleFactor);
+
 static void AddRetractedMove(PMCollection<ToolSegment> &toolSegments,
                             const IntPoint &p1,const IntPoint &p2,
-                             int moveSpeed, cInt lastZ)
+                             int moveSpeed, cInt lastZ, bool leavesPart = false)
 {
     // Retract filament to avoid stringing if possible and if the distance is long enough
     if (GlobalSettings::RetractionSpeed.Get() > 0 && GlobalSettings::RetractionDistance.Get() > 0)
     {
-        const cInt minDist = 10 * scaleFactor;
-        const cInt minDist2 = minDist * minDist;
-
-        if (SquaredDist(p1, p2) > minDist2)
+        cInt minTravel = leavesPart ? MinExitRetractTravel : MinRetractTravel;
+        if (SquaredDist(p1, p2) > minTravel * minTravel)
             toolSegments.emplace<RetractSegment>(GlobalSettings::RetractionDistance.Get());
     }
 
@@ -1876,66 +2810,269 @@ static void AddRetractedMove(PMCollection<ToolSegment> &toolSegments,
     toolSegments.emplace<TravelSegment>(p1, p2, lastZ, moveSpeed);
 }
 
-// Do a binary search for the closest point on a polygon to a defined other point
-// return true if closer distance than the parameter
-static bool FindClosestPoint(const Path &outPath, const IntPoint &lastPoint, std::size_t &closestPoint, std::size_t &closestDist)
+// The area travel moves within an island are kept inside of, the outer shell of the island and those of its holes,
+// this is built once for each island when the toolpath of its layer is created
+struct CombBoundary
 {
-    //std::size_t clos = SquaredDist(lastPoint, outPath[0]);
-    std::size_t upIdx = outPath.size() - 1;
-    std::size_t lowIdx = 0;
-    std::size_t midIdx = 0;
+    Paths paths;
+    std::vector<IntRect> bounds;
+    // The distance along each path to each of its points, with the full length of the path at the end
+    std::vector<std::vector<double>> distances;
+
+    std::size_t combedMoves = 0;
+    std::size_t savedRetractions = 0;
 
-    while (lowIdx != upIdx)
+    CombBoundary(const LayerIsland &isle)
     {
-        midIdx = std::div(lowIdx + upIdx, 2).quot;
+        // The outline segments come first with the outer shell before the others
+        const LayerSegment *outSeg = isle.segments.empty() ? nullptr : *isle.segments.begin();
+        if (outSeg != nullptr && outSeg->type == SegmentType::OutlineSegment)
+            paths = outSeg->outlinePaths;
+        else
+            paths = isle.outlinePaths;
 
-        if (midIdx == lowIdx)
+        for (const Path &path : paths)
         {
-            if (SquaredDist(lastPoint, outPath[upIdx]) < SquaredDist(lastPoint, outPath[lowIdx]))
-                midIdx = upIdx;
+            bounds.push_back(PathBounds(path));
 
-            break;
-        }
+            std::vector<double> dists(1, 0.0);
+            for (std::size_t k = 0; k < path.size(); k++)
+            {
+                const IntPoint &next = path[(k + 1 == path.size()) ? 0 : (k + 1)];
+                dists.push_back(dists.back() + std::sqrt((double)SquaredDist(path[k], next)));
+            }
 
-        //if (clos < SquaredDist(lastPoint, outPath[midIdx]))
-        if (SquaredDist(lastPoint, outPath[lowIdx]) < SquaredDist(lastPoint, outPath[midIdx]))
-            upIdx = midIdx;
-        else
-            lowIdx = midIdx;
+            distances.push_back(std::move(dists));
+        }
     }
 
-    std::size_t clos = SquaredDist(lastPoint, outPath[midIdx]);
-    if (clos < closestDist)
+    bool Inside(const IntPoint &p) const
     {
-        closestDist = clos;
-        closestPoint = midIdx;
-        return true;
-    }
+        // Points on a path are counted as inside, those in an even number of paths are in a hole
+        bool inside = false;
+        for (std::size_t k = 0; k < paths.size(); k++)
+        {
+            if (p.X < bounds[k].left || p.X > bounds[k].right || p.Y < bounds[k].top || p.Y > bounds[k].bottom)
+                continue;
 
-    return false;
-}
+            int result = PointInPolygon(p, paths[k]);
+            if (result < 0)
+                return true;
+            else if (result > 0)
+                inside = !inside;
+        }
 
-// Extrudes a line in a infill segment whilst moving along the outline
-static void ExtrudeLine(const std::size_t lineIdx, IntPoint &lastPoint, const cInt lastZ, bool &firstLine,
-                        const LayerComponent &curLayer, SegmentWithInfill* infillSeg)
+        return inside;
+    }
+};
+
+// A point where a straight travel move crosses a path of a comb boundary
+struct CombCrossing
 {
-    LineSegment &line = infillSeg->fillLines[lineIdx];
+    double t;
+    std::size_t path;
+    std::size_t edge;
+    IntPoint point;
 
-    // Create a clean move to the line if needed
-    if (firstLine)
-        firstLine = false;
-    else
+    bool operator <(const CombCrossing &other) const
     {
-        if (SquaredDist(lastPoint, line.p2) < SquaredDist(lastPoint, line.p1))
-            line.SwapPoints();
+        return t < other.t;
+    }
+};
 
-        IntPoint pA, pB;
-        const Path *interPath;
-        cInt interIdx = 0;
+// Determine the points a travel move from p1 to p2 has to pass to stay inside the boundary, parts of the move
+// that would leave it follow the path they cross along the shortest side instead. Returns false if there is no
+// such route, for example because one of the points is outside the boundary.
+static bool CombRoute(const CombBoundary &boundary, const IntPoint &p1, const IntPoint &p2, Path &route)
+{
+    route.clear();
 
-        const Path *closestPath;
-        cInt closestIdx = 0;
-        cInt closestDist = std::numeric_limits<cInt>::max();
+    double rx = p2.X - p1.X, ry = p2.Y - p1.Y;
+    if (rx == 0 && ry == 0)
+        return true;
+
+    // Find all the crossings with the paths along the move
+    std::vector<CombCrossing> crossings;
+    for (std::size_t k = 0; k < boundary.paths.size(); k++)
+    {
+        const IntRect &rect = boundary.bounds[k];
+        if (std::max(p1.X, p2.X) < rect.left || std::min(p1.X, p2.X) > rect.right ||
+                std::max(p1.Y, p2.Y) < rect.top || std::min(p1.Y, p2.Y) > rect.bottom)
+            continue;
+
+        const Path &path = boundary.paths[k];
+        for (std::size_t e = 0; e < path.size(); e++)
+        {
+            const IntPoint &a = path[e];
+            const IntPoint &b = path[(e + 1 == path.size()) ? 0 : (e + 1)];
+
+            double sx = b.X - a.X, sy = b.Y - a.Y;
+            double denom = rx * sy - ry * sx;
+            if (denom == 0)
+                continue;
+
+            double qx = a.X - p1.X, qy = a.Y - p1.Y;
+            double t = (qx * sy - qy * sx) / denom;
+            double u = (qx * ry - qy * rx) / denom;
+
+            if (t >= 0 && t <= 1 && u >= 0 && u < 1)
+                crossings.push_back({t, k, e, IntPoint(a.X + (cInt)(u * sx), a.Y + (cInt)(u * sy))});
+        }
+    }
+
+    std::sort(crossings.begin(), crossings.end());
+
+    // Go through the parts of the move between the crossings, those inside the boundary are kept straight
+    double prevT = 0;
+    const CombCrossing *prevCrossing = nullptr;
+    for (std::size_t c = 0; c <= crossings.size(); c++)
+    {
+        double t = (c < crossings.size()) ? crossings[c].t : 1.0;
+        double midT = (prevT + t) / 2;
+        IntPoint mid(p1.X + (cInt)(rx * midT), p1.Y + (cInt)(ry * midT));
+
+        // Parts too short to matter are not checked
+        if ((t - prevT) * std::sqrt(rx * rx + ry * ry) > 10 && !boundary.Inside(mid))
+        {
+            // The part outside has to start and end on the same path to follow it instead
+            if (prevCrossing == nullptr || c == crossings.size() || crossings[c].path != prevCrossing->path)
+                return false;
+
+            const CombCrossing &in = *prevCrossing;
+            const CombCrossing &out = crossings[c];
+            const Path &path = boundary.paths[in.path];
+            const std::vector<double> &dists = boundary.distances[in.path];
+            std::size_t n = path.size();
+            double total = dists.back();
+
+            // Determine which way around the path is shorter
+            double inPos = dists[in.edge] + std::sqrt((double)SquaredDist(path[in.edge], in.point));
+            double outPos = dists[out.edge] + std::sqrt((double)SquaredDist(path[out.edge], out.point));
+            double forwardDist = std::fmod(outPos - inPos + total, total);
+
+            route.push_back(in.point);
+            if (in.edge != out.edge)
+            {
+                if (forwardDist <= total / 2)
+                {
+                    for (std::size_t k = in.edge + 1; k != out.edge + 1; k++)
+                    {
+                        if (k == n)
+                            k = 0;
+
+                        route.push_back(path[k]);
+
+                        if (k == out.edge)
+                            break;
+                    }
+                }
+                else
+                {
+                    for (std::size_t k = in.edge; k != out.edge; k = (k == 0) ? (n - 1) : (k - 1))
+                        route.push_back(path[k]);
+                }
+            }
+            route.push_back(out.point);
+        }
+
+        if (c < crossings.size())
+        {
+            prevT = t;
+            prevCrossing = &crossings[c];
+        }
+    }
+
+    return true;
+}
+
+// Travel moves within an island follow its comb boundary instead of crossing holes, only those that
+// cannot stay inside of the island are retracted
+static void AddCombedMove(PMCollection<ToolSegment> &toolSegments, CombBoundary *boundary,
+                          const IntPoint &p1, const IntPoint &p2, int moveSpeed, cInt lastZ)
+{
+    Path route;
+    if (boundary == nullptr || GlobalSettings::Combing.Get() < 1)
+    {
+        AddRetractedMove(toolSegments, p1, p2, moveSpeed, lastZ);
+        return;
+    }
+
+    // A move that can not be combed has to cross the outside of the island
+    if (!CombRoute(*boundary, p1, p2, route))
+    {
+        AddRetractedMove(toolSegments, p1, p2, moveSpeed, lastZ, true);
+        return;
+    }
+
+    // Only the moves that would have been retracted without combing saved a retraction
+    boundary->combedMoves++;
+    if (GlobalSettings::RetractionSpeed.Get() > 0 && GlobalSettings::RetractionDistance.Get() > 0 &&
+            SquaredDist(p1, p2) > MinRetractTravel * MinRetractTravel)
+        boundary->savedRetractions++;
+
+    IntPoint lastPoint = p1;
+    route.push_back(p2);
+    for (const IntPoint &p : route)
+    {
+        if (p == lastPoint)
+            continue;
+
+        toolSegments.emplace<TravelSegment>(lastPoint, p, lastZ, moveSpeed);
+        lastPoint = p;
+    }
+}
+
+// Find the closest point on a polygon to a defined other point
+// return true if closer distance than the parameter
+static bool FindClosestPoint(const Path &outPath, const IntPoint &lastPoint, std::size_t &closestPoint, std::size_t &closestDist)
+{
+    // The vertices of a closed polygon are not ordered by their distance to any point so all of them have to be
+    // checked, the travel optimizer only calls this for the single outline that it already chose to move to
+    bool closer = false;
+
+    for (std::size_t i = 0; i < outPath.size(); i++)
+    {
+        std::size_t dist = SquaredDist(lastPoint, outPath[i]);
+
+        if (dist < closestDist)
+        {
+            closestDist = dist;
+            closestPoint = i;
+            closer = true;
+        }
+    }
+
+    return closer;
+}
+
+// Extrudes a line in a infill segment whilst moving along the outline
+static void ExtrudeLine(const std::size_t lineIdx, IntPoint &lastPoint, const cInt lastZ, bool &firstLine,
+                        const LayerComponent &curLayer, SegmentWithInfill* infillSeg)
+{
+    LineSegment &line = infillSeg->fillLines[lineIdx];
+
+    // Create a clean move to the line if needed
+    if (firstLine)
+        firstLine = false;
+    else if (lastPoint == line.p1 || lastPoint == line.p2)
+    {
+        // Lines that continue from the previous one, such as those of curved
+        // infill patterns, do not need a move
+        if (lastPoint == line.p2)
+            line.SwapPoints();
+    }
+    else
+    {
+        if (SquaredDist(lastPoint, line.p2) < SquaredDist(lastPoint, line.p1))
+            line.SwapPoints();
+
+        IntPoint pA, pB;
+        const Path *interPath;
+        cInt interIdx = 0;
+
+        const Path *closestPath;
+        cInt closestIdx = 0;
+        cInt closestDist = std::numeric_limits<cInt>::max();
 
         // Now check between which two outline points we are
         for (const Path &path : infillSeg->outlinePaths)
@@ -2069,292 +3206,1882 @@ static void ExtrudeLine(const std::size_t lineIdx, IntPoint &lastPoint, const cI
                 infillSeg->toolSegments.emplace<TravelSegment>(lastPoint, interPath->at(idxB),
                                                                lastZ, curLayer.moveSpeed);
 
-                for (cInt k = interIdx + 1; k < interIdx + i; k++)
-                {
-                    cInt idxA = k;
-                    idxB = k + 1;
+                for (cInt k = interIdx + 1; k < interIdx + i; k++)
+                {
+                    cInt idxA = k;
+                    idxB = k + 1;
+
+                    if (idxA >= fullSize)
+                    {
+                        idxA -= fullSize;
+                        idxB -= fullSize;
+                    }
+                    else if (idxB >= fullSize)
+                        idxB -= fullSize;
+
+                    infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxA), interPath->at(idxB),
+                                                              lastZ, curLayer.moveSpeed);
+                }
+
+                infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxB), line.p1,
+                                                          lastZ, curLayer.moveSpeed);
+            }
+            else
+            {
+                cInt idxB = interIdx;
+
+                infillSeg->toolSegments.emplace<TravelSegment>(lastPoint, interPath->at(idxB),
+                                                               lastZ, curLayer.moveSpeed);
+
+                for (cInt k = interIdx; k > (interIdx - i + 2); k--)
+                {
+                    cInt idxA = k;
+                    idxB = k - 1;
+
+                    if (idxA < 0)
+                    {
+                        idxA += fullSize;
+                        idxB += fullSize;
+                    }
+                    else if (idxB < 0)
+                        idxB += fullSize;
+
+                    infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxA), interPath->at(idxB),
+                                                              lastZ, curLayer.moveSpeed);
+                }
+
+                infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxB), line.p1,
+                                                          lastZ, curLayer.moveSpeed);
+            }
+        }
+    }
+
+    // Extrude the line
+    infillSeg->toolSegments.emplace<ExtrudeSegment>(line, lastZ, infillSeg->segmentSpeed);
+
+    lastPoint = line.p2;
+}
+
+// The fewest amount of lines that are worth replacing with an arc
+const std::size_t MinArcLines = 3;
+// Arcs with a larger radius than this (in mm) are treated as straight lines
+const double MaxArcRadius = 250.0;
+
+// Determine if all the points from startIdx to endIdx lie on a common circle, within the tolerance,
+// and are passed in a single direction. The circle is calculated through the start, middle and end point.
+static bool FitsArc(const Path &points, std::size_t startIdx, std::size_t endIdx, double tolerance,
+                    IntPoint &centre, bool &clockwise, double &sweep)
+{
+    // Work relative to the start point to keep the doubles precise
+    const IntPoint &origin = points[startIdx];
+    IntPoint b = points[(startIdx + endIdx) / 2] - origin;
+    IntPoint c = points[endIdx] - origin;
+
+    // https://en.wikipedia.org/wiki/Circumscribed_circle#Cartesian_coordinates_2
+    double d = 2.0 * ((double)b.X * c.Y - (double)b.Y * c.X);
+    if (d == 0)
+        return false;
+
+    double bSq = (double)b.X * b.X + (double)b.Y * b.Y;
+    double cSq = (double)c.X * c.X + (double)c.Y * c.Y;
+    double cX = (c.Y * bSq - b.Y * cSq) / d;
+    double cY = (b.X * cSq - c.X * bSq) / d;
+    double radius = std::sqrt(cX * cX + cY * cY);
+
+    if (radius > MaxArcRadius * scaleFactor)
+        return false;
+
+    // A positive determinant means the points turn counter clockwise
+    clockwise = (d < 0);
+    sweep = 0;
+
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        double aX = points[i].X - origin.X - cX;
+        double aY = points[i].Y - origin.Y - cY;
+        double bX = points[i + 1].X - origin.X - cX;
+        double bY = points[i + 1].Y - origin.Y - cY;
+
+        // Every point needs to be on the circle
+        if (std::abs(std::sqrt(bX * bX + bY * bY) - radius) > tolerance)
+            return false;
+
+        // Every line needs to turn in the same direction around the centre
+        double cross = aX * bY - aY * bX;
+        if ((cross < 0) != clockwise || cross == 0)
+            return false;
+
+        // The arc bulges away from the line it replaces by the sagitta of the line
+        double halfChord = std::sqrt(std::pow(bX - aX, 2) + std::pow(bY - aY, 2)) / 2.0;
+        if (halfChord > radius || (radius - std::sqrt(radius * radius - halfChord * halfChord)) > tolerance)
+            return false;
+
+        sweep += std::atan2(std::abs(cross), aX * bX + aY * bY);
+    }
+
+    // A full circle would end where it starts which cannot be written as a single arc
+    if (sweep >= 2 * PI - 0.01)
+        return false;
+
+    centre = IntPoint(origin.X + (cInt)std::round(cX), origin.Y + (cInt)std::round(cY));
+    return true;
+}
+
+// Extrude along a list of points by replacing the runs of points that lie on a circle
+// with arcs and extruding the rest as normal lines
+static void ExtrudeFittedPath(PMCollection<ToolSegment> &toolSegments, const Path &points,
+                              cInt lastZ, int speed)
+{
+    double tolerance = GlobalSettings::ArcTolerance.Get() * scaleFactor;
+    std::size_t i = 0;
+
+    while (i < points.size() - 1)
+    {
+        IntPoint centre, bestCentre;
+        bool clockwise, bestClockwise = false;
+        double sweep, bestSweep = 0;
+        std::size_t bestIdx = i;
+
+        // Grow the arc by doubling its length for as long as the points still fit on it and then search back for
+        // the last point that does, checking every length would take quadratic time as each check covers all points
+        if (tolerance > 0 && i + MinArcLines < points.size() &&
+                FitsArc(points, i, i + MinArcLines, tolerance, centre, clockwise, sweep))
+        {
+            std::size_t fits = i + MinArcLines;
+            std::size_t fails = points.size();
+
+            for (std::size_t step = 1; fits + step < points.size(); step *= 2)
+            {
+                if (!FitsArc(points, i, fits + step, tolerance, centre, clockwise, sweep))
+                {
+                    fails = fits + step;
+                    break;
+                }
+
+                fits += step;
+            }
+
+            while (fails - fits > 1)
+            {
+                std::size_t mid = fits + (fails - fits) / 2;
+                if (FitsArc(points, i, mid, tolerance, centre, clockwise, sweep))
+                    fits = mid;
+                else
+                    fails = mid;
+            }
+
+            // The arc was last calculated for another end, so it is calculated once more for the one that was found
+            FitsArc(points, i, fits, tolerance, bestCentre, bestClockwise, bestSweep);
+            bestIdx = fits;
+        }
+
+        if (bestIdx != i)
+        {
+            toolSegments.emplace<ArcSegment>(points[i], points[bestIdx], bestCentre,
+                                             bestClockwise, bestSweep, lastZ, speed);
+            i = bestIdx;
+        }
+        else
+        {
+            toolSegments.emplace<ExtrudeSegment>(points[i], points[i + 1], lastZ, speed);
+            i++;
+        }
+    }
+}
+
+// A uniform grid of candidate start points, such as the outline points of all the islands in a layer, this
+// is used by the travel optimizer to find the closest point that has not been visited yet without checking all
+// of them. Points are not removed from the grid, instead all the points of an item are skipped once it is used.
+class PointGrid
+{
+public:
+    struct Entry
+    {
+        IntPoint point;
+        // The island or segment this point belongs to
+        std::size_t item;
+        // The index of the point within its item
+        std::size_t index;
+    };
+
+private:
+    std::vector<std::vector<Entry>> cells;
+    std::vector<bool> used;
+    std::size_t itemsLeft;
+    cInt left = 0, top = 0, cellSize = 1;
+    cInt cols = 0, rows = 0;
+
+    void CheckCell(cInt x, cInt y, const IntPoint &p, Entry &closest, double &closestDist) const
+    {
+        if (x < 0 || y < 0 || x >= cols || y >= rows)
+            return;
+
+        for (const Entry &entry : cells[y * cols + x])
+        {
+            if (used[entry.item])
+                continue;
+
+            double dist = SquaredDist(p, entry.point);
+            if (dist < closestDist)
+            {
+                closestDist = dist;
+                closest = entry;
+            }
+        }
+    }
+
+public:
+    PointGrid(const std::vector<Entry> &entries, std::size_t itemCount) :
+        used(itemCount, false), itemsLeft(itemCount)
+    {
+        if (entries.size() < 1)
+        {
+            itemsLeft = 0;
+            return;
+        }
+
+        cInt right = entries.front().point.X, bottom = entries.front().point.Y;
+        left = right;
+        top = bottom;
+
+        for (const Entry &entry : entries)
+        {
+            left = std::min(left, entry.point.X);
+            right = std::max(right, entry.point.X);
+            top = std::min(top, entry.point.Y);
+            bottom = std::max(bottom, entry.point.Y);
+        }
+
+        // Aim for about two points per cell, but never more cells along a side than there are points
+        // as points spread along a line would otherwise create a lot of empty cells to search through
+        double area = (double)(right - left + 1) * (double)(bottom - top + 1);
+        cellSize = std::max((cInt)1, (cInt)std::sqrt(area * 2.0 / entries.size()));
+        cellSize = std::max(cellSize, std::max(right - left, bottom - top) / (cInt)entries.size() + 1);
+        cols = (right - left) / cellSize + 1;
+        rows = (bottom - top) / cellSize + 1;
+
+        cells.resize(cols * rows);
+        for (const Entry &entry : entries)
+            cells[((entry.point.Y - top) / cellSize) * cols + (entry.point.X - left) / cellSize].push_back(entry);
+    }
+
+    // Find the closest point of an item that has not been used yet, returns false if there is none left
+    bool Closest(const IntPoint &p, Entry &closest) const
+    {
+        if (itemsLeft == 0)
+            return false;
+
+        // Start from the cell containing the point, or the closest one if it is outside the grid
+        cInt cx = std::min(std::max((p.X - left) / cellSize, (cInt)0), cols - 1);
+        cInt cy = std::min(std::max((p.Y - top) / cellSize, (cInt)0), rows - 1);
+        double closestDist = std::numeric_limits<double>::max();
+
+        // Search the rings of cells around it until no closer point can be in the next ring
+        cInt maxRing = std::max(cols, rows);
+        for (cInt r = 0; r <= maxRing; r++)
+        {
+            for (cInt y = std::max(cy - r, (cInt)0); y <= std::min(cy + r, rows - 1); y++)
+            {
+                if (y == cy - r || y == cy + r)
+                {
+                    for (cInt x = cx - r; x <= cx + r; x++)
+                        CheckCell(x, y, p, closest, closestDist);
+                }
+                else
+                {
+                    CheckCell(cx - r, y, p, closest, closestDist);
+                    CheckCell(cx + r, y, p, closest, closestDist);
+                }
+            }
+
+            double ringDist = (double)r * cellSize;
+            if (closestDist <= ringDist * ringDist)
+                break;
+        }
+
+        return closestDist < std::numeric_limits<double>::max();
+    }
+
+    void Use(std::size_t item)
+    {
+        if (!used[item])
+        {
+            used[item] = true;
+            itemsLeft--;
+        }
+    }
+};
+
+// A point the toolpath will visit on its route through a layer, together with the item it belongs to
+// and the point where the toolpath leaves that item again
+struct RouteStop
+{
+    IntPoint point;
+    std::size_t item;
+    std::size_t index;
+    IntPoint exit;
+};
+
+// The travel from where the first stop is left to where the second one is entered, which is not
+// the same in the other direction as an island is not left where it is entered
+static inline double StopDist(const RouteStop &a, const RouteStop &b)
+{
+    return std::sqrt((double)SquaredDist(a.exit, b.point));
+}
+
+static double RouteLength(const std::vector<RouteStop> &route)
+{
+    double length = 0;
+
+    for (std::size_t i = 1; i < route.size(); i++)
+        length += StopDist(route[i - 1], route[i]);
+
+    return length;
+}
+
+// Shorten a route with 2-opt and Or-opt moves until none of them improve it anymore, the given number of moves
+// has been tried or the deadline has passed, the first stop is the point the route starts from and stays in place
+// whilst the end of the route is free. As long as the deadline is not reached the result is the same on every run.
+static void ImproveRoute(std::vector<RouteStop> &route, std::chrono::steady_clock::time_point deadline,
+                         std::size_t maxMoves)
+{
+    // Ignore moves that gain less than this, so rounding errors cannot make the moves undo each other
+    const double minGain = 0.01 * scaleFactor;
+    const std::size_t n = route.size();
+    bool improved = true;
+
+    // Reversing a part of the route also reverses the travel between its stops, which changes its length
+    // because the stops are not left where they are entered. How much it changes from the start of the
+    // route up to each stop is kept up to date so the change for any part is found at once.
+    std::vector<double> turned(n, 0);
+    auto updateTurned = [&]()
+    {
+        for (std::size_t k = 1; k < n; k++)
+            turned[k] = turned[k - 1] + StopDist(route[k], route[k - 1]) - StopDist(route[k - 1], route[k]);
+    };
+    updateTurned();
+
+    while (improved)
+    {
+        improved = false;
+
+        // 2-opt: reverse the part of the route from i to j
+        for (std::size_t i = 1; i + 1 < n; i++)
+        {
+            if (maxMoves < n - i - 1 || std::chrono::steady_clock::now() > deadline)
+                return;
+            maxMoves -= n - i - 1;
+
+            for (std::size_t j = i + 1; j < n; j++)
+            {
+                double delta = StopDist(route[i - 1], route[j]) - StopDist(route[i - 1], route[i])
+                        + turned[j] - turned[i];
+                if (j + 1 < n)
+                    delta += StopDist(route[i], route[j + 1]) - StopDist(route[j], route[j + 1]);
+
+                if (delta < -minGain)
+                {
+                    std::reverse(route.begin() + i, route.begin() + j + 1);
+                    updateTurned();
+                    improved = true;
+                }
+            }
+        }
+
+        // Or-opt: move a chain of up to three stops to between two others, possibly reversed
+        for (std::size_t len = 1; len <= 3; len++)
+        {
+            for (std::size_t i = 1; i + len <= n; i++)
+            {
+                if (maxMoves < n || std::chrono::steady_clock::now() > deadline)
+                    return;
+                maxMoves -= n;
+
+                std::size_t last = i + len - 1;
+                double removeGain = StopDist(route[i - 1], route[i]);
+                if (last + 1 < n)
+                    removeGain += StopDist(route[last], route[last + 1]) - StopDist(route[i - 1], route[last + 1]);
+
+                for (std::size_t j = 0; j < n; j++)
+                {
+                    // The chain is inserted after j
+                    if (j + 1 >= i && j <= last)
+                        continue;
+
+                    double insert, insertRev;
+                    if (j + 1 < n)
+                    {
+                        double gap = StopDist(route[j], route[j + 1]);
+                        insert = StopDist(route[j], route[i]) + StopDist(route[last], route[j + 1]) - gap;
+                        insertRev = StopDist(route[j], route[last]) + StopDist(route[i], route[j + 1]) - gap;
+                    }
+                    else
+                    {
+                        insert = StopDist(route[j], route[i]);
+                        insertRev = StopDist(route[j], route[last]);
+                    }
+                    insertRev += turned[last] - turned[i];
+
+                    if (std::min(insert, insertRev) < removeGain - minGain)
+                    {
+                        std::vector<RouteStop> chain(route.begin() + i, route.begin() + last + 1);
+                        if (insertRev < insert)
+                            std::reverse(chain.begin(), chain.end());
+
+                        route.erase(route.begin() + i, route.begin() + last + 1);
+                        std::size_t at = (j < i) ? (j + 1) : (j + 1 - len);
+                        route.insert(route.begin() + at, chain.begin(), chain.end());
+                        updateTurned();
+
+                        improved = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static std::atomic<long long> routeMicros(0);
+
+// The point aligned seams are placed closest to, the centre of the back of the part
+static IntPoint seamTarget;
+
+// Corners that turn less than this are not sharp enough to hide a seam in
+const double MinSeamCorner = 30.0 / 180.0 * PI;
+// Corners that turn within this much of the sharpest one are considered just as sharp
+const double SeamCornerMargin = 10.0 / 180.0 * PI;
+
+// Choose the vertex of a contour at which its extrusion starts and ends
+static std::size_t ChooseSeam(const Path &path, const IntPoint &lastPoint)
+{
+    std::size_t seamIdx = 0;
+    std::size_t closestDist = std::numeric_limits<std::size_t>::max();
+    SeamPlacement placement = (SeamPlacement)GlobalSettings::SeamPlacement.Get();
+
+    if (placement == SeamPlacement::SharpestCorner)
+    {
+        double sharpest = MinSeamCorner - SeamCornerMargin;
+        bool found = false;
+
+        for (std::size_t k = 0; k < path.size(); k++)
+        {
+            const IntPoint &prev = path[(k == 0) ? (path.size() - 1) : (k - 1)];
+            const IntPoint &next = path[(k + 1 == path.size()) ? 0 : (k + 1)];
+
+            double ax = path[k].X - prev.X, ay = path[k].Y - prev.Y;
+            double bx = next.X - path[k].X, by = next.Y - path[k].Y;
+            double turn = std::abs(std::atan2(ax * by - ay * bx, ax * bx + ay * by));
+
+            if (turn < MinSeamCorner)
+                continue;
+
+            std::size_t dist = SquaredDist(path[k], seamTarget);
+            if (turn > sharpest + SeamCornerMargin || (turn > sharpest - SeamCornerMargin && dist < closestDist))
+            {
+                sharpest = std::max(sharpest, turn);
+                closestDist = dist;
+                seamIdx = k;
+                found = true;
+            }
+        }
+
+        // Smooth outlines have their seam at the back instead
+        if (found)
+            return seamIdx;
+
+        closestDist = std::numeric_limits<std::size_t>::max();
+    }
+
+    FindClosestPoint(path, (placement == SeamPlacement::Nearest) ? lastPoint : seamTarget, seamIdx, closestDist);
+
+    return seamIdx;
+}
+
+// The segment whose toolpath an island starts with and so where it is entered, this is normally the
+// segment of its outer outline but thin walls are entered at the end of one of their lines
+static const LayerSegment *EntrySegment(const LayerIsland &isle)
+{
+    for (const LayerSegment *seg : isle.segments)
+    {
+        if (seg->outlinePaths.size() == 0)
+            continue;
+
+        const SegmentWithInfill *infillSeg = dynamic_cast<const SegmentWithInfill*>(seg);
+        if (infillSeg != nullptr && infillSeg->fillLines.size() == 0)
+            continue;
+
+        return seg;
+    }
+
+    // TODO: get rid of these islands
+    return nullptr;
+}
+
+// Where the toolpath of an infill segment ends when it starts closest to the given point, this follows
+// the choices ExtrudeInfillSegment and ExtrudeLine make without creating the toolpath
+static IntPoint InfillSegmentEnd(const SegmentWithInfill &infillSeg, const IntPoint &lastPoint)
+{
+    const LineList &lines = infillSeg.fillLines;
+
+    std::size_t closestDist = std::numeric_limits<std::size_t>::max();
+    std::size_t closIdx = 0;
+    bool closSwapped = false;
+    for (std::size_t k = 0; k < lines.size(); k++)
+    {
+        if ((std::size_t)SquaredDist(lastPoint, lines[k].p1) < closestDist)
+        {
+            closSwapped = false;
+            closestDist = SquaredDist(lastPoint, lines[k].p1);
+            closIdx = k;
+        }
+
+        if ((std::size_t)SquaredDist(lastPoint, lines[k].p2) < closestDist)
+        {
+            closSwapped = true;
+            closestDist = SquaredDist(lastPoint, lines[k].p2);
+            closIdx = k;
+        }
+    }
+
+    // Every following line is extruded from its end closest to the previous one
+    IntPoint end = closSwapped ? lines[closIdx].p1 : lines[closIdx].p2;
+    for (std::size_t l = 1; l < lines.size(); l++)
+    {
+        const LineSegment &line = lines[(closIdx + l) % lines.size()];
+        end = (SquaredDist(end, line.p2) < SquaredDist(end, line.p1)) ? line.p1 : line.p2;
+    }
+
+    return end;
+}
+
+// Where the toolpath of an island ends when it is entered at the given point of its entry segment, this follows
+// the choices CalculateLayerToolpath makes so the route is planned with the travel that is actually done
+static IntPoint IslandExit(const LayerIsland &isle, const IntPoint &entry, std::size_t entryIdx)
+{
+    const LayerSegment *entrySeg = EntrySegment(isle);
+    IntPoint lastPoint = entry;
+
+    for (const LayerSegment *seg : isle.segments)
+    {
+        if (seg->outlinePaths.size() == 0)
+            continue;
+
+        if (const SegmentWithInfill *infillSeg = dynamic_cast<const SegmentWithInfill*>(seg))
+        {
+            if (infillSeg->fillLines.size() > 0)
+                lastPoint = InfillSegmentEnd(*infillSeg, lastPoint);
+        }
+        else
+        {
+            for (const Path &path : seg->outlinePaths)
+            {
+                bool entered = (seg == entrySeg && &path == &seg->outlinePaths[0]);
+                lastPoint = path[entered ? entryIdx : ChooseSeam(path, lastPoint)];
+            }
+        }
+    }
+
+    return lastPoint;
+}
+
+// Plan the order in which the islands of a layer are visited, the route starts at the given point and
+// contains a stop for each island at the point of its outer outline where it should be entered
+static void PlanIslandRoute(const LayerComponent &layer, const IntPoint &startPoint, std::vector<RouteStop> &route,
+                            double &greedyLength, double &optimizedLength)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    bool alignedSeams = ((SeamPlacement)GlobalSettings::SeamPlacement.Get() != SeamPlacement::Nearest);
+
+    // Every point of the outer outline of an island is a candidate to start from, unless the seams are
+    // aligned in which case an island can only be entered at its seam. Islands that start with a thin
+    // wall can be entered at either end of any of its lines.
+    std::vector<PointGrid::Entry> entries;
+    for (std::size_t j = 0; j < layer.islandList.size(); j++)
+    {
+        const LayerSegment *entrySeg = EntrySegment(layer.islandList[j]);
+        if (entrySeg == nullptr)
+            continue;
+
+        if (const SegmentWithInfill *infillSeg = dynamic_cast<const SegmentWithInfill*>(entrySeg))
+        {
+            for (const LineSegment &line : infillSeg->fillLines)
+            {
+                entries.push_back({line.p1, j, 0});
+                entries.push_back({line.p2, j, 0});
+            }
+            continue;
+        }
+
+        const Path &outPath = entrySeg->outlinePaths[0];
+        if (alignedSeams)
+        {
+            std::size_t seamIdx = ChooseSeam(outPath, startPoint);
+            entries.push_back({outPath[seamIdx], j, seamIdx});
+        }
+        else
+        {
+            for (std::size_t k = 0; k < outPath.size(); k++)
+                entries.push_back({outPath[k], j, k});
+        }
+    }
+
+    PointGrid grid(entries, layer.islandList.size());
+
+    // Build an initial route by always moving to the closest island left, which is searched for from
+    // where the toolpath of the previous island ends
+    route.clear();
+    route.push_back({startPoint, 0, 0, startPoint});
+
+    PointGrid::Entry next;
+    while (grid.Closest(route.back().exit, next))
+    {
+        grid.Use(next.item);
+        route.push_back({next.point, next.item, next.index,
+                         IslandExit(layer.islandList[next.item], next.point, next.index)});
+    }
+
+    greedyLength = RouteLength(route);
+
+    // The time is in milliseconds and the moves in thousands of tried moves per layer
+    std::chrono::duration<double, std::milli> budget(GlobalSettings::TravelOptimizeTime.Get());
+    std::size_t maxMoves = (std::size_t)std::max(0, GlobalSettings::TravelOptimizeMoves.Get()) * 1000;
+    ImproveRoute(route, startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget), maxMoves);
+
+    optimizedLength = RouteLength(route);
+    routeMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Extrude an infill segment starting with the line end closest to the given point
+static void ExtrudeInfillSegment(SegmentWithInfill *infillSeg, IntPoint &lastPoint, const IntPoint &startNear,
+                                 cInt lastZ, const LayerComponent &curLayer, CombBoundary &boundary)
+{
+    // Find the line closest to the start point. This is only done once per segment, whose lines are all extruded
+    // afterwards anyway, so the lines are not indexed as the scan takes less than 2% of the toolpath time
+    std::size_t closestDist = std::numeric_limits<std::size_t>::max();
+    std::size_t closIdx = 0;
+    bool closSwapped = false;
+    for (std::size_t k = 0; k < infillSeg->fillLines.size(); k++)
+    {
+        const LineSegment &line = infillSeg->fillLines[k];
+
+        if ((std::size_t)SquaredDist(startNear, line.p1) < closestDist)
+        {
+            closSwapped = false;
+            closestDist = SquaredDist(startNear, line.p1);
+            closIdx = k;
+        }
+
+        // The other point can be even closer
+        if ((std::size_t)SquaredDist(startNear, line.p2) < closestDist)
+        {
+            closSwapped = true;
+            closestDist = SquaredDist(startNear, line.p2);
+            closIdx = k;
+        }
+    }
+
+    if (closSwapped)
+        infillSeg->fillLines[closIdx].SwapPoints();
+
+    // Move to the closest line
+    AddCombedMove(infillSeg->toolSegments, &boundary, lastPoint, infillSeg->fillLines[closIdx].p1,
+                  curLayer.moveSpeed, lastZ);
+
+    // Extrude all the lines
+    bool firstLine = true;
+
+    for (std::size_t k = closIdx; k < infillSeg->fillLines.size(); k++)
+        ExtrudeLine(k, lastPoint, lastZ, firstLine, curLayer, infillSeg);
+
+    for (std::size_t k = 0; k < closIdx; k++)
+        ExtrudeLine(k, lastPoint, lastZ, firstLine, curLayer, infillSeg);
+}
+
+// The point each layer's toolpath was planned from and the point where it ends
+static IntPoint *LayerStartPoints;
+static IntPoint *LayerLastPoints;
+// Statistics of the toolpath of each layer
+struct ToolpathStats
+{
+    // The length of the planned route between the islands before and after optimizing it,
+    // and the length of the moves between the islands in the toolpath that was created from it
+    double greedyTravel = 0;
+    double optimizedTravel = 0;
+    double islandTravel = 0;
+
+    std::size_t combedMoves = 0;
+    std::size_t savedRetractions = 0;
+
+    // The travel and retractions of the finished toolpath
+    double travel = 0;
+    std::size_t retractions = 0;
+};
+static ToolpathStats *LayerToolpathStats;
+
+// Create the toolpath of a single layer, starting from the end point of the layer below
+static void CalculateLayerToolpath(std::size_t i, IntPoint lastPoint)
+{
+    SlicerLog("Toolpath: " + std::to_string(i));
+    LayerComponent &curLayer = layerComponents[i];
+    ToolpathStats &stats = LayerToolpathStats[i];
+    LayerStartPoints[i] = lastPoint;
+    stats = ToolpathStats();
+
+    // Move to the new z position
+    cInt lastZ = (i > 0) ? LayerPrintZ(i - 1) : 0;
+    cInt newZ = LayerPrintZ(i);
+    curLayer.initialLayerMoves.emplace_back(lastPoint, lastZ, newZ, curLayer.layerSpeed);
+    lastZ = newZ;
+
+#ifdef TOOLPATH_TESTS
+    // TODO: we should actually move from each island to the closest one left
+    for (LayerIsland &isle : curLayer.islandList)
+    {
+        // The outline segments of an island should also have been generated before all infill type segments
+
+        // TODO: we should actually move from each segment to the closest one left
+        for (LayerSegment *seg : isle.segments)
+        {
+            // Infill segments have infill lines whilst other segments have their
+            // outlines extruded
+            if (SegmentWithInfill* segment = dynamic_cast<SegmentWithInfill*>(seg))
+            {
+                // This segment contains its linesegments in its fill polygons
+                LineList &lineList = segment->fillLines;
+
+                // Move to the next segment if this one does not have any lines
+                if (lineList.size() < 1)
+                    continue;
+
+                // We now need to move to the new segment
+                AddRetractedMove(seg->toolSegments, lastPoint, lineList.front().p1, curLayer.moveSpeed, lastZ);
+
+#ifdef TEST_INFILL
+                for (LineSegment &line : lineList)
+                {
+                    seg->toolSegments.emplace<TravelSegment>(lastPoint, line.p1, lastZ, curLayer.moveSpeed);
+                    seg->toolSegments.emplace<ExtrudeSegment>(line, lastZ, seg->segmentSpeed);
+                    lastPoint = line.p2;
+                }
+#endif
+            }
+            else
+            {
+//#define NO_OUTLINE_TOOLPATH
+#if !defined(NO_OUTLINE_TOOLPATH) || !defined(TEST_INFILL)
+                // This segment contains its linesegments in its outline polygons
+                for (Path &path : seg->outlinePaths)
+                {
+                    if (path.size() < 3)
+                        continue;
+
+                    AddRetractedMove(seg->toolSegments, lastPoint, path.front(), curLayer.moveSpeed, lastZ);
+
+                    for (std::size_t i = 0; i < path.size() - 1; i++)
+                        seg->toolSegments.emplace<ExtrudeSegment>(path[i], path[i + 1], lastZ, seg->segmentSpeed);
+
+                    seg->toolSegments.emplace<ExtrudeSegment>(path.back(), path.front(), lastZ, seg->segmentSpeed);
+
+                    lastPoint = path.front();
+                }
+#endif
+            }
+        }
+    }
+#else
+    // Plan the order of the islands
+    std::vector<RouteStop> route;
+    PlanIslandRoute(curLayer, lastPoint, route, stats.greedyTravel, stats.optimizedTravel);
+
+    for (std::size_t r = 1; r < route.size(); r++)
+    {
+        LayerIsland &curIsle = curLayer.islandList[route[r].item];
+        const LayerSegment *entrySeg = EntrySegment(curIsle);
+        IntPoint islandStart = lastPoint;
+        CombBoundary boundary(curIsle);
+        bool enteredIsle = false;
+
+        // The segments are extruded in the order they were created, outlines from the outside in followed by
+        // the top, bottom and infill segments. Visiting the infill type segments closest first instead turned
+        // out to lengthen the travel, because where a segment ends matters more than where it starts.
+        for (LayerSegment *seg : curIsle.segments)
+        {
+            if (seg->outlinePaths.size() == 0)
+                continue;
+
+            if (SegmentWithInfill* infillSeg = dynamic_cast<SegmentWithInfill*>(seg))
+            {
+                if (infillSeg->fillLines.size() == 0)
+                    continue;
+
+                // A thin wall the island is entered on starts at the line end the route was planned to enter at
+                const IntPoint &startNear = (seg == entrySeg) ? route[r].point : lastPoint;
+                ExtrudeInfillSegment(infillSeg, lastPoint, startNear, lastZ, curLayer, boundary);
+                enteredIsle = true;
+            }
+            else
+            {
+                for (const Path &path : seg->outlinePaths)
+                {
+                    // The island is entered where the route was planned to enter it, the seams of
+                    // the other paths are placed from where the toolpath is at that point
+                    bool entered = (seg == entrySeg && &path == &seg->outlinePaths[0]);
+                    std::size_t closIdx = entered ? route[r].index : ChooseSeam(path, lastPoint);
+
+                    // Move to the path, only the move to the island leaves the part
+                    if (enteredIsle)
+                        AddCombedMove(seg->toolSegments, &boundary, lastPoint, path[closIdx], curLayer.moveSpeed, lastZ);
+                    else
+                        AddRetractedMove(seg->toolSegments, lastPoint, path[closIdx], curLayer.moveSpeed, lastZ, true);
+                    enteredIsle = true;
+
+                    // Extrude the outline starting and ending with the seam
+                    Path loop;
+                    loop.reserve(path.size() + 1);
+                    loop.insert(loop.end(), path.begin() + closIdx, path.end());
+                    loop.insert(loop.end(), path.begin(), path.begin() + closIdx + 1);
+                    ExtrudeFittedPath(seg->toolSegments, loop, lastZ, seg->segmentSpeed);
+
+                    lastPoint = path[closIdx];
+                }
+            }
+        }
+
+        stats.combedMoves += boundary.combedMoves;
+        stats.savedRetractions += boundary.savedRetractions;
+
+        // The travel to the island is measured up to the start of the first extrusion in its toolpath
+        bool foundStart = false;
+        for (LayerSegment *seg : curIsle.segments)
+        {
+            for (ToolSegment *toolSeg : seg->toolSegments)
+            {
+                if (toolSeg->type != ToolSegType::Extruded)
+                    continue;
+
+                const IntPoint3 &start = static_cast<MovingSegment*>(toolSeg)->p1;
+                stats.islandTravel += std::sqrt((double)SquaredDist(islandStart, IntPoint(start.X, start.Y)));
+                foundStart = true;
+                break;
+            }
+
+            if (foundStart)
+                break;
+        }
+    }
+
+    // The islands are written in the order they are stored in, so they are put in the order of the route
+    std::vector<LayerIsland> orderedIsles;
+    std::vector<bool> routed(curLayer.islandList.size(), false);
+    orderedIsles.reserve(curLayer.islandList.size());
+    for (std::size_t r = 1; r < route.size(); r++)
+    {
+        orderedIsles.push_back(std::move(curLayer.islandList[route[r].item]));
+        routed[route[r].item] = true;
+    }
+    for (std::size_t j = 0; j < curLayer.islandList.size(); j++)
+    {
+        if (!routed[j])
+            orderedIsles.push_back(std::move(curLayer.islandList[j]));
+    }
+    curLayer.islandList.swap(orderedIsles);
+#endif
+
+    // Keep track of the travel of the toolpath whilst the layer is still in memory
+    for (const LayerIsland &isle : curLayer.islandList)
+    {
+        for (LayerSegment *seg : isle.segments)
+        {
+            for (ToolSegment *toolSeg : seg->toolSegments)
+            {
+                if (toolSeg->type == ToolSegType::Travel)
+                    stats.travel += static_cast<MovingSegment*>(toolSeg)->MoveDistance();
+                else if (toolSeg->type == ToolSegType::Retraction)
+                    stats.retractions++;
+            }
+        }
+    }
+
+    LayerLastPoints[i] = lastPoint;
+}
+
+static void CalculateToolpathMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+{
+    SlicerLog(std::string("Toolpath: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
+
+    // The layers before the first one are not known yet so start from the origin, this is corrected afterwards
+    IntPoint lastPoint(0, 0);
+
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        CalculateLayerToolpath(i, lastPoint);
+        lastPoint = LayerLastPoints[i];
+    }
+
+    *doneFlag = true;
+}
+
+// Join the toolpath of a layer that was planned from the wrong point to the actual end point of the layer below.
+// Only the moves up to the first island are changed so its seam stays where it was planned, which is cheap but
+// not quite where it would have been placed from the actual point. When the move to the first island was not
+// retracted but should be now, or it was combed, the layer can not be joined and false is returned.
+static bool JoinLayerStart(std::size_t i, const IntPoint &start)
+{
+    LayerComponent &curLayer = layerComponents[i];
+    ToolpathStats &stats = LayerToolpathStats[i];
+
+    // The move to the first island is at the start of the first segment with a toolpath
+    PMCollection<ToolSegment> *firstSegments = nullptr;
+    for (LayerIsland &isle : curLayer.islandList)
+    {
+        for (LayerSegment *seg : isle.segments)
+        {
+            if (firstSegments == nullptr && !seg->toolSegments.empty())
+                firstSegments = &seg->toolSegments;
+        }
+    }
+
+    if (firstSegments != nullptr)
+    {
+        MovingSegment *entryMove = nullptr;
+        bool retracted = false;
+        for (ToolSegment *toolSeg : *firstSegments)
+        {
+            if (toolSeg->type == ToolSegType::Retraction && !retracted)
+                retracted = true;
+            else if (toolSeg->type == ToolSegType::Travel && entryMove == nullptr)
+                entryMove = static_cast<MovingSegment*>(toolSeg);
+            else
+            {
+                // A combed move is made up of more than one travel segment
+                if (toolSeg->type == ToolSegType::Travel)
+                    return false;
+                break;
+            }
+        }
+
+        if (entryMove == nullptr)
+            return false;
+
+        IntPoint entry(entryMove->p2.X, entryMove->p2.Y);
+        if (!retracted && GlobalSettings::RetractionSpeed.Get() > 0 && GlobalSettings::RetractionDistance.Get() > 0 &&
+                SquaredDist(start, entry) > MinExitRetractTravel * MinExitRetractTravel)
+            return false;
+
+        // The planned route changes along with the toolpath
+        IntPoint oldStart(entryMove->p1.X, entryMove->p1.Y);
+        double change = std::sqrt((double)SquaredDist(start, entry)) - std::sqrt((double)SquaredDist(oldStart, entry));
+        stats.greedyTravel += change;
+        stats.optimizedTravel += change;
+        stats.islandTravel += change;
+
+        stats.travel -= entryMove->MoveDistance();
+        entryMove->SetStartPoint(start);
+        stats.travel += entryMove->MoveDistance();
+    }
+    else
+    {
+        // Without any islands the layer ends where it started
+        LayerLastPoints[i] = start;
+    }
+
+    // The move to the new z position is done above the actual point
+    for (TravelSegment &move : curLayer.initialLayerMoves)
+    {
+        move.SetStartPoint(start);
+        move.p2.X = start.X;
+        move.p2.Y = start.Y;
+    }
+
+    LayerStartPoints[i] = start;
+    return true;
+}
+
+// The layers are spilled to a file next to the gcode, a scratch directory could well be in memory
+static std::string spillDirectory;
+static SpillFile layerSpill;
+
+// Where a layer that was moved out of memory is stored in the spill file
+struct SpilledLayer
+{
+    bool spilled = false;
+    std::size_t offset = 0;
+    std::size_t length = 0;
+};
+// The geometry of layers is spilled once their infill is trimmed, their toolpath once it is finished
+static std::vector<SpilledLayer> spilledGeometry;
+static std::vector<SpilledLayer> spilledLayers;
+
+// With a memory budget the layers are spilled to disk to keep the memory they use within it, from trimming the
+// infill onwards. The stages before that work on all layers at once so the memory they use is not limited by it.
+static std::size_t memoryBudget = 0;
+static std::size_t usedMemory = 0;
+static std::vector<std::size_t> layerMemory;
+
+// With a memory budget the layers are processed this many layers per thread at a time
+const std::size_t SpillWindowLayers = 24;
+
+// The layers are stored as a list of tool segments, each starting with a byte that holds the kind of
+// segment and which of its values changed. The coordinates are stored as the difference from the
+// previous point in as few bytes as they need, which makes most of them one or two bytes.
+enum SpillFlags : uint8_t
+{
+    SpillRetraction = 0,
+    SpillTravel = 1,
+    SpillExtrude = 2,
+    SpillArc = 3,
+    SpillKindMask = 0x03,
+    SpillNewStart = 0x04,
+    SpillNewZ = 0x08,
+    SpillNewSpeed = 0x10,
+    SpillClockwise = 0x20
+};
+
+struct SpillState
+{
+    IntPoint3 lastPoint = IntPoint3(0, 0, 0);
+    int lastSpeed = 0;
+};
+
+static inline void WriteVarint(std::vector<char> &buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+
+    buffer.push_back((char)value);
+}
+
+static inline void WriteSigned(std::vector<char> &buffer, int64_t value)
+{
+    // Zigzag encode the value so small negative values stay small
+    WriteVarint(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+template <typename T>
+static inline void WriteRaw(std::vector<char> &buffer, T value)
+{
+    const char *bytes = (const char*)&value;
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads the values of a spilled layer back, reading past the end of its block fails the
+// reader and gives zeros instead so a truncated or damaged block is never read beyond
+struct SpillReader
+{
+    const char *data;
+    const char *end;
+    bool failed = false;
+
+    SpillReader(const char *_data, std::size_t length) :
+        data(_data), end(_data + length) {}
+
+    // Whether the whole block was read without running out of data
+    bool Complete() const
+    {
+        return !failed && data == end;
+    }
+
+    uint8_t Byte()
+    {
+        if (data == end)
+        {
+            failed = true;
+            return 0;
+        }
+
+        return (uint8_t)*(data++);
+    }
+
+    uint64_t Varint()
+    {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t byte = Byte();
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        failed = true;
+        return 0;
+    }
+
+    int64_t Signed()
+    {
+        uint64_t value = Varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    // The number of items that follow, as each of them takes at least a byte there can not be more than bytes left
+    std::size_t Count()
+    {
+        uint64_t count = Varint();
+        if (count > (uint64_t)(end - data))
+        {
+            failed = true;
+            return 0;
+        }
+
+        return count;
+    }
+
+    SegmentType Type()
+    {
+        uint8_t type = Byte();
+        if (type > (uint8_t)SegmentType::ThinWallSegment)
+        {
+            failed = true;
+            return SegmentType::OutlineSegment;
+        }
+
+        return (SegmentType)type;
+    }
+
+    template <typename T>
+    T Raw()
+    {
+        T value = T();
+        if ((std::size_t)(end - data) < sizeof(T))
+        {
+            failed = true;
+            data = end;
+            return value;
+        }
+
+        memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return value;
+    }
+};
+
+static void EncodeMove(std::vector<char> &buffer, const MovingSegment &move, uint8_t flags, SpillState &state)
+{
+    std::size_t flagIdx = buffer.size();
+    buffer.push_back(0);
+
+    // Most moves start where the previous one ended
+    if (!(IntPoint3(move.p1) == state.lastPoint))
+    {
+        flags |= SpillNewStart;
+        WriteSigned(buffer, move.p1.X - state.lastPoint.X);
+        WriteSigned(buffer, move.p1.Y - state.lastPoint.Y);
+        WriteSigned(buffer, move.p1.Z - state.lastPoint.Z);
+    }
+
+    WriteSigned(buffer, move.p2.X - move.p1.X);
+    WriteSigned(buffer, move.p2.Y - move.p1.Y);
+
+    if (move.p2.Z != move.p1.Z)
+    {
+        flags |= SpillNewZ;
+        WriteSigned(buffer, move.p2.Z - move.p1.Z);
+    }
+
+    if (move.speed != state.lastSpeed)
+    {
+        flags |= SpillNewSpeed;
+        WriteSigned(buffer, move.speed);
+        state.lastSpeed = move.speed;
+    }
+
+    buffer[flagIdx] = (char)flags;
+    state.lastPoint = move.p2;
+}
+
+static void EncodeToolpath(const LayerComponent &layer, std::vector<char> &buffer)
+{
+    SpillState state;
+
+    WriteVarint(buffer, layer.initialLayerMoves.size());
+    for (const TravelSegment &move : layer.initialLayerMoves)
+        EncodeMove(buffer, move, SpillTravel, state);
+
+    WriteVarint(buffer, layer.islandList.size());
+    for (const LayerIsland &isle : layer.islandList)
+    {
+        std::size_t segCount = 0;
+        for (const LayerSegment *seg : isle.segments)
+        {
+            (void)seg;
+            segCount++;
+        }
+        WriteVarint(buffer, segCount);
+
+        for (const LayerSegment *seg : isle.segments)
+        {
+            buffer.push_back((char)seg->type);
+            if (seg->type == SegmentType::InfillSegment)
+                WriteRaw(buffer, static_cast<const SegmentWithInfill*>(seg)->infillMultiplier);
+
+            std::size_t toolCount = 0;
+            for (ToolSegment *ts : seg->toolSegments)
+            {
+                (void)ts;
+                toolCount++;
+            }
+            WriteVarint(buffer, toolCount);
+
+            for (ToolSegment *ts : seg->toolSegments)
+            {
+                if (ts->type == ToolSegType::Retraction)
+                {
+                    buffer.push_back((char)SpillRetraction);
+                    WriteSigned(buffer, static_cast<RetractSegment*>(ts)->distance);
+                }
+                else if (ArcSegment *as = dynamic_cast<ArcSegment*>(ts))
+                {
+                    EncodeMove(buffer, *as, SpillArc | (as->clockwise ? SpillClockwise : 0), state);
+                    WriteSigned(buffer, as->centre.X - as->p1.X);
+                    WriteSigned(buffer, as->centre.Y - as->p1.Y);
+                    WriteRaw(buffer, as->sweep);
+                }
+                else
+                {
+                    const MovingSegment *ms = static_cast<MovingSegment*>(ts);
+                    EncodeMove(buffer, *ms, (ts->type == ToolSegType::Travel) ? SpillTravel : SpillExtrude, state);
+                }
+            }
+        }
+    }
+}
+
+// Read the toolpath of a layer back, returns false if the block ends before the layer does
+static bool DecodeToolpath(const char *data, std::size_t length, LayerComponent &layer)
+{
+    SpillReader reader(data, length);
+    SpillState state;
+
+    // Read a move and return its flags, the points are that of the move
+    auto decodeMove = [&](IntPoint3 &p1, IntPoint3 &p2, int &speed) -> uint8_t
+    {
+        uint8_t flags = reader.Byte();
+        p1 = state.lastPoint;
+
+        if (flags & SpillNewStart)
+        {
+            p1.X += reader.Signed();
+            p1.Y += reader.Signed();
+            p1.Z += reader.Signed();
+        }
+
+        p2 = p1;
+        p2.X += reader.Signed();
+        p2.Y += reader.Signed();
+
+        if (flags & SpillNewZ)
+            p2.Z += reader.Signed();
+
+        if (flags & SpillNewSpeed)
+            state.lastSpeed = reader.Signed();
+
+        speed = state.lastSpeed;
+        state.lastPoint = p2;
+        return flags;
+    };
+
+    IntPoint3 p1(0, 0, 0), p2(0, 0, 0);
+    int speed;
+
+    std::size_t moveCount = reader.Count();
+    layer.initialLayerMoves.reserve(moveCount);
+    for (std::size_t i = 0; i < moveCount; i++)
+    {
+        decodeMove(p1, p2, speed);
+        layer.initialLayerMoves.emplace_back(p1, p2, speed);
+    }
+
+    layer.islandList.resize(reader.Count());
+    for (LayerIsland &isle : layer.islandList)
+    {
+        std::size_t segCount = reader.Count();
+        for (std::size_t j = 0; j < segCount; j++)
+        {
+            SegmentType type = reader.Type();
+
+            LayerSegment *seg;
+            if (type == SegmentType::InfillSegment)
+            {
+                SegmentWithInfill &infillSeg = isle.segments.emplace<SegmentWithInfill>(type);
+                infillSeg.infillMultiplier = reader.Raw<float>();
+                seg = &infillSeg;
+            }
+            else
+                seg = &isle.segments.emplace<LayerSegment>(type);
+
+            std::size_t toolCount = reader.Count();
+            for (std::size_t k = 0; k < toolCount; k++)
+            {
+                if (reader.data < reader.end && (*reader.data & SpillKindMask) == SpillRetraction)
+                {
+                    reader.Byte();
+                    seg->toolSegments.emplace<RetractSegment>((cInt)reader.Signed());
+                    continue;
+                }
+
+                uint8_t flags = decodeMove(p1, p2, speed);
+                switch (flags & SpillKindMask)
+                {
+                case SpillTravel:
+                    seg->toolSegments.emplace<TravelSegment>(p1, p2, speed);
+                    break;
+                case SpillExtrude:
+                    seg->toolSegments.emplace<ExtrudeSegment>(p1, p2, speed);
+                    break;
+                default:
+                {
+                    IntPoint centre(p1.X, p1.Y);
+                    centre.X += reader.Signed();
+                    centre.Y += reader.Signed();
+                    double sweep = reader.Raw<double>();
+                    seg->toolSegments.emplace<ArcSegment>(IntPoint(p1.X, p1.Y), IntPoint(p2.X, p2.Y), centre,
+                                                          (bool)(flags & SpillClockwise), sweep, p1.Z, speed);
+                    break;
+                }
+                }
+            }
+        }
+    }
+
+    return reader.Complete();
+}
+
+static void EncodePaths(std::vector<char> &buffer, const Paths &paths)
+{
+    WriteVarint(buffer, paths.size());
+    for (const Path &path : paths)
+    {
+        // Each point is stored as the difference from the previous one
+        IntPoint lastPoint(0, 0);
+        WriteVarint(buffer, path.size());
+        for (const IntPoint &point : path)
+        {
+            WriteSigned(buffer, point.X - lastPoint.X);
+            WriteSigned(buffer, point.Y - lastPoint.Y);
+            lastPoint = point;
+        }
+    }
+}
+
+static void DecodePaths(SpillReader &reader, Paths &paths)
+{
+    paths.resize(reader.Count());
+    for (Path &path : paths)
+    {
+        IntPoint lastPoint(0, 0);
+        path.resize(reader.Count());
+        for (IntPoint &point : path)
+        {
+            lastPoint.X += reader.Signed();
+            lastPoint.Y += reader.Signed();
+            point = lastPoint;
+        }
+    }
+}
+
+// The geometry of a layer is stored before its toolpath is created, these are the outlines of its islands
+// and segments and the fill lines of the segments with infill together with what the toolpath needs of them
+static void EncodeGeometry(const LayerComponent &layer, std::vector<char> &buffer)
+{
+    EncodePaths(buffer, layer.outlinePaths);
+    WriteSigned(buffer, layer.layerSpeed);
+    WriteSigned(buffer, layer.moveSpeed);
+
+    WriteVarint(buffer, layer.islandList.size());
+    for (const LayerIsland &isle : layer.islandList)
+    {
+        EncodePaths(buffer, isle.outlinePaths);
+
+        std::size_t segCount = 0;
+        for (const LayerSegment *seg : isle.segments)
+        {
+            (void)seg;
+            segCount++;
+        }
+        WriteVarint(buffer, segCount);
+
+        for (const LayerSegment *seg : isle.segments)
+        {
+            const SegmentWithInfill *infillSeg = dynamic_cast<const SegmentWithInfill*>(seg);
+            buffer.push_back((char)seg->type);
+            buffer.push_back((char)(infillSeg != nullptr));
+            WriteSigned(buffer, seg->segmentSpeed);
+            EncodePaths(buffer, seg->outlinePaths);
+
+            if (infillSeg == nullptr)
+                continue;
+
+            WriteRaw(buffer, infillSeg->infillMultiplier);
+            WriteRaw(buffer, infillSeg->fillDensity);
+
+            // The lines are stored as the difference from the end of the previous one
+            IntPoint lastPoint(0, 0);
+            WriteVarint(buffer, infillSeg->fillLines.size());
+            for (const LineSegment &line : infillSeg->fillLines)
+            {
+                WriteSigned(buffer, line.p1.X - lastPoint.X);
+                WriteSigned(buffer, line.p1.Y - lastPoint.Y);
+                WriteSigned(buffer, line.p2.X - line.p1.X);
+                WriteSigned(buffer, line.p2.Y - line.p1.Y);
+                lastPoint = line.p2;
+            }
+        }
+    }
+}
+
+// Read the geometry of a layer back, returns false if the block ends before the layer does
+static bool DecodeGeometry(const char *data, std::size_t length, LayerComponent &layer)
+{
+    SpillReader reader(data, length);
+
+    DecodePaths(reader, layer.outlinePaths);
+    layer.layerSpeed = reader.Signed();
+    layer.moveSpeed = reader.Signed();
 
-                    if (idxA >= fullSize)
-                    {
-                        idxA -= fullSize;
-                        idxB -= fullSize;
-                    }
-                    else if (idxB >= fullSize)
-                        idxB -= fullSize;
+    layer.islandList.resize(reader.Count());
+    for (LayerIsland &isle : layer.islandList)
+    {
+        DecodePaths(reader, isle.outlinePaths);
 
-                    infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxA), interPath->at(idxB),
-                                                              lastZ, curLayer.moveSpeed);
-                }
+        std::size_t segCount = reader.Count();
+        for (std::size_t j = 0; j < segCount; j++)
+        {
+            SegmentType type = reader.Type();
+            bool withInfill = (reader.Byte() != 0);
 
-                infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxB), line.p1,
-                                                          lastZ, curLayer.moveSpeed);
-            }
+            LayerSegment *seg;
+            if (withInfill)
+                seg = &isle.segments.emplace<SegmentWithInfill>(type);
             else
-            {
-                cInt idxB = interIdx;
+                seg = &isle.segments.emplace<LayerSegment>(type);
 
-                infillSeg->toolSegments.emplace<TravelSegment>(lastPoint, interPath->at(idxB),
-                                                               lastZ, curLayer.moveSpeed);
+            seg->segmentSpeed = reader.Signed();
+            DecodePaths(reader, seg->outlinePaths);
 
-                for (cInt k = interIdx; k > (interIdx - i + 2); k--)
-                {
-                    cInt idxA = k;
-                    idxB = k - 1;
+            if (!withInfill)
+                continue;
 
-                    if (idxA < 0)
-                    {
-                        idxA += fullSize;
-                        idxB += fullSize;
-                    }
-                    else if (idxB < 0)
-                        idxB += fullSize;
+            SegmentWithInfill *infillSeg = static_cast<SegmentWithInfill*>(seg);
+            infillSeg->infillMultiplier = reader.Raw<float>();
+            infillSeg->fillDensity = reader.Raw<float>();
 
-                    infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxA), interPath->at(idxB),
-                                                              lastZ, curLayer.moveSpeed);
-                }
+            IntPoint lastPoint(0, 0);
+            std::size_t lineCount = reader.Count();
+            infillSeg->fillLines.reserve(lineCount);
+            for (std::size_t k = 0; k < lineCount; k++)
+            {
+                IntPoint p1 = lastPoint;
+                p1.X += reader.Signed();
+                p1.Y += reader.Signed();
 
-                infillSeg->toolSegments.emplace<TravelSegment>(interPath->at(idxB), line.p1,
-                                                          lastZ, curLayer.moveSpeed);
+                IntPoint p2 = p1;
+                p2.X += reader.Signed();
+                p2.Y += reader.Signed();
+
+                infillSeg->fillLines.emplace_back(p1, p2);
+                lastPoint = p2;
             }
         }
     }
 
-    // Extrude the line
-    infillSeg->toolSegments.emplace<ExtrudeSegment>(line, lastZ, infillSeg->segmentSpeed);
+    return reader.Complete();
+}
 
-    lastPoint = line.p2;
+static inline std::size_t PathsMemory(const Paths &paths)
+{
+    std::size_t bytes = paths.capacity() * sizeof(Path);
+    for (const Path &path : paths)
+        bytes += path.capacity() * sizeof(IntPoint);
+
+    return bytes;
 }
 
-static IntPoint *LayerLastPoints;
+// An estimate of the memory used by the data of a layer
+static std::size_t LayerMemory(const LayerComponent &layer)
+{
+    std::size_t bytes = layer.initialLayerMoves.capacity() * sizeof(TravelSegment) + PathsMemory(layer.outlinePaths)
+            + layer.islandList.capacity() * sizeof(LayerIsland);
 
-static void CalculateToolpathMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+    for (const LayerIsland &isle : layer.islandList)
+    {
+        bytes += PathsMemory(isle.outlinePaths) + isle.segments.alloc_size();
+
+        for (const LayerSegment *seg : isle.segments)
+        {
+            bytes += PathsMemory(seg->outlinePaths) + seg->toolSegments.alloc_size();
+
+            if (const SegmentWithInfill *infillSeg = dynamic_cast<const SegmentWithInfill*>(seg))
+                bytes += infillSeg->fillLines.capacity() * sizeof(LineSegment);
+        }
+    }
+
+    return bytes;
+}
+
+// Start keeping track of the memory used by the layers if there is a memory budget
+static void StartMemoryBudget()
 {
-    SlicerLog(std::string("Toolpath: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
+    memoryBudget = std::max(0.0f, GlobalSettings::ToolpathMemoryBudget.Get()) * 1024 * 1024;
+    usedMemory = 0;
+    layerMemory.assign(layerCount, 0);
+    spilledGeometry.assign(layerCount, SpilledLayer());
+    spilledLayers.assign(layerCount, SpilledLayer());
 
-    IntPoint lastPoint(0, 0);
-    cInt lastZ = std::max((double)0, (GlobalSettings::LayerHeight.Get() * scaleFactor) * ((double)(startIdx) - 0.5));
+    if (memoryBudget == 0)
+        return;
+
+    for (std::size_t i = 0; i < layerCount; i++)
+    {
+        layerMemory[i] = LayerMemory(layerComponents[i]);
+        usedMemory += layerMemory[i];
+    }
+}
+
+// The amount of layers that is processed at once, which is all of them without a memory budget
+static std::size_t SpillWindow()
+{
+    if (memoryBudget == 0)
+        return layerCount;
+
+    unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    return cores * SpillWindowLayers;
+}
 
+// Update the memory used by the given layers after they changed
+static void UpdateLayerMemory(std::size_t startIdx, std::size_t endIdx)
+{
     for (std::size_t i = startIdx; i < endIdx; i++)
     {
-        SlicerLog("Toolpath: " + std::to_string(i));
-        LayerComponent &curLayer = layerComponents[i];
+        std::size_t newMemory = LayerMemory(layerComponents[i]);
+        usedMemory += newMemory - layerMemory[i];
+        layerMemory[i] = newMemory;
+    }
+}
 
-        // Move to the new z position
-        // We need half a layerheight for the filament
-        cInt newZ = (GlobalSettings::LayerHeight.Get() * scaleFactor) * ((double)(i) + 0.5);
-        curLayer.initialLayerMoves.emplace_back(lastPoint, lastZ, newZ, curLayer.layerSpeed);
-        lastZ = newZ;
+// Move an encoded layer into the spill file and free everything the layer held
+static bool SpillLayer(std::size_t i, const std::vector<char> &buffer, SpilledLayer &spilled)
+{
+    if (!layerSpill.IsOpen() && !layerSpill.Open(spillDirectory))
+        return false;
 
-#ifdef TOOLPATH_TESTS
-        // TODO: we should actually move from each island to the closest one left
-        for (LayerIsland &isle : curLayer.islandList)
-        {
-            // The outline segments of an island should also have been generated before all infill type segments
+    if (!layerSpill.Append(buffer.data(), buffer.size(), spilled.offset))
+        return false;
 
-            // TODO: we should actually move from each segment to the closest one left
-            for (LayerSegment *seg : isle.segments)
-            {
-                // Infill segments have infill lines whilst other segments have their
-                // outlines extruded
-                if (SegmentWithInfill* segment = dynamic_cast<SegmentWithInfill*>(seg))
-                {
-                    // This segment contains its linesegments in its fill polygons
-                    LineList &lineList = segment->fillLines;
+    spilled.length = buffer.size();
+    spilled.spilled = true;
 
-                    // Move to the next segment if this one does not have any lines
-                    if (lineList.size() < 1)
-                        continue;
+    layerComponents[i].~LayerComponent();
+    new ((void*)(layerComponents + i)) LayerComponent();
 
-                    // We now need to move to the new segment
-                    AddRetractedMove(seg->toolSegments, lastPoint, lineList.front().p1, curLayer.moveSpeed, lastZ);
+    usedMemory -= layerMemory[i];
+    layerMemory[i] = 0;
 
-#ifdef TEST_INFILL
-                    for (LineSegment &line : lineList)
-                    {
-                        seg->toolSegments.emplace<TravelSegment>(lastPoint, line.p1, lastZ, curLayer.moveSpeed);
-                        seg->toolSegments.emplace<ExtrudeSegment>(line, lastZ, seg->segmentSpeed);
-                        lastPoint = line.p2;
-                    }
-#endif
-                }
-                else
-                {
-//#define NO_OUTLINE_TOOLPATH
-#if !defined(NO_OUTLINE_TOOLPATH) || !defined(TEST_INFILL)
-                    // This segment contains its linesegments in its outline polygons
-                    for (Path &path : seg->outlinePaths)
-                    {
-                        if (path.size() < 3)
-                            continue;
+    return true;
+}
 
-                        AddRetractedMove(seg->toolSegments, lastPoint, path.front(), curLayer.moveSpeed, lastZ);
+// Move the geometry of a layer with trimmed infill into the spill file
+static bool SpillGeometry(std::size_t i)
+{
+    std::vector<char> buffer;
+    EncodeGeometry(layerComponents[i], buffer);
 
-                        for (std::size_t i = 0; i < path.size() - 1; i++)
-                            seg->toolSegments.emplace<ExtrudeSegment>(path[i], path[i + 1], lastZ, seg->segmentSpeed);
+    return SpillLayer(i, buffer, spilledGeometry[i]);
+}
 
-                        seg->toolSegments.emplace<ExtrudeSegment>(path.back(), path.front(), lastZ, seg->segmentSpeed);
+// Move the finished toolpath of a layer into the spill file
+static bool SpillToolpath(std::size_t i)
+{
+    std::vector<char> buffer;
+    EncodeToolpath(layerComponents[i], buffer);
 
-                        lastPoint = path.front();
-                    }
-#endif
-                }
-            }
-        }
-#else
-        // Create a list of islands left to go to
-        std::size_t isleCount = curLayer.islandList.size();
-        std::size_t islesLeft = isleCount;
-        bool *islesUsed = new bool[isleCount];
-        for (std::size_t i = 0; i < isleCount; i++)
-            islesUsed[i] = false;
+    return SpillLayer(i, buffer, spilledLayers[i]);
+}
 
-        // Continue to the closest island until all have been moved to
-        while (islesLeft > 0)
-        {
-            std::size_t closestIsle = 0;
-            std::size_t closestPoint = 0;
-            std::size_t closestDist = std::numeric_limits<std::size_t>::max();
+// Read the geometry of a spilled layer back into the layer, this fails if the block can not be read completely
+static bool RestoreGeometry(std::size_t i)
+{
+    SpilledLayer &spilled = spilledGeometry[i];
+    const char *data = layerSpill.Read(spilled.offset, spilled.length);
+    if (data == nullptr || !DecodeGeometry(data, spilled.length, layerComponents[i]))
+        return false;
 
-            // Do a binary search for the closest point on each island
-            for (std::size_t j = 0; j < isleCount; j++)
-            {
-                if (islesUsed[j])
-                    continue;
+    layerSpill.Release(spilled.offset, spilled.length);
+    spilled.spilled = false;
 
-                LayerIsland &isle = curLayer.islandList[j];
-                LayerSegment *outSeg = isle.segments.begin().operator *();
+    return true;
+}
 
-                // TODO: get rid of these segments
-                if (outSeg->outlinePaths.size() == 0)
-                {
-                    islesUsed[j] = true;
-                    islesLeft--;
-                    continue;
-                }
+// Read the toolpath of a spilled layer back, this fails if the block can not be read completely
+static bool RestoreToolpath(std::size_t i, LayerComponent &layer)
+{
+    const SpilledLayer &spilled = spilledLayers[i];
+    const char *data = layerSpill.Read(spilled.offset, spilled.length);
+    if (data == nullptr || !DecodeToolpath(data, spilled.length, layer))
+        return false;
 
-                Path &outPath = outSeg->outlinePaths[0];
+    layerSpill.Release(spilled.offset, spilled.length);
 
-                if (FindClosestPoint(outPath, lastPoint, closestPoint, closestDist))
-                    closestIsle = j;
-            }
+    return true;
+}
+
+static void TrimInfillMF(std::size_t startIdx, std::size_t endIdx, bool* doneFlag)
+{
+    SlicerLog(std::string("Trim infill: ") + std::to_string(startIdx) + std::string(" to ") + std::to_string(endIdx));
 
-            // Now we can handle this island
-            islesUsed[closestIsle] = true;
-            islesLeft--;
-            LayerIsland &curIsle = curLayer.islandList[closestIsle];
+    // Even layers go right
+    bool right = (std::div(startIdx, 2).rem == 0);
 
-            bool firstSeg = true;
+    for (std::size_t i = startIdx; i < endIdx; i++)
+    {
+        SlicerLog("Trim infill: " + std::to_string(i));
 
-            // Create the commands for the other segments
-            for (LayerSegment *seg : curIsle.segments)
+        for (LayerIsland &isle : layerComponents[i].islandList)
+        {
+            for (LayerSegment *segment : isle.segments)
             {
-                if (seg->outlinePaths.size() == 0)
-                    continue;
-
-                if (SegmentWithInfill* infillSeg = dynamic_cast<SegmentWithInfill*>(seg))
+                if (SegmentWithInfill* seg = dynamic_cast<SegmentWithInfill*>(segment))
                 {
-                    if (infillSeg->fillLines.size() == 0)
-                        continue;
+                    bool goRight = right;
+                    float density;
 
-                    // Find the closest line to start from
-                    closestDist = std::numeric_limits<std::size_t>::max();
-                    std::size_t closIdx = 0;
-                    bool closSwapped = false;
-                    for (std::size_t k = 0; k < infillSeg->fillLines.size(); k++)
+                    switch (seg->type)
                     {
-                        const LineSegment &line = infillSeg->fillLines[k];
-
-                        if ((std::size_t)SquaredDist(lastPoint, line.p1) < closestDist)
-                        {
-                            closSwapped = false;
-                            closestDist = SquaredDist(lastPoint, line.p1);
-                            closIdx = k;
-                        }
-
-                        // The other point can be even closer
-                        if ((std::size_t)SquaredDist(lastPoint, line.p2) < closestDist)
-                        {
-                            closSwapped = true;
-                            closestDist = SquaredDist(lastPoint, line.p2);
-                            closIdx = k;
-                        }
+                    case SegmentType::InfillSegment:
+                        // If the segment is an infill segment then we need to trim the correlating infill grid to fill it
+                        density = GlobalSettings::InfillDensity.Get();
+                        break;
+                    case SegmentType::BottomSegment: case SegmentType::TopSegment: case SegmentType::ThinWallSegment:
+                        // If this is a top, bottom or thin wall segment then we need to trim the solid infill grid to fill it
+                        density = 100.0f;
+                        break;
+                    case SegmentType::RaftSegment:
+                        // Raft segments were given their density when they were generated
+                        density = seg->fillDensity;
+                        break;
+                    case SegmentType::SupportSegment:
+                        // If this is a support segment then we need to trim the support infill grid to fill it
+                        density = GlobalSettings::SupportDensity.Get();
+                        goRight = false;
+                        break;
+                    default:
+                        std::cout << "Unhandled infill segment of type number: " << (int)seg->type << std::endl;
+                        break;
                     }
 
-                    if (closSwapped)
-                        infillSeg->fillLines[closIdx].SwapPoints();
+                    if (density <= 0)
+                        continue;
 
-                    // Move to the closest line
-                    AddRetractedMove(infillSeg->toolSegments, lastPoint, infillSeg->fillLines[closIdx].p1, curLayer.moveSpeed, lastZ);
+#ifdef FAILSAFE_INFILL
+                    ClipLinesToPaths(seg->fillLines, (goRight) ? InfillGridMap[density].rightList :
+                                                              InfillGridMap[density].leftList, seg->outlinePaths);
+#else
+                    // Sparse infill can use one of the cached patterns instead of lines
+                    InfillPattern pattern = (InfillPattern)GlobalSettings::InfillPattern.Get();
+                    if (seg->type == SegmentType::InfillSegment && pattern != InfillPattern::Lines)
+                        ClipPatternToPaths(seg->fillLines, density, layerZ[i],
+                                           pattern == InfillPattern::Cubic, seg->outlinePaths);
+                    else
+                        FillInPaths(seg->outlinePaths, seg->fillLines, density, goRight);
+#endif
 
-                    // Extrude all the lines
-                    bool firstLine = true;
+                    seg->fillDensity = density;
+                }
+            }
+        }
 
-                    for (std::size_t k = closIdx; k < infillSeg->fillLines.size(); k++)
-                        ExtrudeLine(k, lastPoint, lastZ, firstLine, curLayer, infillSeg);
+        right = !right;
+    }
 
-                    for (std::size_t k = 0; k < closIdx; k++)
-                        ExtrudeLine(k, lastPoint, lastZ, firstLine, curLayer, infillSeg);
-                }
-                else
-                {
-                    for (const Path &path : seg->outlinePaths)
-                    {
-                        // Find the closest point to the previous segment if needed
-                        std::size_t closIdx = 0;
-                        if (firstSeg)
-                        {
-                            closIdx = closestPoint;
-                            firstSeg = false;
-                        }
-                        else
-                        {
-                            closestDist = std::numeric_limits<std::size_t>::max();
-                            FindClosestPoint(path, lastPoint, closIdx, closestDist);
-                        }
+    *doneFlag = true;
+}
 
-                        // Move to the path
-                        AddRetractedMove(seg->toolSegments, lastPoint, path[closIdx], curLayer.moveSpeed, lastZ);
+static inline void TrimInfill()
+{
+    SlicerLog("Trimming infill");
 
-                        // Extrude the outline starting with the closest point
-                        for (std::size_t k = closIdx; k < path.size()-1; k++)
-                           seg->toolSegments.emplace<ExtrudeSegment>(path[k], path[k + 1], lastZ, seg->segmentSpeed);
+    // Without a memory budget all layers are trimmed at once, otherwise a window of layers is trimmed at a time
+    // after which the oldest trimmed layers are spilled to disk for as long as the budget is exceeded
+    StartMemoryBudget();
+    std::size_t window = SpillWindow();
+    std::size_t spillCount = 0;
+    std::size_t nextSpill = 0;
 
-                        seg->toolSegments.emplace<ExtrudeSegment>(path.back(), path.front(), lastZ, seg->segmentSpeed);
+    for (std::size_t windowStart = 0; windowStart < layerCount; windowStart += window)
+    {
+        std::size_t windowEnd = std::min(layerCount, windowStart + window);
+        MultiRunFunction(TrimInfillMF, windowStart, windowEnd);
 
-                        for (std::size_t k = 0; k < closIdx; k++)
-                           seg->toolSegments.emplace<ExtrudeSegment>(path[k], path[k + 1], lastZ, seg->segmentSpeed);
+        if (memoryBudget == 0)
+            continue;
 
-                        lastPoint = path[closIdx];
-                    }
-                }
+        UpdateLayerMemory(windowStart, windowEnd);
+        while (usedMemory > memoryBudget && nextSpill < windowEnd)
+        {
+            if (!SpillGeometry(nextSpill))
+            {
+                SlicerLog("Could not spill layer " + std::to_string(nextSpill) + ", keeping all layers in memory");
+                memoryBudget = 0;
+                break;
             }
-        }
-
-        delete[] islesUsed;
-#endif
 
-        LayerLastPoints[i] = lastPoint;
+            nextSpill++;
+            spillCount++;
+        }
     }
 
-    *doneFlag = true;
+    if (spillCount > 0)
+        SlicerLog("Spilled the geometry of " + std::to_string(spillCount) + " layers to disk");
+
+#ifndef FAILSAFE_INFILL
+    SlicerLog("Solid infill: " + std::to_string(solidFillLines) + " lines in "
+              + std::to_string(solidFillMicros / 1000.0) + "ms of thread time");
+    SlicerLog("Sparse infill: " + std::to_string(sparseFillLines) + " lines in "
+              + std::to_string(sparseFillMicros / 1000.0) + "ms of thread time");
+
+    solidFillLines = 0;
+    solidFillMicros = 0;
+    sparseFillLines = 0;
+    sparseFillMicros = 0;
+#endif
 }
 
-static inline void CalculateToolpath()
+static inline bool CalculateToolpath()
 {
     SlicerLog("Calculating toolpath");
 
+    LayerStartPoints = new IntPoint[layerCount];
     LayerLastPoints = new IntPoint[layerCount];
+    LayerToolpathStats = new ToolpathStats[layerCount];
+    routeMicros = 0;
+
+    // Aligned seams are placed closest to the centre of the back of the part
+    seamTarget = IntPoint((cInt)((sliceMesh->MinVec.x + sliceMesh->MaxVec.x) / 2 * scaleFactor),
+                          (cInt)(sliceMesh->MaxVec.y * scaleFactor));
+
+    // Without a memory budget all layers are done at once, otherwise a window of layers is done at a time. The
+    // layers of a window whose geometry was spilled when their infill was trimmed are read back first, and once
+    // the window is finished the oldest finished layers are spilled to disk for as long as the budget is exceeded.
+    std::size_t window = SpillWindow();
+    spilledGeometry.resize(layerCount);
+    spilledLayers.resize(layerCount);
+    layerMemory.resize(layerCount);
+
+    std::size_t joinCount = 0;
+    std::size_t replanCount = 0;
+    std::size_t spillCount = 0;
+    std::size_t nextSpill = 0;
+    bool restored = true;
+
+    for (std::size_t windowStart = 0; windowStart < layerCount; windowStart += window)
+    {
+        std::size_t windowEnd = std::min(layerCount, windowStart + window);
+
+        for (std::size_t i = windowStart; i < windowEnd && restored; i++)
+        {
+            if (spilledGeometry[i].spilled && !RestoreGeometry(i))
+            {
+                SlicerLog("Could not read back layer " + std::to_string(i) + ", aborting");
+                restored = false;
+            }
+        }
+
+        if (!restored)
+            break;
+
+        MultiRunFunction(CalculateToolpathMF, windowStart, windowEnd);
+
+        // The first layer of each thread was planned from the origin, those are joined to the actual end point of
+        // the layer below. Only when that is not possible is the layer redone, and since where a layer ends can
+        // depend on where it starts the layer above it may then have to be joined as well.
+        for (std::size_t i = std::max(windowStart, (std::size_t)1); i < windowEnd; i++)
+        {
+            if (LayerStartPoints[i] == LayerLastPoints[i - 1])
+                continue;
+
+            if (JoinLayerStart(i, LayerLastPoints[i - 1]))
+            {
+                joinCount++;
+                continue;
+            }
+
+            LayerComponent &curLayer = layerComponents[i];
+            curLayer.initialLayerMoves.clear();
+            for (LayerIsland &isle : curLayer.islandList)
+            {
+                for (LayerSegment *seg : isle.segments)
+                    seg->toolSegments.clear();
+            }
 
-    MultiRunFunction(CalculateToolpathMF, 0, layerCount);
+            CalculateLayerToolpath(i, LayerLastPoints[i - 1]);
+            replanCount++;
+        }
+
+        if (memoryBudget == 0)
+            continue;
+
+        UpdateLayerMemory(windowStart, windowEnd);
+
+        // The layers of this window are finished so they can all be spilled
+        while (usedMemory > memoryBudget && nextSpill < windowEnd)
+        {
+            if (!SpillToolpath(nextSpill))
+            {
+                SlicerLog("Could not spill layer " + std::to_string(nextSpill) + ", keeping all layers in memory");
+                memoryBudget = 0;
+                break;
+            }
+
+            nextSpill++;
+            spillCount++;
+        }
+    }
 
-    // Adjust the starting position of each layer to the end of the last one
-    for (std::size_t i = 1; i < layerCount; i++)
+    if (!restored)
+    {
+        delete[] LayerStartPoints;
+        delete[] LayerLastPoints;
+        delete[] LayerToolpathStats;
+        return false;
+    }
+
+    // Keep track of the total travel of the toolpath
+    ToolpathStats totalStats;
+    for (std::size_t i = 0; i < layerCount; i++)
     {
-        if (layerComponents[i].initialLayerMoves.size() > 0)
-            layerComponents[i].initialLayerMoves[0].SetStartPoint(LayerLastPoints[i - 1]);
+        totalStats.greedyTravel += LayerToolpathStats[i].greedyTravel;
+        totalStats.optimizedTravel += LayerToolpathStats[i].optimizedTravel;
+        totalStats.islandTravel += LayerToolpathStats[i].islandTravel;
+        totalStats.combedMoves += LayerToolpathStats[i].combedMoves;
+        totalStats.savedRetractions += LayerToolpathStats[i].savedRetractions;
+        totalStats.travel += LayerToolpathStats[i].travel;
+        totalStats.retractions += LayerToolpathStats[i].retractions;
     }
 
+    SlicerLog("Joined " + std::to_string(joinCount) + " and replanned " + std::to_string(replanCount) +
+              " layers from the end of the layer below");
+    SlicerLog("Travel between islands: " + std::to_string((long long)(totalStats.greedyTravel / scaleFactor)) +
+              " mm when moving to the closest, " +
+              std::to_string((long long)(totalStats.optimizedTravel / scaleFactor)) +
+              " mm after optimizing in " + std::to_string(routeMicros / 1000) + " ms, " +
+              std::to_string((long long)(totalStats.islandTravel / scaleFactor)) + " mm in the toolpath");
+    SlicerLog("Combing kept " + std::to_string(totalStats.combedMoves) + " moves inside the part, saving " +
+              std::to_string(totalStats.savedRetractions) + " retractions, " +
+              std::to_string(totalStats.retractions) + " left");
+    SlicerLog("Total travel: " + std::to_string((long long)(totalStats.travel / scaleFactor)) + " mm");
+    if (spillCount > 0)
+        SlicerLog("Spilled the toolpath of " + std::to_string(spillCount) + " layers to disk, using " +
+                  std::to_string(layerSpill.Size() / 1024) + " KiB in total");
+
+    delete[] LayerStartPoints;
     delete[] LayerLastPoints;
+    delete[] LayerToolpathStats;
+
+    return true;
 }
 
 #if defined(TEST_ISLAND_DETECTION) || defined(TEST_OUTLINE_GENERATION)
@@ -2373,8 +5100,7 @@ static inline void CalculateBasicToolpath()
         LayerComponent &curLayer = layerComponents[i];
 
         // Move to the new z position
-        // We need half a layerheight for the filament
-        cInt newZ = (GlobalSettings::LayerHeight.Get() * scaleFactor) * ((double)(i) + 0.5);
+        cInt newZ = LayerPrintZ(i);
         curLayer.initialLayerMoves.emplace_back(lastPoint, lastZ, newZ, curLayer.layerSpeed);
         lastZ = newZ;
 
@@ -2414,7 +5140,8 @@ static inline void CalculateBasicToolpath()
 }
 #endif
 
-static inline void StoreGCode(std::string outFilePath)
+// Returns whether the whole toolpath has been written
+static inline bool StoreGCode(std::string outFilePath)
 {
     //  TODO: implement this
     SlicerLog("Storing GCode");
@@ -2424,7 +5151,7 @@ static inline void StoreGCode(std::string outFilePath)
     if (!os)
     {
         std::cout << "Could not write gcode file." << std::endl;
-        return;
+        return false;
     }
 
     float currentE = 0.0f;
@@ -2452,7 +5179,24 @@ static inline void StoreGCode(std::string outFilePath)
     {
         SlicerLog("Writing: " + std::to_string(layerNum));
 
-        const LayerComponent &layer = layerComponents[layerNum];
+        // Layers that were spilled to disk are read back one at a time
+        LayerComponent restoredLayer;
+        const LayerComponent *layerPtr = &layerComponents[layerNum];
+        if (layerNum < spilledLayers.size() && spilledLayers[layerNum].spilled)
+        {
+            // Writing on without the layer would print everything above it in mid air,
+            // so the slice is aborted and the unfinished gcode file removed
+            if (!RestoreToolpath(layerNum, restoredLayer))
+            {
+                SlicerLog("Could not read back layer " + std::to_string(layerNum) + ", aborting");
+                os.close();
+                std::remove(outFilePath.c_str());
+                return false;
+            }
+            layerPtr = &restoredLayer;
+        }
+
+        const LayerComponent &layer = *layerPtr;
         os << ";Layer: " << layerNum << std::endl;
 
         for (const TravelSegment &move : layer.initialLayerMoves)
@@ -2498,6 +5242,12 @@ static inline void StoreGCode(std::string outFilePath)
             {
                 os << ";Segment: " << (int)seg->type << std::endl; // TODO
 
+                // Combined infill segments represent more than one layer
+                // TODO: also apply the multiplier of bridges once they are detected as such
+                float multiplier = 1.0f;
+                if (seg->type == SegmentType::InfillSegment)
+                    multiplier = static_cast<const SegmentWithInfill*>(seg)->infillMultiplier;
+
                 for (ToolSegment *ts : seg->toolSegments)
                 {
                     if (ts->type == ToolSegType::Retraction)
@@ -2523,11 +5273,14 @@ static inline void StoreGCode(std::string outFilePath)
                             // If the printhead has retracted then we first need to get it back at the correct e before continuing
                             if (retracted)
                             {
-                                os << "G1 E" << currentE;
+                                os << "G1 E" << currentE << std::endl;
                                 retracted = false;
                             }
 
-                            os << "G1";
+                            if (ArcSegment *as = dynamic_cast<ArcSegment*>(ms))
+                                os << ((as->clockwise) ? "G2" : "G3");
+                            else
+                                os << "G1";
                         }
                         else
                             os << "G0";
@@ -2554,12 +5307,19 @@ static inline void StoreGCode(std::string outFilePath)
                             os << " Z" << prevZ;
                         }
 
+                        if (ArcSegment *as = dynamic_cast<ArcSegment*>(ms))
+                        {
+                            // The centre is given relative to the start of the arc
+                            os << " I" << (float)((as->centre.X - as->p1.X) / scaleFactor);
+                            os << " J" << (float)((as->centre.Y - as->p1.Y) / scaleFactor);
+                        }
+
                         if (ms->type == ToolSegType::Extruded)
                         {
                             ExtrudeSegment *es = (ExtrudeSegment*)(ms);
 
                             // The e position should always change so there is no need to check if it changed
-                            currentE += es->ExtrusionDistance(); // *layer.InfillMulti
+                            currentE += es->ExtrusionDistance(layerHeights[layerNum] * multiplier);
 
                             os << " E" << currentE;
 
@@ -2598,15 +5358,22 @@ static inline void StoreGCode(std::string outFilePath)
 
     os.flush();
     os.close();
+
+    return true;
 }
 
 void ChopperEngine::SliceFile(Mesh *inputMesh, std::string outputFile)
 {
     sliceMesh = inputMesh;
 
-    // Calculate the amount layers that will be sliced
-    // TODO
-    layerCount = (std::size_t)(sliceMesh->MaxVec.z / GlobalSettings::LayerHeight.Get()) + 1;
+    // Spilled layers are stored next to the gcode
+    std::size_t slashIdx = outputFile.find_last_of('/');
+    spillDirectory = (slashIdx == std::string::npos) ? "." : outputFile.substr(0, slashIdx);
+
+    // Calculate the amount layers that will be sliced and their heights
+    CalculateLayerHeights();
+    AddRaftLayers();
+    layerCount = layerZ.size();
 
     if (layerComponents != nullptr)
         layerComponents = (LayerComponent*)realloc(layerComponents, sizeof(LayerComponent) * layerCount);
@@ -2618,6 +5385,7 @@ void ChopperEngine::SliceFile(Mesh *inputMesh, std::string outputFile)
 
     // Slice the triangles into layers
     SliceTrigsToLayers();
+    bool calculated = true;
 
 #ifdef TEST_INITIAL_LINES
     ToolpathLines();
@@ -2629,7 +5397,7 @@ void ChopperEngine::SliceFile(Mesh *inputMesh, std::string outputFile)
     CalculateIslandsFromInitialLines();
     GenerateOutlineSegments();
 #ifdef TEST_OUTLINE_TOOLPATH
-    CalculateToolpath();
+    calculated = CalculateToolpath();
 #else
     CalculateBasicToolpath();
 #endif
@@ -2645,6 +5413,7 @@ void ChopperEngine::SliceFile(Mesh *inputMesh, std::string outputFile)
     GenerateInfillGrids();
 #else
     CalculateDensityDividers();
+    GenerateInfillPatterns();
 #endif
 
     // The top and bottom segments need to calculated before
@@ -2658,28 +5427,32 @@ void ChopperEngine::SliceFile(Mesh *inputMesh, std::string outputFile)
     // Calculate the support segments
     CalculateSupportSegments();
 
-#ifdef COMBINE_INFILL
     // Combine the infill segments
     CombineInfillSegments();
-#endif
 
-    // Generate a raft
+    // Generate a raft and a skirt around the first layer
+    CalculateFirstLayerOutline();
     GenerateRaft();
 
-    // Generate a skirt
     GenerateSkirt();
 
     // Tim the infill grids to fit the segments
     TrimInfill();
 
-    // Calculate the toolpath
-    CalculateToolpath();
+    // Calculate the toolpath, this fails when a layer that was spilled to disk can not be read back
+    calculated = CalculateToolpath();
 #endif
 
     // Write the toolpath as gcode
-    StoreGCode(outputFile);
-
-    SlicerLog("Done with " + outputFile);
+    bool stored = calculated && StoreGCode(outputFile);
+    layerSpill.Close();
+    spilledGeometry.clear();
+    spilledLayers.clear();
+    layerMemory.clear();
+    memoryBudget = 0;
+
+    if (stored)
+        SlicerLog("Done with " + outputFile);
 
     // Free the memory
     if (layerComponents != nullptr)
@@ -8,6 +8,27 @@ namespace ChopperEngine
 {
     typedef void (*LogDelegate)(std::string message);
 
+    // The patterns that can be used for sparse infill
+    enum class InfillPattern
+    {
+        Lines = 0,
+        Grid = 1,
+        Triangles = 2,
+        Cubic = 3,
+        Gyroid = 4
+    };
+
+    // Where the start and end of each outline, its seam, is placed
+    enum class SeamPlacement
+    {
+        // Closest to where the toolpath was before the outline
+        Nearest = 0,
+        // Closest to the centre of the back of the part, so the seams of all layers line up
+        Back = 1,
+        // In the sharpest corner of the outline, of corners that are about as sharp the one closest to the back
+        SharpestCorner = 2
+    };
+
     extern void SliceFile(Mesh* inputMesh, std::string outputFile);
     extern void SlicerLog(std::string message);
     extern std::size_t layerCount;
@@ -38,6 +38,8 @@ public:
         other.items = nullptr;
         curAlloc = other.curAlloc;
         curUsed = other.curUsed;
+        other.curAlloc = 0;
+        other.curUsed = 0;
     }
 
     PMCollection(const PMCollection &other) = delete;
@@ -82,6 +84,27 @@ public:
     {
         back()->~Base();
         curUsed -= offsets.back();
+        offsets.pop_back();
+    }
+
+    void clear()
+    {
+        for (auto itr = begin(); itr != end(); ++itr)
+            (*itr)->~Base();
+
+        curUsed = 0;
+        offsets.clear();
+    }
+
+    bool empty() const
+    {
+        return curUsed == 0;
+    }
+
+    // The amount of bytes allocated for the items
+    std::size_t alloc_size() const
+    {
+        return curAlloc;
     }
 
     void shrink_to_fit()
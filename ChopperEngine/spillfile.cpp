@@ -0,0 +1,111 @@
+#include "spillfile.h"
+
+#include <vector>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+SpillFile::~SpillFile()
+{
+    Close();
+}
+
+bool SpillFile::Open(const std::string &directory)
+{
+    Close();
+
+    std::string path = directory + "/.chopperspill.XXXXXX";
+    std::vector<char> pathBuffer(path.begin(), path.end());
+    pathBuffer.push_back('\0');
+
+    fd = mkstemp(pathBuffer.data());
+    if (fd == -1)
+        return false;
+
+    // The file stays usable through its descriptor after being unlinked
+    unlink(pathBuffer.data());
+    return true;
+}
+
+void SpillFile::Close()
+{
+    if (mapping != nullptr)
+        munmap(mapping, mappedSize);
+
+    if (fd != -1)
+        close(fd);
+
+    fd = -1;
+    size = 0;
+    mapping = nullptr;
+    mappedSize = 0;
+}
+
+bool SpillFile::Append(const char *data, std::size_t length, std::size_t &offset)
+{
+    if (fd == -1)
+        return false;
+
+    std::size_t written = 0;
+    while (written < length)
+    {
+        ssize_t result = pwrite(fd, data + written, length - written, size + written);
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        // A partially written block is overwritten by the next one as the size is not changed
+        if (result <= 0)
+            return false;
+
+        written += result;
+    }
+
+    offset = size;
+    size += length;
+    return true;
+}
+
+const char *SpillFile::Read(std::size_t offset, std::size_t length)
+{
+    if (fd == -1 || offset > size || length > size - offset)
+        return nullptr;
+
+    if (mapping == nullptr || offset + length > mappedSize)
+    {
+        if (mapping != nullptr)
+            munmap(mapping, mappedSize);
+
+        mapping = nullptr;
+        mappedSize = 0;
+        if (size == 0)
+            return nullptr;
+
+        void *result = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (result == MAP_FAILED)
+            return nullptr;
+
+        mapping = (char*)result;
+        mappedSize = size;
+
+        // The blocks are mostly read in the order they were written
+        madvise(mapping, mappedSize, MADV_SEQUENTIAL);
+    }
+
+    return mapping + offset;
+}
+
+void SpillFile::Release(std::size_t offset, std::size_t length)
+{
+    if (mapping == nullptr)
+        return;
+
+    // Only whole pages can be released
+    std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::size_t start = (offset + pageSize - 1) / pageSize * pageSize;
+    std::size_t end = (offset + length) / pageSize * pageSize;
+
+    if (end > start)
+        madvise(mapping + start, end - start, MADV_DONTNEED);
+}
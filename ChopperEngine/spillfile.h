@@ -0,0 +1,45 @@
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include <string>
+#include <cstddef>
+
+// This class provides a scratch file that blocks of data can be
+// appended to, and that is memory mapped to read them back. The file
+// is removed as soon as it is created so it never outlives the process
+// that uses it.
+class SpillFile
+{
+private:
+    int fd = -1;
+    std::size_t size = 0;
+    char *mapping = nullptr;
+    std::size_t mappedSize = 0;
+
+public:
+    SpillFile() {}
+    SpillFile(const SpillFile &other) = delete;
+    ~SpillFile();
+
+    // Create the file in the given directory, returns false if that was not possible
+    bool Open(const std::string &directory);
+    void Close();
+
+    bool IsOpen() const { return fd != -1; }
+    std::size_t Size() const { return size; }
+
+    // Append a block to the end of the file and return the offset it was stored at,
+    // returns false if the block could not be written in which case nothing was added
+    bool Append(const char *data, std::size_t length, std::size_t &offset);
+
+    // Get a block that was appended before, the file is mapped again when the block was appended
+    // after the last time it was mapped so the block is only valid until the next call to this.
+    // Returns nullptr if the block does not lie within the file.
+    const char *Read(std::size_t offset, std::size_t length);
+
+    // Tell the system that the pages of a block are not needed anymore
+    // so they do not keep using memory after being read
+    void Release(std::size_t offset, std::size_t length);
+};
+
+#endif // SPILLFILE_H
@@ -22,7 +22,7 @@ struct SettingValue
 
     SettingValue(const void *_bytes, std::size_t _byteCnt)
     {
-        bytes = std::shared_ptr<char>(new char(_byteCnt));
+        bytes = std::shared_ptr<char>(new char[_byteCnt], std::default_delete<char[]>());
         memcpy(bytes.get(), _bytes, _byteCnt);
         byteCnt = _byteCnt;
     }
@@ -340,6 +340,9 @@ AUTO_SET(InfillDensity, float, 20.0f)
 AUTO_SET(LayerHeight, float, 0.2f)
 AUTO_SET(SkirtLineCount, int, 3)
 AUTO_SET(SkirtDistance, float, 5.0f)
+AUTO_SET(RaftLayerCount, int, 0)
+AUTO_SET(RaftMargin, float, 3.0f)
+AUTO_SET(RaftDensity, float, 30.0f)
 AUTO_SET(PrintSpeed, float, 60.0f)
 AUTO_SET(InfillSpeed, float, 100.0f)
 AUTO_SET(TopBottomSpeed, float, 15.0f)
@@ -351,6 +354,22 @@ AUTO_SET(ShellThickness, float, 1.5f)
 AUTO_SET(TopBottomThickness, float, 1.2f)
 AUTO_SET(PrintTemperature, int, 200)
 AUTO_SET(InfillCombinationCount, int, 1)
+AUTO_SET(ArcTolerance, float, 0.025f)
+AUTO_SET(SimplifyDeviation, float, 0.025f)
+AUTO_SET(SimplifyMinLength, float, 0.075f)
+AUTO_SET(InfillPattern, int, 0)
+AUTO_SET(TravelOptimizeTime, float, 10.0f)
+AUTO_SET(TravelOptimizeMoves, int, 500)
+AUTO_SET(SeamPlacement, int, 0)
+AUTO_SET(Combing, int, 1)
+AUTO_SET(AdaptiveLayers, int, 0)
+AUTO_SET(MinLayerHeight, float, 0.1f)
+AUTO_SET(MaxLayerHeight, float, 0.3f)
+AUTO_SET(Support, int, 0)
+AUTO_SET(SupportAngle, float, 60.0f)
+AUTO_SET(SupportDistance, float, 0.7f)
+AUTO_SET(SupportDensity, float, 10.0f)
+AUTO_SET(ToolpathMemoryBudget, float, 0.0f)
 #undef AUTO_SET
 
 // Explicitly specialize the GS classes
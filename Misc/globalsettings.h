@@ -62,6 +62,9 @@ public:
     static GlobalSetting<float> LayerHeight;
     static GlobalSetting<int> SkirtLineCount;
     static GlobalSetting<float> SkirtDistance;
+    static GlobalSetting<int> RaftLayerCount;
+    static GlobalSetting<float> RaftMargin;
+    static GlobalSetting<float> RaftDensity;
     static GlobalSetting<float> PrintSpeed;
     static GlobalSetting<float> InfillSpeed;
     static GlobalSetting<float> TopBottomSpeed;
@@ -73,6 +76,22 @@ public:
     static GlobalSetting<float> TopBottomThickness;
     static GlobalSetting<int> PrintTemperature;
     static GlobalSetting<int> InfillCombinationCount;
+    static GlobalSetting<float> ArcTolerance;
+    static GlobalSetting<float> SimplifyDeviation;
+    static GlobalSetting<float> SimplifyMinLength;
+    static GlobalSetting<int> InfillPattern;
+    static GlobalSetting<float> TravelOptimizeTime;
+    static GlobalSetting<int> TravelOptimizeMoves;
+    static GlobalSetting<int> SeamPlacement;
+    static GlobalSetting<int> Combing;
+    static GlobalSetting<int> AdaptiveLayers;
+    static GlobalSetting<float> MinLayerHeight;
+    static GlobalSetting<float> MaxLayerHeight;
+    static GlobalSetting<int> Support;
+    static GlobalSetting<float> SupportAngle;
+    static GlobalSetting<float> SupportDistance;
+    static GlobalSetting<float> SupportDensity;
+    static GlobalSetting<float> ToolpathMemoryBudget;
 };
 
 #endif // GLOBALSETTINGS_H
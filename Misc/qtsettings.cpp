@@ -35,9 +35,23 @@ AUTO_WRAPPER(bedWidth)
 AUTO_WRAPPER(bedHeight)
 AUTO_WRAPPER(bedLength)
 AUTO_WRAPPER(infillDensity)
+AUTO_WRAPPER(infillPattern)
+AUTO_WRAPPER(seamPlacement)
+AUTO_WRAPPER(travelOptimizeTime)
+AUTO_WRAPPER(travelOptimizeMoves)
 AUTO_WRAPPER(layerHeight)
+AUTO_WRAPPER(adaptiveLayers)
+AUTO_WRAPPER(minLayerHeight)
+AUTO_WRAPPER(maxLayerHeight)
+AUTO_WRAPPER(support)
+AUTO_WRAPPER(supportAngle)
+AUTO_WRAPPER(supportDistance)
+AUTO_WRAPPER(supportDensity)
 AUTO_WRAPPER(skirtLineCount)
 AUTO_WRAPPER(skirtDistance)
+AUTO_WRAPPER(raftLayerCount)
+AUTO_WRAPPER(raftMargin)
+AUTO_WRAPPER(raftDensity)
 AUTO_WRAPPER(printSpeed)
 AUTO_WRAPPER(infillSpeed)
 AUTO_WRAPPER(topBottomSpeed)
@@ -48,6 +62,7 @@ AUTO_WRAPPER(retractionDistance)
 AUTO_WRAPPER(shellThickness)
 AUTO_WRAPPER(topBottomThickness)
 AUTO_WRAPPER(printTemperature)
+AUTO_WRAPPER(toolpathMemoryBudget)
 #undef AUTO_WRAPPER
 
 QtSettings::QtSettings(QObject *parent) : QObject(parent)
@@ -60,9 +75,23 @@ QtSettings::QtSettings(QObject *parent) : QObject(parent)
     AUTO_CONNECT(float, bedHeight, BedHeight)
     AUTO_CONNECT(float, bedLength, BedLength)
     AUTO_CONNECT(float, infillDensity, InfillDensity)
+    AUTO_CONNECT(int, infillPattern, InfillPattern)
+    AUTO_CONNECT(int, seamPlacement, SeamPlacement)
+    AUTO_CONNECT(float, travelOptimizeTime, TravelOptimizeTime)
+    AUTO_CONNECT(int, travelOptimizeMoves, TravelOptimizeMoves)
     AUTO_CONNECT(float, layerHeight, LayerHeight)
+    AUTO_CONNECT(int, adaptiveLayers, AdaptiveLayers)
+    AUTO_CONNECT(float, minLayerHeight, MinLayerHeight)
+    AUTO_CONNECT(float, maxLayerHeight, MaxLayerHeight)
+    AUTO_CONNECT(int, support, Support)
+    AUTO_CONNECT(float, supportAngle, SupportAngle)
+    AUTO_CONNECT(float, supportDistance, SupportDistance)
+    AUTO_CONNECT(float, supportDensity, SupportDensity)
     AUTO_CONNECT(int, skirtLineCount, SkirtLineCount)
     AUTO_CONNECT(float, skirtDistance, SkirtDistance)
+    AUTO_CONNECT(int, raftLayerCount, RaftLayerCount)
+    AUTO_CONNECT(float, raftMargin, RaftMargin)
+    AUTO_CONNECT(float, raftDensity, RaftDensity)
     AUTO_CONNECT(float, printSpeed, PrintSpeed)
     AUTO_CONNECT(float, infillSpeed, InfillSpeed)
     AUTO_CONNECT(float, topBottomSpeed, TopBottomSpeed)
@@ -74,5 +103,6 @@ QtSettings::QtSettings(QObject *parent) : QObject(parent)
     AUTO_CONNECT(float, shellThickness, ShellThickness)
     AUTO_CONNECT(float, topBottomThickness, TopBottomThickness)
     AUTO_CONNECT(int, printTemperature, PrintTemperature)
+    AUTO_CONNECT(float, toolpathMemoryBudget, ToolpathMemoryBudget)
 #undef AUTO_CONNECT
 }
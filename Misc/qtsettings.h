@@ -21,9 +21,23 @@ public:
     AUTO_SETTING_PROPERTY(float, bedHeight, BedHeight)
     AUTO_SETTING_PROPERTY(float, bedLength, BedLength)
     AUTO_SETTING_PROPERTY(float, infillDensity, InfillDensity)
+    AUTO_SETTING_PROPERTY(int, infillPattern, InfillPattern)
+    AUTO_SETTING_PROPERTY(int, seamPlacement, SeamPlacement)
+    AUTO_SETTING_PROPERTY(float, travelOptimizeTime, TravelOptimizeTime)
+    AUTO_SETTING_PROPERTY(int, travelOptimizeMoves, TravelOptimizeMoves)
     AUTO_SETTING_PROPERTY(float, layerHeight, LayerHeight)
+    AUTO_SETTING_PROPERTY(int, adaptiveLayers, AdaptiveLayers)
+    AUTO_SETTING_PROPERTY(float, minLayerHeight, MinLayerHeight)
+    AUTO_SETTING_PROPERTY(float, maxLayerHeight, MaxLayerHeight)
+    AUTO_SETTING_PROPERTY(int, support, Support)
+    AUTO_SETTING_PROPERTY(float, supportAngle, SupportAngle)
+    AUTO_SETTING_PROPERTY(float, supportDistance, SupportDistance)
+    AUTO_SETTING_PROPERTY(float, supportDensity, SupportDensity)
     AUTO_SETTING_PROPERTY(int, skirtLineCount, SkirtLineCount)
     AUTO_SETTING_PROPERTY(float, skirtDistance, SkirtDistance)
+    AUTO_SETTING_PROPERTY(int, raftLayerCount, RaftLayerCount)
+    AUTO_SETTING_PROPERTY(float, raftMargin, RaftMargin)
+    AUTO_SETTING_PROPERTY(float, raftDensity, RaftDensity)
     AUTO_SETTING_PROPERTY(float, printSpeed, PrintSpeed)
     AUTO_SETTING_PROPERTY(float, infillSpeed, InfillSpeed)
     AUTO_SETTING_PROPERTY(float, topBottomSpeed, TopBottomSpeed)
@@ -34,6 +48,7 @@ public:
     AUTO_SETTING_PROPERTY(float, shellThickness, ShellThickness)
     AUTO_SETTING_PROPERTY(float, topBottomThickness, TopBottomThickness)
     AUTO_SETTING_PROPERTY(int, printTemperature, PrintTemperature)
+    AUTO_SETTING_PROPERTY(float, toolpathMemoryBudget, ToolpathMemoryBudget)
 #undef AUTO_SETTING_PROPERTY
 };
 
@@ -226,7 +226,7 @@ static void PrintFile(std::string path)
 
                 // Update the progress indicators
                 ToolpathRendering::ShowPrintedToLine(lineNum);
-                m_timeLeft -= ComboRendering::getToolpath()->lineInfos[lineNum - 1].milliSecs;
+                m_timeLeft -= ComboRendering::getToolpath()->LineMillis(lineNum - 1);
                 emit GlobalPrinter.etaChanged();
                 emit GlobalPrinter.percentDoneChanged();
                 GlobalPrinter.UpdateProgressStatus();
@@ -8,7 +8,8 @@
 #include <glm/gtx/intersect.hpp>
 #include <algorithm>
 #include <fstream>
-#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "stlimporting.h"
 #include "stlexporting.h"
@@ -19,6 +20,12 @@
 // TODO: make relative to bed size
 static const float DefaultZoom = 3.0f;
 
+// The view is changed by the gestures on the GUI thread and drawn on the render thread. The gestures
+// change the state below while holding the view mutex, and at the start of every frame the render
+// thread takes a snapshot of it that it draws with. All the gestures since the last frame thus end up
+// in one update, and the renderers never see a half changed view.
+static std::mutex viewMutex;
+
 static float viewWidth = 0.0f;
 static float viewHeight = 0.0f;
 
@@ -36,10 +43,31 @@ static glm::mat4 rotOrg = glm::mat4();
 static glm::mat4 rotOrgInv = glm::mat4();
 static glm::quat sceneRot = glm::quat();
 
+// What has changed since the last snapshot
+static bool dirtyViewTrans = true;
+static bool dirtyViewProj = true;
+
+struct ViewSnapshot
+{
+    glm::mat4 trans;
+    glm::mat4 proj;
+    float zoom = DefaultZoom;
+    float width = 0.0f;
+    float height = 0.0f;
+};
+
+// Only used by the render thread
+static ViewSnapshot drawnView;
+
+// Set while an update has been requested for a view change that has not been drawn yet
+static std::atomic<bool> viewUpdatePending(false);
+
 static std::set<Mesh*> stlMeshes;
 static std::set<Mesh*> selectedMeshes;
 
-static Toolpath *gcodePath = nullptr;
+// The loaded toolpath is shared with the toolpath renderer, which may still be drawing the previous one
+static std::mutex toolpathMutex;
+static std::shared_ptr<const Toolpath> gcodePath;
 
 static bool curMeshesSaved = false;
 static std::string curMeshesPath = "";
@@ -76,10 +104,7 @@ static void UpdateProjection()
     sceneProj = glm::ortho(left, right, bottom, top, -GlobalSettings::BedHeight.Get() * 10,
                            GlobalSettings::BedHeight.Get() * 10);
 
-    // Flag the renderers to update their proj matrices
-    GridRendering::ProjMatDirty();
-    STLRendering::ProjMatDirty();
-    ToolpathRendering::ProjMatDirty();
+    dirtyViewProj = true;
 }
 
 static void RecalculateView()
@@ -98,6 +123,44 @@ static void RecalculateView()
     sceneRot *= glm::angleAxis(glm::radians(45.0f), glm::vec3(xDir.x, xDir.y, 0.0f));
     sceneTrans *= glm::mat4_cast(sceneRot);
     sceneTrans *= rotOrgInv;
+    dirtyViewTrans = true;
+}
+
+static void RequestViewUpdate()
+{
+    // Gestures that come in before the next frame do not need updates of their own
+    if (!viewUpdatePending.exchange(true))
+        ComboRendering::Update();
+}
+
+// Take the view to draw this frame with and flag the renderers that use what has changed
+static void TakeViewSnapshot()
+{
+    std::lock_guard<std::mutex> lock(viewMutex);
+    viewUpdatePending = false;
+
+    if (dirtyViewProj)
+    {
+        drawnView.proj = sceneProj;
+        drawnView.zoom = zoom;
+        drawnView.width = viewWidth;
+        drawnView.height = viewHeight;
+
+        GridRendering::ProjMatDirty();
+        STLRendering::ProjMatDirty();
+        ToolpathRendering::ProjMatDirty();
+        dirtyViewProj = false;
+    }
+
+    if (dirtyViewTrans)
+    {
+        drawnView.trans = sceneTrans;
+
+        GridRendering::SceneMatDirty();
+        STLRendering::SceneMatDirty();
+        ToolpathRendering::SceneMatDirty();
+        dirtyViewTrans = false;
+    }
 }
 
 static void removeCharsFromString(std::string &str, const char* charsToRemove ) {
@@ -129,10 +192,9 @@ void ComboRendering::FreeMemory()
         }
     }
 
-    if (gcodePath != nullptr)
     {
-        delete gcodePath;
-        gcodePath = nullptr;
+        std::lock_guard<std::mutex> lock(toolpathMutex);
+        gcodePath.reset();
     }
 
     ToolpathRendering::FreeMemory();
@@ -158,11 +220,14 @@ void ComboRendering::LoadMesh(std::string path)
 
 void ComboRendering::LoadToolpath(std::string path)
 {
-    if (gcodePath != nullptr)
-        delete gcodePath;
+    // The previous toolpath is not deleted here, the renderer releases it once the new one has replaced it
+    std::shared_ptr<const Toolpath> toolpath(GCodeImporting::ImportGCode(path.c_str()));
+    ToolpathRendering::SetToolpath(toolpath);
 
-    gcodePath = GCodeImporting::ImportGCode(path.c_str());
-    ToolpathRendering::SetToolpath(gcodePath);
+    {
+        std::lock_guard<std::mutex> lock(toolpathMutex);
+        gcodePath = std::move(toolpath);
+    }
 
     // Call OpenGL upate
     Update();
@@ -234,6 +299,8 @@ void ComboRendering::RemoveMesh(Mesh *mesh)
 
 void ComboRendering::SetViewSize(float width, float height)
 {
+    std::lock_guard<std::mutex> lock(viewMutex);
+
     // Update the viewport variables
     viewWidth = width;
     viewHeight = height;
@@ -243,27 +310,30 @@ void ComboRendering::SetViewSize(float width, float height)
     RecalculateView();
 }
 
+// The gestures only do a little matrix math, so they are applied straight away on the calling thread
+
 void ComboRendering::ApplyRot(float x, float y)
 {
-    // Apply the transformation asynchronously because it can take some time
-    // TODO: tell the user that we are busy
-    std::thread([=]() {
-        // We need to transform the rotation axis into screen space by applying the inverse of the rotation
-        // currently being applied to our scene
-
-        // We also need to scale the roation to the screen size and aspect ratio
-        // TODO: add dpi scaling
-        // For some reason the x rot is in the inverse direction of the mouse movement
-        // TODO: 3.0 ?
-        float yAng = (x / GlobalSettings::BedWidth.Get() * 1.1) / 3.0;
-        float xAng = -(y / GlobalSettings::BedLength.Get() *
-                       (1.1 * GlobalSettings::BedLength.Get() / GlobalSettings::BedWidth.Get())) / 3.0;
-        glm::vec2 axis = glm::vec2(xAng, yAng);
-        auto l = glm::length(axis); // doesnt work
-        if (l == 0) // This is important to avoid normaliztion disasters ahead
-            return;
-
-        axis = glm::normalize(axis);
+    // We need to transform the rotation axis into screen space by applying the inverse of the rotation
+    // currently being applied to our scene
+
+    // We also need to scale the roation to the screen size and aspect ratio
+    // TODO: add dpi scaling
+    // For some reason the x rot is in the inverse direction of the mouse movement
+    // TODO: 3.0 ?
+    float yAng = (x / GlobalSettings::BedWidth.Get() * 1.1) / 3.0;
+    float xAng = -(y / GlobalSettings::BedLength.Get() *
+                   (1.1 * GlobalSettings::BedLength.Get() / GlobalSettings::BedWidth.Get())) / 3.0;
+    glm::vec2 axis = glm::vec2(xAng, yAng);
+    auto l = glm::length(axis); // doesnt work
+    if (l == 0) // This is important to avoid normaliztion disasters ahead
+        return;
+
+    axis = glm::normalize(axis);
+
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+
         glm::vec4 dir = glm::vec4(axis.x, axis.y, 0.0f, 0.0f);
         glm::quat inv = sceneRot;
         inv.w *= -1;
@@ -275,22 +345,18 @@ void ComboRendering::ApplyRot(float x, float y)
         sceneRot *= glm::angleAxis(l, glm::vec3(dir.x, dir.y, dir.z));
         sceneTrans *= glm::mat4_cast(sceneRot);
         sceneTrans *= rotOrgInv;
+        dirtyViewTrans = true;
+    }
 
-        // Flag the renderers to update their scene matrices
-        GridRendering::SceneMatDirty();
-        STLRendering::SceneMatDirty();
-        ToolpathRendering::SceneMatDirty();
-
-        // Call OpenGL upate
-        Update();
-    }).detach();
+    // Call OpenGL upate
+    RequestViewUpdate();
 }
 
 void ComboRendering::Move(float x, float y)
 {
-    // Apply the transformation asynchronously because it can take some time
-    // TODO: tell the user that we are busy
-    std::thread([=]() {
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+
         // The direction of mouse movement is inverse of the view movement
         // We need to scale the move distance to the size of the viewport
         // We want a constant move distance for a viewport length and take
@@ -301,47 +367,38 @@ void ComboRendering::Move(float x, float y)
                  * (65 * GlobalSettings::BedLength.Get() / GlobalSettings::BedWidth.Get())) / zoom;
 
         UpdateProjection();
+    }
 
-        // Call OpenGL upate
-        Update();
-    }).detach();
+    // Call OpenGL upate
+    RequestViewUpdate();
 }
 
 void ComboRendering::Zoom(float scale)
 {
-    // Apply the transformation asynchronously because it can take some time
-    // TODO: tell the user that we are busy
-    std::thread([=]() {
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
         zoom *= scale;
         UpdateProjection();
+    }
 
-        // Call OpenGL upate
-        Update();
-    }).detach();
+    // Call OpenGL upate
+    RequestViewUpdate();
 }
 
 void ComboRendering::ResetView(bool updateNow)
 {
-    // Apply the transformation asynchronously because it can take some time
-    // TODO: tell the user that we are busy
-    std::thread([=]() {
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
         zoom = DefaultZoom;
 
         aimX = (GlobalSettings::BedWidth.Get() / 2.0f);
         aimY = (GlobalSettings::BedLength.Get() / 2.0f);
         RecalculateView();
+    }
 
-        GridRendering::SceneMatDirty();
-        STLRendering::SceneMatDirty();
-        ToolpathRendering::SceneMatDirty();
-
-        // Call OpenGL upate
-        if (updateNow)
-            Update();
-
-        // Call OpenGL upate
-        Update();
-    }).detach();
+    // Call OpenGL upate
+    if (updateNow)
+        RequestViewUpdate();
 }
 
 void ComboRendering::Init()
@@ -366,7 +423,9 @@ void ComboRendering::Init()
 
 void ComboRendering::Draw()
 {
-    glViewport(0, 0, viewWidth, viewHeight);
+    TakeViewSnapshot();
+
+    glViewport(0, 0, drawnView.width, drawnView.height);
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -384,13 +443,22 @@ void ComboRendering::TestMouseIntersection(float x, float y)
 {
     // TODO: this should only run if the STLs are visible
 
+    // Test against the latest view
+    glm::mat4 MV;
+    float width, height;
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        MV = sceneProj * sceneTrans;
+        width = viewWidth;
+        height = viewHeight;
+    }
+
     // Normalized screen coordinates
-    float screenX = (2.0f * x) / viewWidth - 1.0f;
-    float screenY = (2.0 * y) / viewHeight - 1.0f;
+    float screenX = (2.0f * x) / width - 1.0f;
+    float screenY = (2.0 * y) / height - 1.0f;
 
     // Calculate the farthest and closest points from a line caused by the cursor
     // TODO: cache some of this shit
-    glm::mat4 MV = sceneProj * sceneTrans;
     glm::mat4 invMat = glm::inverse(MV);
     glm::vec4 clipCoords = glm::vec4(screenX, screenY, -1.0f, 1.0f);
     glm::vec4 worldCoords = invMat * clipCoords;
@@ -445,15 +513,21 @@ const std::set<Mesh*> &ComboRendering::getSelectedMeshes()
 
 const glm::mat4 &ComboRendering::getSceneTrans()
 {
-    return sceneTrans;
+    return drawnView.trans;
 }
 
 const glm::mat4 &ComboRendering::getSceneProj()
 {
-    return sceneProj;
+    return drawnView.proj;
+}
+
+float ComboRendering::getZoom()
+{
+    return drawnView.zoom;
 }
 
-const Toolpath *ComboRendering::getToolpath()
+std::shared_ptr<const Toolpath> ComboRendering::getToolpath()
 {
+    std::lock_guard<std::mutex> lock(toolpathMutex);
     return gcodePath;
 }
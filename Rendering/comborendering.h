@@ -7,6 +7,7 @@
 #include <set>
 #include <future>
 #include <string>
+#include <memory>
 
 #include "stlrendering.h"
 #include "toolpathrendering.h"
@@ -37,10 +38,11 @@ namespace ComboRendering
     void TestMouseIntersection(float x, float y);
 
     const std::set<Mesh*> &getSelectedMeshes();
-    const Toolpath* getToolpath();
+    std::shared_ptr<const Toolpath> getToolpath();
 
     const glm::mat4 &getSceneTrans();
     const glm::mat4 &getSceneProj();
+    float getZoom(); // Pixels per millimetre
     int getMeshCount();
 }
 
@@ -367,6 +367,11 @@ QString FBORenderer::printToolpath()
     return "started";
 }
 
+void FBORenderer::showLayerRange(int first, int last)
+{
+    ToolpathRendering::ShowLayerRange(first, last);
+}
+
 void FBORenderer::ReadSlicerOutput()
 {
     /*QStringList sl = QString(sliceProcess->readAllStandardError()).split("\n");
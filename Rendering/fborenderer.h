@@ -38,6 +38,7 @@ public:
     Q_INVOKABLE QString saveMeshes();
     Q_INVOKABLE QString sliceMeshes();
     Q_INVOKABLE QString printToolpath();
+    Q_INVOKABLE void showLayerRange(int first, int last);
 
     Q_PROPERTY(float meshOpacity READ meshOpacity WRITE setMeshOpacity NOTIFY meshOpacityChanged)
     bool meshOpacity() { return STLRendering::GetBaseOpacity(); }
@@ -72,6 +73,9 @@ public:
     Q_PROPERTY(bool toolPathLoaded READ toolPathLoaded NOTIFY toolPathLoadedChanged)
     bool toolPathLoaded() { return ToolpathRendering::ToolpathLoaded(); }
 
+    Q_PROPERTY(int tpLayerCount READ tpLayerCount NOTIFY toolPathLoadedChanged)
+    int tpLayerCount() { return ToolpathRendering::LayerCount(); }
+
     Q_PROPERTY(QString saveName READ saveName WRITE setSaveName NOTIFY saveNameChanged)
     QString saveName() { return m_saveName; }
     void setSaveName(QString sav);
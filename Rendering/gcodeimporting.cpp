@@ -1,327 +1,556 @@
 #include "gcodeimporting.h"
 
-#include <fstream>
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "structures.h"
 
 #include <QDebug>
 
-inline void ShrinkIsle(Island *isle)
-{
-    if (isle != nullptr)
-    {
-        if (isle->movePoints.size() > 0)
-            isle->movePoints.shrink_to_fit();
+// The longest piece of an arc that is drawn as a straight line
+static const float ArcPieceLength = 0.5f;
 
-        if (isle->printPoints.size() > 0)
-            isle->printPoints.shrink_to_fit();
-    }
+// Calculates the angles and amount of straight pieces needed to draw an arc
+// from the start to the end point around the centre
+static int ArcPieces(float startX, float startY, float endX, float endY, float cX, float cY,
+                     bool clockwise, float &radius, float &startAng, float &sweep)
+{
+    radius = std::sqrt(std::pow(startX - cX, 2) + std::pow(startY - cY, 2));
+    startAng = std::atan2(startY - cY, startX - cX);
+    float endAng = std::atan2(endY - cY, endX - cX);
+
+    // The sweep is negative for clockwise arcs, the same start and end point is a full circle
+    sweep = endAng - startAng;
+    if (clockwise && sweep >= 0)
+        sweep -= 2 * M_PI;
+    else if (!clockwise && sweep <= 0)
+        sweep += 2 * M_PI;
+
+    return std::max(1, (int)std::ceil(std::abs(sweep) * radius / ArcPieceLength));
 }
 
-Toolpath* GCodeImporting::ImportGCode(const char *path)
+// The parameters of a line that are used for the preview
+enum Word
 {
-    std::ifstream is(path);
+    WordX = 0,
+    WordY,
+    WordZ,
+    WordE,
+    WordF,
+    WordI,
+    WordJ,
+    WordCount
+};
+
+static const char WordLetters[WordCount] = { 'X', 'Y', 'Z', 'E', 'F', 'I', 'J' };
+
+struct GCodeLine
+{
+    int type = -1;
+    uint8_t present = 0; // A bit for every word on the line
+    float values[WordCount];
 
-    Toolpath *tp = new Toolpath();
+    bool Has(Word word) const { return (present & (1 << word)) != 0; }
+};
 
-    // Check for a valid file
-    if (is)
+static const double PowersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+// Read a decimal number directly from the file, which is not null terminated
+// Dividing the digits as an integer by a power of ten gives the same value as atof for G-code numbers
+static const char *ParseNumber(const char *pos, const char *end, float &value)
+{
+    bool negative = false;
+    if (pos < end && (*pos == '-' || *pos == '+'))
+        negative = (*pos++ == '-');
+
+    uint64_t digits = 0;
+    int digitCount = 0;
+    int decimals = 0;
+    bool fraction = false;
+    for (; pos < end; pos++)
     {
-        // Store the previous values for G0 and G1
-        float prevX = -1;
-        float prevY = -1;
-        float prevZ = -1;
-        float prevF[2] = {-1, -1};
-        float prevE = 0;
-        bool prevValid = false;
-
-        Layer *curLayer = nullptr;
-        Island *curIsle = nullptr;
-        Point3 lastPoint;
-        Point2 lastPoint2;
-
-        int8_t g = -1;
-        bool rel = false;
-
-        // Keep track if the last action was a move or
-        // an extrusion
-        bool lastWasMove = true;
-
-        // TODO: add support for set pos command
-
-        // Read through each line
-        std::string line;
-        LineInfo *curLineInfo = nullptr;
-        int64_t lineNum = -1;
-        while (std::getline(is, line))
+        if (*pos >= '0' && *pos <= '9')
         {
-            lineNum++;
-            tp->lineInfos.emplace_back();
-            curLineInfo = &(tp->lineInfos.back());
+            // Digits beyond what fits are insignificant
+            if (digitCount < 18)
+            {
+                digits = digits * 10 + (*pos - '0');
+                digitCount++;
+                if (fraction)
+                    decimals++;
+            }
+            else if (!fraction && decimals > -18)
+                decimals--;
+        }
+        else if (*pos == '.' && !fraction)
+            fraction = true;
+        else
+            break;
+    }
 
-            bool extruded = false;
-            bool setPos = false;
-            int type = -1;
+    double result = (decimals >= 0) ? digits / PowersOfTen[decimals] : digits * PowersOfTen[-decimals];
+    value = negative ? -result : result;
+    return pos;
+}
 
-            // Remove all comments from the line
-            line = line.substr(0, line.find(';') - 1);
+// Split a line into its command and parameters without copying it, returns false if it is not a G command
+static bool ParseLine(const char *pos, const char *end, GCodeLine &line)
+{
+    if (pos == end || *pos != 'G')
+        return false;
 
-            //qDebug() << QString(line.c_str());
+    float type;
+    pos = ParseNumber(pos + 1, end, type);
+    line.type = (int)type;
+    line.present = 0;
 
-            // Confirm the line starts wit g and get the code
-            if (line[0] != 'G')
-                continue;
-            else
+    while (pos < end && *pos != ';')
+    {
+        char c = *pos++;
+
+        for (uint8_t word = 0; word < WordCount; word++)
+        {
+            if (c == WordLetters[word])
             {
-                auto pos = line.find(' ');
-                std::string code = line.substr(1, pos - 1);
-                type = std::stoi(code);
-
-                if (type == 0 || type == 1)
-                    g = type;
-                else if (type == SetPos)
-                    setPos = true;
-                else
-                {
-                    if (type == SetRel)
-                        rel = true;
-                    else if (type == SetAbs)
-                        rel = false;
-                    else if (type == Home)
-                    {
-                        prevX = 0;
-                        prevY = 0;
-                        prevZ = 0;
-                    }
-
-                    continue;
-                }
+                pos = ParseNumber(pos, end, line.values[word]);
+                line.present |= 1 << word;
+                break;
             }
+        }
+    }
+
+    return true;
+}
+
+static inline const char *LineEnd(const char *pos, const char *end)
+{
+    const char *newLine = (const char*)std::memchr(pos, '\n', end - pos);
+    return (newLine == nullptr) ? end : newLine;
+}
+
+// The state that G-code commands depend on and that is kept from one line to the next
+// A chunk of the file is first gone through without knowing the state it starts with, then axes that
+// were only moved relatively hold the distance from the start and the feedrates may not be set yet
+struct ModalState
+{
+    bool relative = false;
+    double axes[4] = { -1, -1, -1, 0 }; // X, Y, Z and E, in double so relative moves add up the same wherever the file is split
+    bool fromStart[4] = { false, false, false, false };
+    float feedRates[2] = { -1, -1 };
+    bool feedSet[2] = { true, true };
+
+    static ModalState Unknown(bool relative)
+    {
+        ModalState state;
+        state.relative = relative;
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            state.axes[i] = 0;
+            state.fromStart[i] = true;
+        }
+        state.feedSet[0] = state.feedSet[1] = false;
+        return state;
+    }
+
+    // The state after a chunk that started with this state, given what the chunk did to an unknown state
+    ModalState Then(const ModalState &chunk) const
+    {
+        ModalState state = chunk;
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            if (chunk.fromStart[i])
+                state.axes[i] += axes[i];
+            state.fromStart[i] = fromStart[i] && chunk.fromStart[i];
+        }
 
-            bool moved = false; // Flag if movement occured
-
-            // Create a point at the last position
-            lastPoint = { prevX, prevY, prevZ };
-            lastPoint2 = { prevX, prevY, -1 }; // The zero is the irrelevant line number
-
-            // Read the parts as spilt by spaces
-            // TODO: add support or at least warnings for irregularly long whitespaces
-            // Working correctly with the c_str  directly in strtok
-            // breaks the std::string a bit and complicates debugging
-//#define PRESERVE_LINE_STR
-#ifdef PRESERVE_LINE_STR
-            auto temp = line.c_str();
-            auto len = strlen(temp);
-            char *lineCpy = new char[len];
-            memcpy(lineCpy, temp, sizeof(char) * len);
-            char *pch = std::strtok(lineCpy, " ");
-#else
-            char *pch = std::strtok((char*)line.c_str(), " ");
-#endif
-
-            while (pch != NULL)
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            if (!chunk.feedSet[i])
             {
-                std::string part(pch);
-                char c = part[0];
-                auto numLen = strlen(pch); // Keep the null termination (-1 + 1)
-                char numS[numLen]; // Buffer for number
-                memcpy(numS, &pch[1], numLen);
-                float num = std::atof(numS);
-
-                pch = std::strtok(NULL, "     "); // Get the next part so long
-
-                switch(c) {
-                    case 'X' :
-                    {
-                        if (setPos)
-                        {
-                            prevX = num;
-                            moved = true;
-                            break;
-                        }
-
-                        float old = prevX;
-
-                        if (rel)
-                            prevX += num;
-                        else
-                            prevX = num;
-
-                        if (!moved && (prevX != old))
-                        {
-                            moved = true;
-                        }
-                        break;
-                    }
-                    case 'Y' :
-                    {
-                        if (setPos)
-                        {
-                            prevY = num;
-                            moved = true;
-                            break;
-                        }
-
-                        float old = prevY;
-
-                        if (rel)
-                            prevY += num;
-                        else
-                            prevY = num;
-
-                        if (!moved && (prevY != old))
-                        {
-                            moved = true;
-                        }
-                        break;
-                    }
-                    case 'Z' :
-                    {
-                        if (setPos)
-                        {
-                            prevZ = num;
-                            moved = true;
-                            break;
-                        }
-
-                        float nZ = (rel) ? (prevZ + num) : num;
-
-                        if (nZ != prevZ)
-                        {
-                            // Create a new layer when moving to a new z
-                            // and optimize the old one
-                            //if (curLayer != nullptr && curLayer->islands.size() > 0)
-                              //  curLayer->islands.shrink_to_fit();
-
-                            tp->layers.emplace_back();
-                            curLayer = &(tp->layers.back());
-                            curLayer->z = num;
-
-                            ShrinkIsle(curIsle);
-
-                            curLayer->islands.emplace_back();
-                            lastWasMove = true;
-                            curIsle = &(curLayer->islands.back());
-                            // Move to the island
-                            curIsle->movePoints.push_back(lastPoint);
-
-                            moved = true;
-                        }
-
-                        prevZ = num;
-                        break;
-                    }
-                    case 'F' :
-                    {
-                        // G92 doesn't have an F parameter
-                        //if (rel) // don't think this exists
-                          //  prevF[g] += num;
-                        //else
-                            prevF[g] = num;
-                        break;
-                    }
-                    case 'E' :
-                    {
-                        if (setPos)
-                        {
-                            prevE = num;
-                            moved = true;
-                            break;
-                        }
-
-                        float nE = (rel) ? (prevE + num) : num;
-
-                        // TODO: detect retractions
-                        if (prevE != nE)
-                            extruded = true;
-                        break;
-                    }
-                }
+                state.feedRates[i] = feedRates[i];
+                state.feedSet[i] = feedSet[i];
             }
-#ifdef PRESERVE_LINE_STR
-            delete[] lineCpy;
-#endif
+        }
 
-            // If no parameters were given for G92 then everything becomes 0
-            if (setPos)
-            {
-                if (!moved)
-                {
-                    prevX = 0.0f;
-                    prevY = 0.0f;
-                    prevZ = 0.0f;
-                    prevE = 0.0f;
-                }
+        return state;
+    }
+};
 
-                continue;
-            }
+// What applying a line to the state did
+struct LineEffect
+{
+    bool moved = false;
+    bool newZ = false;
+    bool extruded = false;
+    bool arc = false;
+};
+
+// Update the state with a line, returns false for commands that do not move
+static bool ApplyLine(ModalState &state, const GCodeLine &line, int8_t &g, LineEffect &effect)
+{
+    effect = LineEffect();
 
-            // Skip the line if there was no movement
-            if (!moved)
+    switch (line.type)
+    {
+    case RapidMove:
+    case Move:
+        g = line.type;
+        break;
+    case ArcCW:
+    case ArcCCW:
+        // Arcs share the feedrate of normal moves
+        g = 1;
+        effect.arc = true;
+        break;
+    case SetPos:
+        // If no parameters were given for G92 then everything becomes 0
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            if (line.Has((Word)i) || (line.present & 0xF) == 0)
             {
-                continue;
+                state.axes[i] = line.Has((Word)i) ? line.values[i] : 0;
+                state.fromStart[i] = false;
             }
+        }
+        return false;
+    case SetRel:
+        state.relative = true;
+        return false;
+    case SetAbs:
+        state.relative = false;
+        return false;
+    case Home:
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            state.axes[i] = 0;
+            state.fromStart[i] = false;
+        }
+        return false;
+    default:
+        return false;
+    }
 
-            // Wait until we have current values to work from
-            if (!prevValid)
-            {
-                prevValid = (prevX != -1) && (prevY != -1) && (prevZ != -1);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (!line.Has((Word)i))
+            continue;
 
-                if (!prevValid)
-                    continue;
-            }
+        double old = state.axes[i];
+        if (state.relative)
+            state.axes[i] += line.values[i];
+        else
+        {
+            state.axes[i] = line.values[i];
+            state.fromStart[i] = false;
+        }
 
-            // TODO: points get lost when not on layers
-            if (curLayer == nullptr)
-                continue;
+        if (i == WordE)
+            effect.extruded = state.axes[i] > old;
+        else if (state.axes[i] != old)
+        {
+            effect.moved = true;
+            effect.newZ = effect.newZ || (i == WordZ);
+        }
+    }
 
-            // Roughly estimate the time for the line
-            double dist = std::sqrt(std::pow(prevX - lastPoint.x, 2) + std::pow(prevY - lastPoint.y, 2));
-            curLineInfo->milliSecs = dist * 60000 / prevF[g]; // Feedrate per minute...
-            tp->totalMillis += curLineInfo->milliSecs;
+    if (line.Has(WordF))
+    {
+        state.feedRates[g] = line.values[WordF];
+        state.feedSet[g] = true;
+    }
 
-            if (extruded)
-            {
-                // Add the first point after moves
-                if (lastWasMove)
-                    curIsle->printPoints.push_back(lastPoint2);
+    return true;
+}
 
-                curIsle->printPoints.push_back({prevX, prevY, lineNum});
-                curLineInfo->isExtruded = true;
+// A piece of the file that is parsed on its own, every piece but the first starts with a line that moves to a new z
+struct GCodeChunk
+{
+    const char *begin;
+    const char *end;
 
-                lastWasMove = false;
-            }
-            else
-            {
-                if (!lastWasMove)
-                {
-                    ShrinkIsle(curIsle);
+    std::size_t lineCount = 0;
+    ModalState summaries[2]; // What the chunk does when starting in absolute or relative mode
 
-                    // If the last action was not a move, then we are now starting a new island
-                    curLayer->islands.emplace_back();
-                    curIsle = &(curLayer->islands.back());
+    ModalState startState;
+    int64_t firstLineNum = 0;
 
-                    // Move to the island
-                    curIsle->movePoints.push_back(lastPoint);
-                }
+    Toolpath path;
+};
 
-                curIsle->movePoints.push_back({prevX, prevY, prevZ});
-                curLineInfo->isMove = true;
-                lastWasMove = true;
-            }
+// Go through a chunk without knowing its starting state, to find out what it changes about the state
+static void SummarizeChunk(GCodeChunk &chunk)
+{
+    chunk.summaries[0] = ModalState::Unknown(false);
+    chunk.summaries[1] = ModalState::Unknown(true);
+    int8_t g[2] = { 0, 0 };
+
+    GCodeLine line;
+    LineEffect effect;
+    for (const char *pos = chunk.begin; pos < chunk.end; chunk.lineCount++)
+    {
+        const char *lineEnd = LineEnd(pos, chunk.end);
+
+        if (ParseLine(pos, lineEnd, line))
+        {
+            ApplyLine(chunk.summaries[0], line, g[0], effect);
+            ApplyLine(chunk.summaries[1], line, g[1], effect);
         }
 
-        if (curLayer != nullptr && curLayer->islands.size() > 0)
-            curLayer->islands.shrink_to_fit();
+        pos = lineEnd + 1;
+    }
+}
+
+// Build the layers and islands of a chunk, starting with the state the previous chunks leave it in
+static void ParseChunk(GCodeChunk &chunk)
+{
+    Toolpath &path = chunk.path;
+    ModalState state = chunk.startState;
+    int8_t g = 0;
+
+    // The first chunk starts with unset values, the others always start a new layer
+    bool prevValid = (state.axes[0] != -1) && (state.axes[1] != -1) && (state.axes[2] != -1);
+    bool hasLayer = false;
+
+    // Keep track if the last action was a move or
+    // an extrusion
+    bool lastWasMove = true;
+
+    GCodeLine line;
+    LineEffect effect;
+    int64_t lineNum = chunk.firstLineNum - 1;
+    for (const char *pos = chunk.begin; pos < chunk.end; pos = LineEnd(pos, chunk.end) + 1)
+    {
+        lineNum++;
+
+        if (!ParseLine(pos, LineEnd(pos, chunk.end), line))
+            continue;
+
+        // The last position
+        float lastX = state.axes[0];
+        float lastY = state.axes[1];
+
+        if (!ApplyLine(state, line, g, effect))
+            continue;
+
+        if (effect.newZ)
+        {
+            // Create a new layer when moving to a new z
+            path.StartLayer(state.axes[2]);
+            path.StartIsland();
+            hasLayer = true;
+            lastWasMove = true;
+
+            // Move to the island
+            path.AddPoint(lastX, lastY, false, lineNum);
+        }
+
+        // Skip the line if there was no movement
+        if (!effect.moved)
+            continue;
+
+        float x = state.axes[0];
+        float y = state.axes[1];
+
+        // Wait until we have current values to work from
+        if (!prevValid)
+        {
+            prevValid = (x != -1) && (y != -1) && (state.axes[2] != -1);
+
+            if (!prevValid)
+                continue;
+        }
 
-        if (curIsle != nullptr)
+        // TODO: points get lost when not on layers
+        if (!hasLayer)
+            continue;
+
+        // Arcs are drawn as a number of short straight pieces
+        float arcI = line.Has(WordI) ? line.values[WordI] : 0.0f;
+        float arcJ = line.Has(WordJ) ? line.values[WordJ] : 0.0f;
+        float arcRadius = 0.0f;
+        float arcStart = 0.0f;
+        float arcSweep = 0.0f;
+        int arcPieces = 1;
+        if (effect.arc)
+            arcPieces = ArcPieces(lastX, lastY, x, y, lastX + arcI, lastY + arcJ,
+                                  (line.type == ArcCW), arcRadius, arcStart, arcSweep);
+
+        // Roughly estimate the time for the line
+        double dist = (effect.arc) ? std::abs(arcSweep * arcRadius) :
+                                     std::sqrt(std::pow(x - lastX, 2) + std::pow(y - lastY, 2));
+        uint16_t millis = dist * 60000 / state.feedRates[g]; // Feedrate per minute...
+        path.totalMillis += millis;
+
+        if (effect.extruded)
         {
-            curIsle->movePoints.shrink_to_fit();
-            curIsle->printPoints.shrink_to_fit();
+            // Add the first point after moves
+            if (lastWasMove)
+                path.AddPoint(lastX, lastY, true, lineNum);
+
+            lastWasMove = false;
+        }
+        else if (!lastWasMove)
+        {
+            // If the last action was not a move, then we are now starting a new island
+            path.StartIsland();
+
+            // Move to the island
+            path.AddPoint(lastX, lastY, false, lineNum);
+
+            lastWasMove = true;
         }
+
+        for (int i = 1; i < arcPieces; i++)
+        {
+            float ang = arcStart + arcSweep * i / arcPieces;
+            path.AddPoint(lastX + arcI + arcRadius * std::cos(ang), lastY + arcJ + arcRadius * std::sin(ang),
+                          effect.extruded, lineNum);
+        }
+
+        // The time of the line is kept with its last point
+        path.AddPoint(x, y, effect.extruded, lineNum, millis);
+    }
+}
+
+// Run a function for every chunk on as many threads as there are cores
+template<typename Function>
+static void ForEachChunk(std::vector<GCodeChunk> &chunks, Function function)
+{
+    unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::atomic<std::size_t> nextChunk(0);
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < std::min((std::size_t)cores, chunks.size()); i++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (std::size_t c = nextChunk++; c < chunks.size(); c = nextChunk++)
+                function(chunks[c]);
+        });
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+// The amount of chunks per core the file is split into, so threads that finish early can take over work
+static const std::size_t ChunksPerCore = 4;
+
+// Find the start of the first line at or after the position that moves in z, the pieces in between
+// can then be parsed separately because layers do not continue past such a line
+static const char *NextLayerStart(const char *pos, const char *begin, const char *end)
+{
+    // Move to the start of a line
+    while (pos > begin && pos < end && pos[-1] != '\n')
+        pos++;
+
+    GCodeLine line;
+    while (pos < end)
+    {
+        const char *lineEnd = LineEnd(pos, end);
+        if (ParseLine(pos, lineEnd, line) && (line.type == RapidMove || line.type == Move) && line.Has(WordZ))
+            return pos;
+
+        pos = lineEnd + 1;
+    }
+
+    return end;
+}
+
+// The file is memory mapped and split into chunks at layer changes that are parsed in parallel. Because
+// the G-code is modal, every chunk is first summarized with its starting state unknown. Going through the
+// summaries in order gives the actual state each chunk starts with, after which they can be fully parsed.
+Toolpath* GCodeImporting::ImportGCode(const char *path)
+{
+    Toolpath *tp = new Toolpath();
+
+    // Check for a valid file
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return tp;
+
+    struct stat fileStat;
+    std::size_t size = (fstat(fd, &fileStat) == 0) ? fileStat.st_size : 0;
+    void *mapping = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return tp;
+
+    const char *begin = (const char*)mapping;
+    const char *end = begin + size;
+    madvise(mapping, size, MADV_WILLNEED);
+
+    unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::size_t targetCount = cores * ChunksPerCore;
+
+    std::vector<GCodeChunk> chunks;
+    const char *chunkBegin = begin;
+    for (std::size_t i = 1; i <= targetCount && chunkBegin < end; i++)
+    {
+        const char *chunkEnd = (i == targetCount) ? end :
+                               NextLayerStart(std::max(chunkBegin + 1, begin + size * i / targetCount), begin, end);
+
+        chunks.emplace_back();
+        chunks.back().begin = chunkBegin;
+        chunks.back().end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    ForEachChunk(chunks, SummarizeChunk);
+
+    // Work out the state every chunk starts with, a chunk that does not actually start a new layer
+    // in that state is joined with the one before it
+    std::vector<GCodeChunk> joined;
+    ModalState state;
+    int64_t lineNum = 0;
+    for (GCodeChunk &chunk : chunks)
+    {
+        bool startsLayer = joined.empty();
+        if (!startsLayer)
+        {
+            GCodeLine line;
+            ModalState lineState = state;
+            LineEffect effect;
+            int8_t g = 0;
+            ParseLine(chunk.begin, LineEnd(chunk.begin, chunk.end), line);
+            ApplyLine(lineState, line, g, effect);
+            startsLayer = effect.newZ;
+        }
+
+        if (startsLayer)
+        {
+            joined.emplace_back();
+            joined.back().begin = chunk.begin;
+            joined.back().startState = state;
+            joined.back().firstLineNum = lineNum;
+        }
+
+        joined.back().end = chunk.end;
+        state = state.Then(chunk.summaries[state.relative]);
+        lineNum += chunk.lineCount;
+    }
+
+    ForEachChunk(joined, ParseChunk);
+
+    munmap(mapping, size);
+
+    for (GCodeChunk &chunk : joined)
+    {
+        tp->Append(chunk.path);
+        chunk.path = Toolpath();
     }
 
+    tp->ShrinkToFit();
     return tp;
 }
@@ -183,6 +183,14 @@ void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage
     glFuncs->glBufferData(target, size, data, usage);
 }
 
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    if (ThrowInactive())
+        return;
+
+    glFuncs->glBufferSubData(target, offset, size, data);
+}
+
 void glUseProgram(GLuint program)
 {
     if (ThrowInactive())
@@ -215,6 +223,14 @@ void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, cons
     glFuncs->glUniformMatrix4fv(location, count, transpose, value);
 }
 
+void glUniform3fv(GLint location, GLsizei count, const GLfloat *value)
+{
+    if (ThrowInactive())
+        return;
+
+    glFuncs->glUniform3fv(location, count, value);
+}
+
 void glUniform4fv(GLint location, GLsizei count, const GLfloat *value)
 {
     if (ThrowInactive())
@@ -27,10 +27,12 @@ extern GLint glGetUniformLocation(GLuint program, const char* name);
 extern void glGenBuffers(GLsizei n, GLuint *buffers);
 extern void glBindBuffer(GLenum target, GLuint buffer);
 extern void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+extern void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
 extern void glUseProgram(GLuint program);
 extern void glEnableVertexAttribArray(GLuint index);
 extern void glVertexAttribPointer(GLuint indx, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *ptr);
 extern void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+extern void glUniform3fv(GLint location, GLsizei count, const GLfloat *value);
 extern void glUniform4fv(GLint location, GLsizei count, const GLfloat *value);
 extern void glUniform1f(GLint location,  GLfloat v0);
 extern void glUniform1i(GLint location,  GLint value);
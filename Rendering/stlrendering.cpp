@@ -5,6 +5,7 @@
 #include <string>
 #include <queue>
 #include <algorithm>
+#include <chrono>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -34,19 +35,49 @@ static bool dirtyProjMat = true;
 static bool dirtySceneMat = true;
 static bool dirtyMesh = false;
 
-static void LoadMesh(MeshGroupData &mg, Mesh *mesh)
+// Big meshes are uploaded in parts over several frames so the interface stays responsive
+typedef std::chrono::steady_clock UploadClock;
+static const UploadClock::duration UploadBudget = std::chrono::milliseconds(8);
+static const std::size_t UploadTrigs = 1 << 15;
+
+// Upload the next parts of a mesh until the deadline has passed, returns whether it is done
+static bool LoadMesh(MeshGroupData &mg, Mesh *mesh, UploadClock::time_point deadline)
 {
-    glGenBuffers(1, &mg.mVertexPositionBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexPositionBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mesh->trigCount * 9, mesh->getFlatVerts(), GL_STATIC_DRAW);
-    mesh->dumpFlatVerts();
+    const std::size_t trigSize = sizeof(float) * 9;
 
-    glGenBuffers(1, &mg.mVertexNormalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexNormalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mesh->trigCount * 9, mesh->getFlatNorms(), GL_STATIC_DRAW);
-    mesh->dumpFlatNorms();
+    // The buffers are allocated first and then filled in
+    if (mg.mVertexPositionBuffer == 0)
+    {
+        glGenBuffers(1, &mg.mVertexPositionBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexPositionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, trigSize * mesh->trigCount, nullptr, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mg.mVertexNormalBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexNormalBuffer);
+        glBufferData(GL_ARRAY_BUFFER, trigSize * mesh->trigCount, nullptr, GL_STATIC_DRAW);
+    }
+
+    while (mg.uploadedTrigs < mesh->trigCount && UploadClock::now() < deadline)
+    {
+        std::size_t count = std::min(UploadTrigs, mesh->trigCount - mg.uploadedTrigs);
+        std::size_t offset = mg.uploadedTrigs * 9;
+
+        glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexPositionBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, trigSize * mg.uploadedTrigs, trigSize * count, mg.flatVerts.data() + offset);
 
+        glBindBuffer(GL_ARRAY_BUFFER, mg.mVertexNormalBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, trigSize * mg.uploadedTrigs, trigSize * count, mg.flatNorms.data() + offset);
+
+        mg.uploadedTrigs += count;
+    }
+
+    if (mg.uploadedTrigs < mesh->trigCount)
+        return false;
+
+    std::vector<float>().swap(mg.flatVerts);
+    std::vector<float>().swap(mg.flatNorms);
     mg.meshDirty = false;
+    return true;
 }
 
 // This updates the Mesh in normal memory for saving but does not
@@ -346,6 +377,14 @@ void STLRendering::AddMesh(Mesh *mesh)
 {
     // Add a new mesh data group to the vector that contains all the metadata and helpers
     MeshGroupData *mg = new MeshGroupData;
+    const float *flatVerts = mesh->getFlatVerts();
+    mg->flatVerts.assign(flatVerts, flatVerts + mesh->trigCount * 9);
+    mesh->dumpFlatVerts();
+
+    const float *flatNorms = mesh->getFlatNorms();
+    mg->flatNorms.assign(flatNorms, flatNorms + mesh->trigCount * 9);
+    mesh->dumpFlatNorms();
+
     mg->meshDirty = true;
     meshGroups.emplace(mesh, mg);
 
@@ -545,13 +584,18 @@ void STLRendering::Draw()
 
     if (dirtyMesh)
     {
+        UploadClock::time_point deadline = UploadClock::now() + UploadBudget;
+        dirtyMesh = false;
+
         for (auto &gPair : meshGroups)
         {
-            if (gPair.second->meshDirty)
-                LoadMesh(*gPair.second, gPair.first);
+            if (gPair.second->meshDirty && !LoadMesh(*gPair.second, gPair.first, deadline))
+                dirtyMesh = true;
         }
 
-        dirtyMesh = false;
+        // Come back for the rest in the next frame
+        if (dirtyMesh)
+            ComboRendering::Update();
     }
 
     if (dirtyProjMat)
@@ -564,7 +608,7 @@ void STLRendering::Draw()
     {
         MeshGroupData &mg = *gPair.second;
 
-        if (mg.mVertexPositionBuffer == 0 || mg.mVertexNormalBuffer == 0)
+        if (mg.mVertexPositionBuffer == 0 || mg.mVertexNormalBuffer == 0 || mg.uploadedTrigs == 0)
             continue;
 
         // Set the matrices to those of this mesh, update if needed first
@@ -590,7 +634,7 @@ void STLRendering::Draw()
         glEnableVertexAttribArray(mNormalAttribLocation);
         glVertexAttribPointer(mNormalAttribLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-        glDrawArrays(GL_TRIANGLES, 0, gPair.first->trigCount * 3);
+        glDrawArrays(GL_TRIANGLES, 0, mg.uploadedTrigs * 3);
     }
 
     dirtySceneMat = false;
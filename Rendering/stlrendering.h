@@ -23,6 +23,13 @@ struct MeshGroupData
     GLuint mVertexPositionBuffer = 0;
     GLuint mVertexNormalBuffer = 0;
 
+    // The flat shading arrays are copied on the thread that adds the mesh and are
+    // uploaded in parts, only the uploaded triangles are drawn
+    // They are owned here because the mesh reuses its own arrays when it is exported
+    std::vector<float> flatVerts;
+    std::vector<float> flatNorms;
+    std::size_t uploadedTrigs = 0;
+
     // The scale that the actual mesh is currently on
     float scaleOnMesh = 1.0f;
     // The scale that the matrix is applying to the mesh
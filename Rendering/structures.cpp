@@ -2,6 +2,10 @@
 
 #include <QDebug>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <atomic>
 
 Mesh::Mesh(std::size_t size)
 {
@@ -68,7 +72,7 @@ void Mesh::ShrinkTrigs(std::size_t newSize)
 
 const float *Mesh::getFlatVerts()
 {
-    if (vertexFloats != nullptr)
+    if (vertFloats != nullptr)
         delete[] vertFloats;
 
     vertFloats = new float[trigCount * 9];
@@ -90,7 +94,7 @@ const float *Mesh::getFlatVerts()
 const float *Mesh::getFlatNorms()
 {
     if (normFloats != nullptr)
-        delete[] vertexFloats;
+        delete[] normFloats;
 
     normFloats = new float[trigCount * 9];
     for (std::size_t i = 0; i <trigCount; i++)
@@ -119,110 +123,301 @@ const float *Mesh::getFlatNorms()
     return normFloats;
 }
 
-static inline void AddPointsToArray(float *array, Point2 &p, short count, uint32_t &arrPos)
+const std::size_t Toolpath::LineBlockSize;
+const uint16_t Toolpath::LineOverflow;
+const uint32_t TPDataChunk::BlockIndices;
+const std::size_t TPDataChunk::LineLevelCount;
+const float TPDataChunk::LineTolerances[TPDataChunk::LineLevelCount] = { 0.2f, 1.0f };
+
+Toolpath::Toolpath()
+{
+    layerIslands.push_back(0);
+    islandPoints.push_back(0);
+}
+
+// The last entries of the offset tables are the counts, which become the start of the next layer or island
+void Toolpath::StartLayer(float z)
+{
+    layerZs.push_back(z);
+    layerIslands.push_back(layerIslands.back());
+}
+
+void Toolpath::StartIsland()
+{
+    islandPoints.push_back(islandPoints.back());
+    layerIslands.back()++;
+}
+
+void Toolpath::AddPoint(float x, float y, bool isPrinted, int64_t lineNum, uint16_t millis)
 {
-    for (short i = 0; i < count; i++)
+    AddLine(xs.size(), lineNum);
+    xs.push_back(x);
+    ys.push_back(y);
+    printed.push_back(isPrinted);
+    pointMillis.push_back(millis);
+    islandPoints.back()++;
+}
+
+void Toolpath::AddLine(std::size_t idx, int64_t lineNum)
+{
+    if (idx % LineBlockSize == 0)
+        lineBlocks.push_back(lineNum);
+
+    int64_t offset = lineNum - lineBlocks.back();
+    if (offset >= 0 && offset < LineOverflow)
+        lineOffsets.push_back(offset);
+    else
     {
-        array[arrPos + 0] = p.x;
-        array[arrPos + 1] = p.y;
-        arrPos += 2;
+        lineOffsets.push_back(LineOverflow);
+        overflowLines.emplace_back(idx, lineNum);
     }
 }
 
-static inline void AddPointZsToArray(float *array, Point2 &p, float z, short count, uint32_t &arrPos)
+void Toolpath::Append(const Toolpath &other)
 {
-    for (short i = 0; i < count; i++)
+    layerZs.insert(layerZs.end(), other.layerZs.begin(), other.layerZs.end());
+
+    uint32_t islandCount = IslandCount();
+    for (std::size_t i = 1; i < other.layerIslands.size(); i++)
+        layerIslands.push_back(islandCount + other.layerIslands[i]);
+
+    uint32_t pointCount = PointCount();
+    for (std::size_t i = 1; i < other.islandPoints.size(); i++)
+        islandPoints.push_back(pointCount + other.islandPoints[i]);
+
+    // The line numbers are added one by one as the blocks do not line up
+    for (std::size_t i = 0; i < other.PointCount(); i++)
+        AddLine(pointCount + i, other.PointLine(i));
+
+    xs.insert(xs.end(), other.xs.begin(), other.xs.end());
+    ys.insert(ys.end(), other.ys.begin(), other.ys.end());
+    printed.insert(printed.end(), other.printed.begin(), other.printed.end());
+    pointMillis.insert(pointMillis.end(), other.pointMillis.begin(), other.pointMillis.end());
+
+    totalMillis += other.totalMillis;
+}
+
+void Toolpath::ShrinkToFit()
+{
+    xs.shrink_to_fit();
+    ys.shrink_to_fit();
+    printed.shrink_to_fit();
+    pointMillis.shrink_to_fit();
+    layerZs.shrink_to_fit();
+    layerIslands.shrink_to_fit();
+    islandPoints.shrink_to_fit();
+    lineBlocks.shrink_to_fit();
+    lineOffsets.shrink_to_fit();
+    overflowLines.shrink_to_fit();
+}
+
+int64_t Toolpath::PointLine(std::size_t idx) const
+{
+    uint16_t offset = lineOffsets[idx];
+    if (offset != LineOverflow)
+        return lineBlocks[idx / LineBlockSize] + offset;
+
+    auto itr = std::lower_bound(overflowLines.begin(), overflowLines.end(), std::make_pair((uint32_t)idx, (int64_t)0),
+                                [](const std::pair<uint32_t, int64_t> &a, const std::pair<uint32_t, int64_t> &b)
+                                { return a.first < b.first; });
+    return itr->second;
+}
+
+int64_t Toolpath::LastPointOfLine(int64_t lineNum) const
+{
+    // The points are stored in the order of their lines
+    std::size_t low = 0, high = PointCount();
+    while (low < high)
     {
-        array[arrPos + 0] = p.x;
-        array[arrPos + 1] = p.y;
-        array[arrPos + 2] = z;
-        arrPos += 3;
+        std::size_t mid = (low + high) / 2;
+        if (PointLine(mid) <= lineNum)
+            low = mid + 1;
+        else
+            high = mid;
     }
+
+    return (int64_t)low - 1;
 }
 
-// An GLES chunk can have a maximum of 2^16(ushort) indices and we need to divide all the data between that
-// we will do this by creating a maximum size buffer for each set of data here and then shrinking it to only the
-// needed part
-static const uint16_t maxIdx = 10000;//UINT16_MAX; // TODO: variable data type
+std::size_t Toolpath::LineMillis(int64_t lineNum) const
+{
+    std::size_t millis = 0;
+    for (int64_t idx = LastPointOfLine(lineNum); idx >= 0 && PointLine(idx) == lineNum; idx--)
+        millis += pointMillis[idx];
 
-static inline void NewChunk(ushort &idxPos, ushort &saveIdx, ushort &lineIdx, std::vector<TPDataChunk> *chunks,
-                            TPDataChunk *&dc, ushort &lastEndIdx, ushort &lastLineIdx)
+    return millis;
+}
+
+// A chunk can only have as many vertices as its indices can address and we need to divide all the data between
+// that, we will do this by first counting how much of the toolpath fits in each chunk and then filling the chunks
+
+// The side codes of the vertices added for a point
+static const int8_t ConnectSides[] = { 10, -10 }; // Only the backwards part for the next point to connect to
+static const int8_t ForwardSides[] = { 40, -40 };
+static const int8_t BackwardSides[] = { 50, -50 };
+static const int8_t CornerSides[] = { 10, -10, 20, 30, -30 }; // Backwards, centre, forwards
+
+// Where a data chunk starts in the toolpath, and how the island it starts in was being cut up if it does not
+// start at the beginning of an island
+struct Toolpath::ChunkStart
 {
-    // We need to shrink the previous chunk to size
-    if (dc != nullptr)
+    std::size_t layer = 0;
+    std::size_t island = 0;
+    uint pointInIsle = 0;
+    bool cut = false;
+    uint fitCount = 0;
+    uint leftCount = 0;
+    uint fitPos = 0;
+
+    std::size_t firstPoint = 0;
+
+    // The size and bounds of the chunk, which are found by the counting pass
+    uint32_t vertexCount = 0;
+    uint32_t idxCount = 0;
+    uint32_t lineIdxCount = 0;
+    glm::vec3 low = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 high = glm::vec3(-std::numeric_limits<float>::max());
+};
+
+// Record how much of the chunk has to be drawn to show the toolpath up to the given point
+static inline void MarkPointsUpTo(TPDataChunk *dc, std::size_t pointIdx, uint32_t lastEndIdx, uint32_t lastLineIdx)
+{
+    while (dc->firstPoint + dc->pointIdxEnds.size() < pointIdx)
     {
-        dc->idxCount = idxPos;
-        dc->lineIdxCount = lineIdx;
-        dc->sideFloatCount = saveIdx;
-        dc->ShrinkToSize();
+        dc->pointIdxEnds.push_back(lastEndIdx);
+        dc->pointLineIdxEnds.push_back(lastLineIdx);
     }
+}
 
-    idxPos = 0;
-    saveIdx = 0;
-    lineIdx = 0;
-    lastEndIdx = 0;
-    lastLineIdx = 0;
-    chunks->emplace_back();
-    dc = &(chunks->back());
+static inline int16_t Quantise(float value, float origin, float scale)
+{
+    float steps = std::round((value - origin) / scale);
+    return (int16_t)std::max(std::min(steps, (float)INT16_MAX), (float)-INT16_MAX);
 }
 
-std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
+static inline void GrowBounds(glm::vec3 &low, glm::vec3 &high, const Point2 &p, float z)
 {
-    ushort idxPos = 0;
-    ushort saveIdx = 0;
-    ushort lineIdx = 0;
-    std::vector<TPDataChunk> *chunks = new std::vector<TPDataChunk>();
-    TPDataChunk *dc = nullptr;
+    low = glm::vec3(std::min(low.x, p.x), std::min(low.y, p.y), std::min(low.z, z));
+    high = glm::vec3(std::max(high.x, p.x), std::max(high.y, p.y), std::max(high.z, z));
+}
+
+// Go through the toolpath from the start of a chunk until the next chunk has to be started, returns false if the
+// end of the toolpath was reached instead. Without a chunk to fill in only the size of the chunk is determined.
+bool Toolpath::WalkChunk(ChunkStart &start, ChunkStart &next, TPDataChunk *dc, uint32_t maxVertices) const
+{
+    uint32_t idxPos = 0;
+    uint32_t saveIdx = 0;
+    uint32_t lineIdx = 0;
 
     // Data for partial rendering
-    ushort lastEndIdx = 0;
-    ushort lastLineIdx = 0;
+    uint32_t lastEndIdx = 0;
+    uint32_t lastLineIdx = 0;
+
+    bool hasNext = false;
+
+    // Add the vertices for a point, when only counting the bounds of the chunk are grown instead
+    auto addVertices = [&](const Point2 &curPoint, const Point2 &prevPoint, const Point2 &nextPoint, float z,
+                           const int8_t *sides, short count)
+    {
+        if (dc == nullptr)
+        {
+            GrowBounds(start.low, start.high, curPoint, z);
+            GrowBounds(start.low, start.high, prevPoint, z);
+            GrowBounds(start.low, start.high, nextPoint, z);
+            return;
+        }
 
-    // Use a MACRO to easily push a new chunk
-    #define NEWCHUNK() NewChunk(idxPos, saveIdx, lineIdx, chunks, dc, lastEndIdx, lastLineIdx)
-    NEWCHUNK();
+        TPVertex vertex;
+        vertex.cur[0] = Quantise(curPoint.x, dc->origin.x, dc->scale.x);
+        vertex.cur[1] = Quantise(curPoint.y, dc->origin.y, dc->scale.y);
+        vertex.cur[2] = Quantise(z, dc->origin.z, dc->scale.z);
+        vertex.pad = 0;
+        vertex.prev[0] = Quantise(prevPoint.x, dc->origin.x, dc->scale.x);
+        vertex.prev[1] = Quantise(prevPoint.y, dc->origin.y, dc->scale.y);
+        vertex.next[0] = Quantise(nextPoint.x, dc->origin.x, dc->scale.x);
+        vertex.next[1] = Quantise(nextPoint.y, dc->origin.y, dc->scale.y);
+
+        for (short k = 0; k < count; k++)
+        {
+            vertex.side = sides[k];
+            dc->vertices[saveIdx + k] = vertex;
+        }
+    };
 
-    for (Layer layer : layers)
+    for (std::size_t l = start.layer; l < LayerCount() && !hasNext; l++)
     {
-        for (Island isle : layer.islands)
+        float layerZ = layerZs[l];
+        std::size_t firstIsle = (l == start.layer) ? start.island : layerIslands[l];
+
+        for (std::size_t i = firstIsle; i < layerIslands[l + 1]; i++)
         {
+            // Only the points that are printed to are drawn, they follow the moves to the island
+            std::size_t printStart = islandPoints[i];
+            std::size_t printEnd = islandPoints[i + 1];
+            while (printStart < printEnd && !printed[printStart])
+                printStart++;
+
+            auto pCount = printEnd - printStart;
+#define PRINTPOINT(idx) PointAt(printStart + (idx))
+
+            // The island might have been cut off at the end of the previous chunk
+            bool resumed = (l == start.layer && i == start.island && start.pointInIsle > 0);
+            uint firstJ = 0;
+
             // We need to determine the maximum amount of points on the island in order to know if we
             // will have to cut it up into pieces
             bool cut = true;
-            auto pCount = isle.printPoints.size();
-
-            // Determine how many points we can still fit in this chunk
-            uint fitCount = (maxIdx - saveIdx - 2) / 5;
+            uint fitCount = 0;
             uint leftCount = 0;
+            uint fitPos = 0;
 
-#define MAXFITCOUNT() fitCount = (maxIdx - 2) / 5
-
-            // We need to fit at least 3 points
-            if (fitCount < 3)
-            {
-                NEWCHUNK();
-                MAXFITCOUNT();
-            }
-
-            if (pCount < fitCount)
+            if (resumed)
             {
-                cut = false;
-                //fitCount = pCount;
+                firstJ = start.pointInIsle;
+                cut = start.cut;
+                fitCount = start.fitCount;
+                leftCount = start.leftCount;
+                fitPos = start.fitPos;
             }
             else
             {
-                cut = true;
-                leftCount = pCount - fitCount;
+                if (dc != nullptr)
+                    MarkPointsUpTo(dc, printStart, lastEndIdx, lastLineIdx);
+
+                // Determine how many points we can still fit in this chunk
+                fitCount = (maxVertices - saveIdx - 2) / 5;
+
+                // We need to fit at least 3 points, the island then starts the next chunk
+                if (fitCount < 3)
+                {
+                    next = ChunkStart();
+                    next.layer = l;
+                    next.island = i;
+                    next.firstPoint = printStart;
+                    hasNext = true;
+                    break;
+                }
+
+                if (pCount < fitCount)
+                {
+                    cut = false;
+                    //fitCount = pCount;
+                }
+                else
+                {
+                    cut = true;
+                    leftCount = pCount - fitCount;
+                }
             }
 
-            uint fitPos = 0;
-            for (uint j = 0; j < pCount; j++)
+            for (uint j = firstJ; j < pCount; j++)
             {
                 // Determine the connecting points
                 bool isLast = (j == pCount - 1);
                 bool isFirst = (j == 0);
 
-                Point2 curPoint = isle.printPoints[j];
+                std::size_t pointIdx = printStart + j;
+                Point2 curPoint = PRINTPOINT(j);
                 Point2 prevPoint, nextPoint;
                 bool hasNoPrev = false;
                 bool hasNoNext = false;
@@ -232,18 +427,14 @@ std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
                 // It is not possible to place the last point alone on the next chunk so we need to ensure it is never needed
                 if (isLast)
                 {
-                    prevPoint = isle.printPoints[j - 1];
-                    nextPoint = isle.printPoints[0];
+                    prevPoint = PRINTPOINT(j - 1);
+                    nextPoint = PRINTPOINT(0);
 
                     if (curPoint == nextPoint)
                     {
                         // Add the first two parts of the first point for the last point to connect to
-                        nextPoint = isle.printPoints[1];
-                        AddPointZsToArray(dc->curFloats, curPoint, layer.z, 2, dc->curFloatCount);
-                        AddPointsToArray(dc->prevFloats, prevPoint, 2, dc->prevFloatCount);
-                        AddPointsToArray(dc->nextFloats, nextPoint, 2, dc->nextFloatCount);
-                        dc->sides[saveIdx + 0] = 10.0f;
-                        dc->sides[saveIdx + 1] = -10.0f;
+                        nextPoint = PRINTPOINT(1);
+                        addVertices(curPoint, prevPoint, nextPoint, layerZ, ConnectSides, 2);
                         saveIdx += 2;
 
                         continue;
@@ -253,46 +444,53 @@ std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
                 }
                 else
                 {
-                    nextPoint = isle.printPoints[j + 1];
+                    nextPoint = PRINTPOINT(j + 1);
 
                     if (isFirst)
                     {
-                        prevPoint = isle.printPoints[pCount - 1];
+                        prevPoint = PRINTPOINT(pCount - 1);
 
                         if (prevPoint == curPoint)
-                            prevPoint = isle.printPoints[pCount - 2]; // TODO: error maybe?
+                            prevPoint = PRINTPOINT(pCount - 2); // TODO: error maybe?
                         else
                             hasNoPrev = true;
                     }
                     else
-                        prevPoint = isle.printPoints[j - 1];
+                        prevPoint = PRINTPOINT(j - 1);
 
-                    // Check if we need to move to a new chunk
-                    if (cut)
+                    // Check if we need to move to a new chunk, the point an island is resumed
+                    // at was already moved
+                    if (cut && !(resumed && j == firstJ))
                     {
                         if (fitPos > (fitCount - 2))
                         {
                             // If this point needs to go to a new chunk then we need to add its first 2
                             // vertices for the last one in this chunk to connect to
-                            AddPointZsToArray(dc->curFloats, curPoint, layer.z, 2, dc->curFloatCount);
-                            AddPointsToArray(dc->prevFloats, prevPoint, 2, dc->prevFloatCount);
-                            AddPointsToArray(dc->nextFloats, nextPoint, 2, dc->nextFloatCount);
-                            dc->sides[saveIdx + 0] = 10.0f;
-                            dc->sides[saveIdx + 1] = -10.0f;
+                            addVertices(curPoint, prevPoint, nextPoint, layerZ, ConnectSides, 2);
                             saveIdx += 2;
 
-                            // We then need to move to a new chunk
-                            NEWCHUNK();
+                            // We then need to move to a new chunk that starts at this point
+                            next = ChunkStart();
+                            next.layer = l;
+                            next.island = i;
+                            next.pointInIsle = j;
+                            next.firstPoint = pointIdx;
+                            next.fitPos = fitPos;
+                            next.leftCount = leftCount;
 
                             // We also need to determine if it will have to be cut again
-                            MAXFITCOUNT();
-                            if (leftCount < fitCount)
-                                cut = false;
+                            next.fitCount = (maxVertices - 2) / 5;
+                            if (leftCount < next.fitCount)
+                                next.cut = false;
                             else
                             {
-                                leftCount -= fitCount;
-                                fitPos = 0;
+                                next.cut = true;
+                                next.leftCount -= next.fitCount;
+                                next.fitPos = 0;
                             }
+
+                            hasNext = true;
+                            break;
                         }
                         else
                             fitPos++;
@@ -309,32 +507,29 @@ std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
                 if (hasNoPrev)
                 {
                     // Add only 2 points
-                    AddPointZsToArray(dc->curFloats, curPoint, layer.z, 2, dc->curFloatCount);
-                    AddPointsToArray(dc->prevFloats, prevPoint, 2, dc->prevFloatCount);
-                    AddPointsToArray(dc->nextFloats, nextPoint, 2, dc->nextFloatCount);
-
-                    // Point attributes
                     // Forwards only
-                    dc->sides[saveIdx + 0] = 40.0f;
-                    dc->sides[saveIdx + 1] = -40.0f;
-
-                    // Rectangle only
-                    dc->indices[idxPos + 0] = saveIdx + 0;
-                    dc->indices[idxPos + 1] = saveIdx + 2;
-                    dc->indices[idxPos + 2] = saveIdx + 1;
-                    dc->indices[idxPos + 3] = saveIdx + 2;
-                    dc->indices[idxPos + 4] = saveIdx + 3;
-                    dc->indices[idxPos + 5] = saveIdx + 1;                    
-
-                    // Line
-                    dc->lineIdxs[lineIdx] = saveIdx;
-                    dc->lineIdxs[lineIdx + 1] = saveIdx + 3;
+                    addVertices(curPoint, prevPoint, nextPoint, layerZ, ForwardSides, 2);
+
+                    if (dc != nullptr)
+                    {
+                        // Rectangle only
+                        dc->indices[idxPos + 0] = saveIdx + 0;
+                        dc->indices[idxPos + 1] = saveIdx + 2;
+                        dc->indices[idxPos + 2] = saveIdx + 1;
+                        dc->indices[idxPos + 3] = saveIdx + 2;
+                        dc->indices[idxPos + 4] = saveIdx + 3;
+                        dc->indices[idxPos + 5] = saveIdx + 1;
+
+                        // Line
+                        dc->lineIdxs[lineIdx] = saveIdx;
+                        dc->lineIdxs[lineIdx + 1] = saveIdx + 3;
+                    }
                     lineIdx += 2;
 
                     // Mark the rendering start & end point
                     // With the position/count of the index
                     lastEndIdx = idxPos + 6;
-                    lastLineIdx = lineIdx + 2;
+                    lastLineIdx = lineIdx;
 
                     idxPos += 6;
                     saveIdx += 2;
@@ -342,14 +537,8 @@ std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
                 else if (hasNoNext)
                 {
                     // Add only 2 points
-                    AddPointZsToArray(dc->curFloats, curPoint, layer.z, 2, dc->curFloatCount);
-                    AddPointsToArray(dc->prevFloats, prevPoint, 2, dc->prevFloatCount);
-                    AddPointsToArray(dc->nextFloats, nextPoint, 2, dc->nextFloatCount);
-
-                    // Point attributes
                     // Backwards only
-                    dc->sides[saveIdx + 0] = 50.0f;
-                    dc->sides[saveIdx + 1] = -50.0f;
+                    addVertices(curPoint, prevPoint, nextPoint, layerZ, BackwardSides, 2);
 
                     // Nothing for the indices
 
@@ -358,163 +547,286 @@ std::vector<TPDataChunk>* Toolpath::CalculateDataChunks()
                 else
                 {
                     // Add all the position components
-                    AddPointZsToArray(dc->curFloats, curPoint, layer.z, 5, dc->curFloatCount);
-                    AddPointsToArray(dc->prevFloats, prevPoint, 5, dc->prevFloatCount);
-                    AddPointsToArray(dc->nextFloats, nextPoint, 5, dc->nextFloatCount);
-
-                    // Point attributes
-                    // Backwards, centre, forwards
-                    dc->sides[saveIdx + 0] = 10.0f;
-                    dc->sides[saveIdx + 1] = -10.0f;
-                    dc->sides[saveIdx + 2] = 20.0f;
-                    dc->sides[saveIdx + 3] = 30.0f;
-                    dc->sides[saveIdx + 4] = -30.0f;
-
-                    // Connector trigs
-                    dc->indices[idxPos + 0] = saveIdx + 0;
-                    dc->indices[idxPos + 1] = saveIdx + 3;
-                    dc->indices[idxPos + 2] = saveIdx + 2;
-                    dc->indices[idxPos + 3] = saveIdx + 1;
-                    dc->indices[idxPos + 4] = saveIdx + 2;
-                    dc->indices[idxPos + 5] = saveIdx + 4;
-
-                    // Rectangle
-                    dc->indices[idxPos + 6] = saveIdx + 3;
-                    dc->indices[idxPos + 7] = saveIdx + 5;
-                    dc->indices[idxPos + 8] = saveIdx + 4;
-                    dc->indices[idxPos + 9] = saveIdx + 4;
-                    dc->indices[idxPos + 10] = saveIdx + 5;
-                    dc->indices[idxPos + 11] = saveIdx + 6;
-
-                    // Line
-                    dc->lineIdxs[lineIdx] = saveIdx;
-                    dc->lineIdxs[lineIdx + 1] = saveIdx + 6;
+                    addVertices(curPoint, prevPoint, nextPoint, layerZ, CornerSides, 5);
+
+                    if (dc != nullptr)
+                    {
+                        // Connector trigs
+                        dc->indices[idxPos + 0] = saveIdx + 0;
+                        dc->indices[idxPos + 1] = saveIdx + 3;
+                        dc->indices[idxPos + 2] = saveIdx + 2;
+                        dc->indices[idxPos + 3] = saveIdx + 1;
+                        dc->indices[idxPos + 4] = saveIdx + 2;
+                        dc->indices[idxPos + 5] = saveIdx + 4;
+
+                        // Rectangle
+                        dc->indices[idxPos + 6] = saveIdx + 3;
+                        dc->indices[idxPos + 7] = saveIdx + 5;
+                        dc->indices[idxPos + 8] = saveIdx + 4;
+                        dc->indices[idxPos + 9] = saveIdx + 4;
+                        dc->indices[idxPos + 10] = saveIdx + 5;
+                        dc->indices[idxPos + 11] = saveIdx + 6;
+
+                        // Line
+                        dc->lineIdxs[lineIdx] = saveIdx;
+                        dc->lineIdxs[lineIdx + 1] = saveIdx + 6;
+                    }
                     lineIdx += 2;
 
                     // Mark the rendering start & end point
                     // With the position/count of the index
                     lastEndIdx = idxPos + 12;
-                    lastLineIdx = lineIdx + 2;
+                    lastLineIdx = lineIdx;
 
                     idxPos += 12;
                     saveIdx += 5;
                 }
 
                 // Add the info and move to the next one
-                // -1 means the points signifies the start of a move
-                // and isn't relevant
-                if (curPoint.lineNum != -1)
-                {
-                    LineInfo &isleLineInfo = lineInfos[curPoint.lineNum];
-                    isleLineInfo.idxInChunk = lastEndIdx;
-                    isleLineInfo.lineIdxInChunk = lastLineIdx;
-                    isleLineInfo.chunkIdx = chunks->size() - 1;
-                }
+                if (dc != nullptr)
+                    MarkPointsUpTo(dc, pointIdx + 1, lastEndIdx, lastLineIdx);
             }
+#undef PRINTPOINT
+
+            if (hasNext)
+                break;
         }
     }
 
-    // Finish up the last chunk
-    dc->idxCount = idxPos;
-    dc->lineIdxCount = lineIdx;
-    dc->sideFloatCount = saveIdx;
-    dc->ShrinkToSize();
-
-    // Fill in all the blank lineinfos
-    int chunkIdx = 0;
-    int idxInChunk = 0;
-    int lineIdxInChunk = 0;
-    for (LineInfo &li : lineInfos)
+    if (dc != nullptr)
+    {
+        // The moves before the next chunk are still drawn up to the end of this one
+        MarkPointsUpTo(dc, hasNext ? next.firstPoint : PointCount(), lastEndIdx, lastLineIdx);
+        dc->vertexCount = saveIdx;
+        dc->idxCount = idxPos;
+        dc->lineIdxCount = lineIdx;
+    }
+    else
+    {
+        start.vertexCount = saveIdx;
+        start.idxCount = idxPos;
+        start.lineIdxCount = lineIdx;
+    }
+
+    return hasNext;
+}
+
+std::vector<TPDataChunk>* Toolpath::CalculateDataChunks(uint32_t maxVertices) const
+{
+    // Find where every chunk starts and how big it will be
+    std::vector<ChunkStart> starts(1);
+    while (true)
     {
-        // Reset the inChunkIdxs after each new block
-        if (li.chunkIdx > chunkIdx)
+        ChunkStart next;
+        if (!WalkChunk(starts.back(), next, nullptr, maxVertices))
+            break;
+
+        starts.push_back(next);
+    }
+
+    // The chunks can then be allocated at their final size
+    std::vector<TPDataChunk> *chunks = new std::vector<TPDataChunk>();
+    chunks->reserve(starts.size());
+    for (std::size_t c = 0; c < starts.size(); c++)
+    {
+        ChunkStart &start = starts[c];
+        chunks->emplace_back(start.vertexCount, start.idxCount, start.lineIdxCount);
+
+        TPDataChunk &dc = chunks->back();
+
+        // The positions are stored relative to the centre of the chunk, with steps that make them fit in 16 bits
+        if (start.vertexCount > 0)
         {
-            idxInChunk = 0;
-            lineIdxInChunk = 0;
+            glm::vec3 halfSize = (start.high - start.low) * 0.5f;
+            dc.origin = start.low + halfSize;
+            for (int a = 0; a < 3; a++)
+                dc.scale[a] = (halfSize[a] > 0.0f) ? halfSize[a] / INT16_MAX : 1.0f;
         }
 
-        li.chunkIdx = chunkIdx = std::max(chunkIdx, li.chunkIdx);
-        li.idxInChunk = idxInChunk = std::max(idxInChunk, li.idxInChunk);
-        li.lineIdxInChunk = lineIdxInChunk = std::max(lineIdxInChunk, li.lineIdxInChunk);
+        std::size_t endPoint = (c + 1 < starts.size()) ? starts[c + 1].firstPoint : PointCount();
+        dc.firstPoint = start.firstPoint;
+        dc.pointIdxEnds.reserve(endPoint - start.firstPoint);
+        dc.pointLineIdxEnds.reserve(endPoint - start.firstPoint);
     }
 
-    chunks->shrink_to_fit();
-    return chunks;
-}
+    // And filled in on as many threads as there are cores
+    unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::atomic<std::size_t> nextChunk(0);
 
-ushort *TPDataChunk::getIndices()
-{
-    indicesCopied = true;
-    return indices;
-}
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < std::min((std::size_t)cores, starts.size()); i++)
+    {
+        threads.emplace_back([&]()
+        {
+            ChunkStart next;
+            for (std::size_t c = nextChunk++; c < starts.size(); c = nextChunk++)
+            {
+                WalkChunk(starts[c], next, &chunks->at(c), maxVertices);
+                chunks->at(c).CalculateBounds();
+                chunks->at(c).CalculateLineLevels();
+            }
+        });
+    }
 
-ushort *TPDataChunk::getLineIdxs()
-{
-    lineIdxsCopied = true;
-    return lineIdxs;
-}
+    for (std::thread &thread : threads)
+        thread.join();
 
-void TPDataChunk::ShrinkToSize()
-{
-    curFloats   = (float*) realloc (curFloats, curFloatCount * sizeof(float));
-    nextFloats  = (float*) realloc (nextFloats, nextFloatCount * sizeof(float));
-    prevFloats  = (float*) realloc (prevFloats, prevFloatCount * sizeof(float));
-    sides       = (float*) realloc (sides, sideFloatCount * sizeof(float));
-    indices     = (ushort*)realloc (indices, idxCount * sizeof(uint16_t));
-    lineIdxs    = (ushort*)realloc (lineIdxs, lineIdxCount * sizeof(uint16_t));
+    return chunks;
 }
 
-TPDataChunk::TPDataChunk()
+TPDataChunk::TPDataChunk(uint32_t vertexCount, uint32_t indexCount, uint32_t lineIndexCount)
 {
-    curFloats  = (float*) malloc (maxIdx * 15 * sizeof(float));
-    nextFloats = (float*) malloc (maxIdx * 10 * sizeof(float));
-    prevFloats = (float*) malloc (maxIdx * 10 * sizeof(float));
-    sides      = (float*) malloc (maxIdx * 5 * sizeof(float));
-    indices    = (ushort*)malloc (maxIdx * 12 * sizeof(ushort));
-    lineIdxs   = (ushort*)malloc (maxIdx * sizeof(ushort));
+    vertices   = (TPVertex*)malloc (vertexCount * sizeof(TPVertex));
+    indices    = (uint32_t*)malloc (indexCount * sizeof(uint32_t));
+    lineIdxs   = (uint32_t*)malloc (lineIndexCount * sizeof(uint32_t));
 }
 
 TPDataChunk::TPDataChunk(TPDataChunk &&copier)
 {
-    curFloats = copier.curFloats;
-    prevFloats = copier.prevFloats;
-    nextFloats = copier.nextFloats;
-    sides = copier.sides;
+    vertices = copier.vertices;
     indices = copier.indices;
     lineIdxs = copier.lineIdxs;
 
-    curFloatCount = copier.curFloatCount;
-    prevFloatCount = copier.prevFloatCount;
-    nextFloatCount = copier.nextFloatCount;
-    sideFloatCount = copier.sideFloatCount;
+    origin = copier.origin;
+    scale = copier.scale;
+    vertexCount = copier.vertexCount;
     idxCount = copier.idxCount;
     lineIdxCount = copier.lineIdxCount;
-    indicesCopied = copier.indicesCopied;
-    lineIdxsCopied = copier.lineIdxsCopied;
-
-    copier.curFloats = nullptr;
-    copier.prevFloats = nullptr;
-    copier.nextFloats = nullptr;
-    copier.sides = nullptr;
+    firstPoint = copier.firstPoint;
+    pointIdxEnds = std::move(copier.pointIdxEnds);
+    pointLineIdxEnds = std::move(copier.pointLineIdxEnds);
+    low = copier.low;
+    high = copier.high;
+    blockBounds = std::move(copier.blockBounds);
+    for (std::size_t l = 0; l < LineLevelCount; l++)
+        lineLevels[l] = std::move(copier.lineLevels[l]);
+
+    copier.vertices = nullptr;
     copier.indices = nullptr;
     copier.lineIdxs = nullptr;
 }
 
 TPDataChunk::~TPDataChunk()
 {
-    if (curFloats != nullptr)
-        free (curFloats);
-    if (prevFloats != nullptr)
-        free (prevFloats);
-    if (nextFloats != nullptr)
-        free (nextFloats);
-    if (sides != nullptr)
-        free (sides);
-
-    // The indices won't be copied over to the gpu and will need to remain in existence
-    // the renderer will be responsible for freeing the memory used by that array
-    if (!indicesCopied && indices != nullptr)
+    if (vertices != nullptr)
+        free (vertices);
+    if (indices != nullptr)
         free (indices);
-    if (!lineIdxsCopied && lineIdxs != nullptr)
+    if (lineIdxs != nullptr)
         free (lineIdxs);
 }
+
+void TPDataChunk::CalculateBounds()
+{
+    // The vertices are moved towards their previous and next points when they are drawn,
+    // so those have to be inside the bounds as well
+    auto growBounds = [&](glm::vec3 &blockLow, glm::vec3 &blockHigh, const TPVertex &vertex)
+    {
+        float z = origin.z + vertex.cur[2] * scale.z;
+        for (const int16_t *pos : { vertex.cur, vertex.prev, vertex.next })
+        {
+            glm::vec3 p = glm::vec3(origin.x + pos[0] * scale.x, origin.y + pos[1] * scale.y, z);
+            blockLow = glm::vec3(std::min(blockLow.x, p.x), std::min(blockLow.y, p.y), std::min(blockLow.z, p.z));
+            blockHigh = glm::vec3(std::max(blockHigh.x, p.x), std::max(blockHigh.y, p.y), std::max(blockHigh.z, p.z));
+        }
+    };
+
+    for (uint32_t v = 0; v < vertexCount; v++)
+        growBounds(low, high, vertices[v]);
+
+    uint32_t blockCount = (idxCount + BlockIndices - 1) / BlockIndices;
+    blockBounds.clear();
+    blockBounds.reserve(blockCount * 2);
+    for (uint32_t b = 0; b < blockCount; b++)
+    {
+        glm::vec3 blockLow = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 blockHigh = glm::vec3(-std::numeric_limits<float>::max());
+
+        uint32_t end = std::min((b + 1) * BlockIndices, idxCount);
+        for (uint32_t i = b * BlockIndices; i < end; i++)
+            growBounds(blockLow, blockHigh, vertices[indices[i]]);
+
+        blockBounds.push_back(blockLow);
+        blockBounds.push_back(blockHigh);
+    }
+}
+
+static float DistanceToLineSq(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+{
+    glm::vec3 ab = b - a;
+    float lengthSq = glm::dot(ab, ab);
+    float t = (lengthSq > 0.0f) ? std::max(0.0f, std::min(1.0f, glm::dot(p - a, ab) / lengthSq)) : 0.0f;
+    glm::vec3 offset = p - (a + ab * t);
+    return glm::dot(offset, offset);
+}
+
+void TPDataChunk::CalculateLineLevels()
+{
+    // Never skip so many points that checking them becomes slow
+    const uint32_t MaxSkipped = 32;
+
+    auto samePoint = [&](uint32_t a, uint32_t b)
+    {
+        return std::equal(vertices[a].cur, vertices[a].cur + 3, vertices[b].cur);
+    };
+
+    for (std::size_t l = 0; l < LineLevelCount; l++)
+    {
+        lineLevels[l].lineIdxs.clear();
+        lineLevels[l].lineIdxEnds.clear();
+    }
+
+    std::vector<glm::vec3> points;
+    uint32_t lineCount = lineIdxCount / 2;
+    uint32_t line = 0;
+    while (line < lineCount)
+    {
+        // The lines of an island follow each other, each one starting at the point the last one ended
+        uint32_t chainEnd = line + 1;
+        while (chainEnd < lineCount && samePoint(lineIdxs[chainEnd * 2 - 1], lineIdxs[chainEnd * 2]))
+            chainEnd++;
+
+        // The start of the chain followed by the end of every line in it
+        points.clear();
+        for (uint32_t i = line; i <= chainEnd; i++)
+        {
+            const TPVertex &vertex = vertices[(i == line) ? lineIdxs[i * 2] : lineIdxs[i * 2 - 1]];
+            points.push_back(glm::vec3(origin.x + vertex.cur[0] * scale.x, origin.y + vertex.cur[1] * scale.y,
+                                       origin.z + vertex.cur[2] * scale.z));
+        }
+
+        for (std::size_t l = 0; l < LineLevelCount; l++)
+        {
+            TPLineLevel &level = lineLevels[l];
+            float toleranceSq = LineTolerances[l] * LineTolerances[l];
+
+            auto addLine = [&](uint32_t from, uint32_t to)
+            {
+                level.lineIdxs.push_back(lineIdxs[from * 2]);
+                level.lineIdxs.push_back(lineIdxs[to * 2 + 1]);
+                level.lineIdxEnds.push_back((to + 1) * 2);
+            };
+
+            // Keep extending a line from the anchor as long as the points it skips stay close enough to it
+            uint32_t anchor = line;
+            for (uint32_t i = line + 1; i < chainEnd; i++)
+            {
+                bool fits = (i - anchor < MaxSkipped);
+                const glm::vec3 &a = points[anchor - line];
+                const glm::vec3 &b = points[i + 1 - line];
+                for (uint32_t k = anchor + 1; fits && k <= i; k++)
+                    fits = (DistanceToLineSq(points[k - line], a, b) <= toleranceSq);
+
+                if (!fits)
+                {
+                    addLine(anchor, i - 1);
+                    anchor = i;
+                }
+            }
+
+            addLine(anchor, chainEnd - 1);
+        }
+
+        line = chainEnd;
+    }
+}
@@ -4,8 +4,10 @@
 #include <stdexcept>
 #include <Misc/strings.h>
 #include <cstring>
+#include <cstdint>
 #include <limits>
 #include <vector>
+#include <utility>
 #include <glm/glm.hpp>
 #include <list>
 
@@ -106,6 +108,8 @@ enum GType
 {
     RapidMove = 0,
     Move = 1,
+    ArcCW = 2,
+    ArcCCW = 3,
     Home = 28,
     ToInch = 20,
     ToMM = 21,
@@ -118,10 +122,9 @@ struct Point2
 {
     float x = 0;
     float y = 0;
-    int64_t lineNum = -1; // The gcode line
 
     Point2() {}
-    Point2(float _x, float _y, int64_t _lineNum) : x(_x), y(_y), lineNum(_lineNum) {}
+    Point2(float _x, float _y) : x(_x), y(_y) {}
 
     bool operator== (Point2 &b)
     {
@@ -134,81 +137,115 @@ struct Point2
     }
 };
 
-struct Point3
-{
-    float x = 0;
-    float y = 0;
-    float z = 0;
-
-    Point3() {}
-    Point3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
-};
-
-struct LineInfo
-{
-    uint16_t milliSecs = 0;
-    bool isMove = false;
-    bool isExtruded = false;
-    // Else nonsense
-
-    int chunkIdx = 0;
-    int idxInChunk = 0;
-    int lineIdxInChunk = 0;
-};
+class Toolpath;
 
-struct Island
+// A vertex for rendering the toolpath, its positions are stored relative to the origin of its chunk
+// in steps of the chunk's scale. The side code tells which corner of a line piece the vertex is.
+struct TPVertex
 {
-    std::vector<Point3> movePoints;
-    std::vector<Point2> printPoints;
+    int16_t cur[3];
+    int8_t side;
+    int8_t pad;
+    int16_t prev[2];
+    int16_t next[2];
 };
 
-struct Layer
+// A simplified copy of the line indices of a chunk, for drawing it with less detail
+struct TPLineLevel
 {
-    float z;
-    std::vector<Island> islands;
+    std::vector<uint32_t> lineIdxs;
+    std::vector<uint32_t> lineIdxEnds; // How far into the full line indices each line reaches
 };
 
-class Toolpath;
-
 class TPDataChunk
 {
-    friend class Toolpath;
-
-private:
-    bool indicesCopied = false;
-    bool lineIdxsCopied = false;
-    bool lineInfosCopied = false;
-    ushort *indices = nullptr;
-    ushort *lineIdxs = nullptr;
-
 public:
-    float *curFloats = nullptr;
-    float *prevFloats = nullptr;
-    float *nextFloats = nullptr;
-    float *sides = nullptr;
-
-    uint32_t curFloatCount = 0;
-    uint32_t prevFloatCount = 0;
-    uint32_t nextFloatCount = 0;
-    uint32_t sideFloatCount = 0;
-    uint16_t idxCount = 0;
-    uint16_t lineIdxCount = 0;
-
-    ushort *getIndices();
-    ushort *getLineIdxs();
-    void ShrinkToSize();
-
-    TPDataChunk();
+    TPVertex *vertices = nullptr;
+    uint32_t *indices = nullptr;
+    uint32_t *lineIdxs = nullptr;
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    uint32_t vertexCount = 0;
+    uint32_t idxCount = 0;
+    uint32_t lineIdxCount = 0;
+
+    // How many indices have to be drawn to show the toolpath up to each point, starting with the first point in the chunk
+    uint32_t firstPoint = 0;
+    std::vector<uint32_t> pointIdxEnds;
+    std::vector<uint32_t> pointLineIdxEnds;
+
+    // The bounds of the chunk and of every block of triangle indices, so what is out of view can be skipped
+    static const uint32_t BlockIndices = 3 * 1024;
+    glm::vec3 low = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 high = glm::vec3(-std::numeric_limits<float>::max());
+    std::vector<glm::vec3> blockBounds; // The low and high corner of each block
+
+    // The lines simplified to stay within each tolerance, from fine to coarse
+    static const std::size_t LineLevelCount = 2;
+    static const float LineTolerances[LineLevelCount];
+    TPLineLevel lineLevels[LineLevelCount];
+
+    TPDataChunk(uint32_t vertexCount, uint32_t indexCount, uint32_t lineIndexCount);
     TPDataChunk(TPDataChunk &&copier);
     ~TPDataChunk();
+
+    void CalculateBounds();
+    void CalculateLineLevels();
 };
 
+// The toolpath of a G-code file stored as flat arrays. Every layer is a range of islands and every island
+// a range of points, starting with the points moved to to reach it followed by the points printed to.
+// The line number of each point is kept as an offset to the first line of its block of points.
 struct Toolpath
 {
-    std::vector<Layer> layers;
-    std::vector<TPDataChunk> *CalculateDataChunks();
-    std::vector<LineInfo> lineInfos;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<bool> printed; // Whether each point is printed to or moved to
+    std::vector<uint16_t> pointMillis; // The estimated time to reach each point
+
+    std::vector<float> layerZs;
+    std::vector<uint32_t> layerIslands; // The first island of every layer, followed by the island count
+    std::vector<uint32_t> islandPoints; // The first point of every island, followed by the point count
+
     std::size_t totalMillis = 0; // ETA
+
+    std::size_t LayerCount() const { return layerZs.size(); }
+    std::size_t IslandCount() const { return islandPoints.size() - 1; }
+    std::size_t PointCount() const { return xs.size(); }
+    Point2 PointAt(std::size_t idx) const { return Point2(xs[idx], ys[idx]); }
+
+    void StartLayer(float z);
+    void StartIsland();
+    void AddPoint(float x, float y, bool isPrinted, int64_t lineNum, uint16_t millis = 0);
+
+    // Add the layers of another toolpath, which has to come after this one in the file
+    void Append(const Toolpath &other);
+    void ShrinkToFit();
+
+    int64_t PointLine(std::size_t idx) const;
+    // The last point that is reached before the line after this one is started, or -1 if there is none
+    int64_t LastPointOfLine(int64_t lineNum) const;
+    std::size_t LineMillis(int64_t lineNum) const;
+
+    // Build the vertex data for rendering with at most the given amount of vertices in a chunk,
+    // this can be called from any thread
+    std::vector<TPDataChunk> *CalculateDataChunks(uint32_t maxVertices) const;
+
+    Toolpath();
+
+private:
+    static const std::size_t LineBlockSize = 64;
+    static const uint16_t LineOverflow = UINT16_MAX;
+
+    std::vector<uint32_t> lineBlocks; // The line of the first point in every block
+    std::vector<uint16_t> lineOffsets;
+    std::vector<std::pair<uint32_t, int64_t>> overflowLines; // Points too far from the start of their block
+
+    void AddLine(std::size_t idx, int64_t lineNum);
+
+    struct ChunkStart;
+    bool WalkChunk(ChunkStart &start, ChunkStart &next, TPDataChunk *dc, uint32_t maxVertices) const;
 };
 
 #endif // STRUCTURES
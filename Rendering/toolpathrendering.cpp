@@ -5,9 +5,15 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <iostream>
-#include <time.h>
 #include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
 
 #include "glhelper.h"
 #include "mathhelper.h"
@@ -19,15 +25,36 @@ struct GroupGLData
 {
     ~GroupGLData();
 
-    GLuint mCurPosBuffer = 0;
-    GLuint mNextPosBuffer = 0;
-    GLuint mPrevPosBuffer = 0;
-    GLuint mSideBuffer = 0;
+    GLuint mVertexBuffer = 0;
+    GLuint mIndexBuffer = 0;
+    GLuint mLineIndexBuffer = 0;
+    glm::vec3 origin;
+    glm::vec3 scale;
 
-    uint16_t *indices;
-    uint16_t *lineIdxs;
-    short idxCount = 0;
-    short lineIdxCount = 0;
+    uint32_t idxCount = 0;
+    uint32_t lineIdxCount = 0;
+
+    // Bounds of the whole group and of every block of triangle indices
+    glm::vec3 low;
+    glm::vec3 high;
+    std::vector<glm::vec3> blockBounds;
+
+    // The simplified lines and how far into the full line indices each of them reaches
+    GLuint mLevelIndexBuffers[TPDataChunk::LineLevelCount] = {};
+    std::vector<uint32_t> levelLineIdxEnds[TPDataChunk::LineLevelCount];
+
+    // How much has to be drawn to show the toolpath up to each point from the first one in the group
+    uint32_t firstPoint = 0;
+    std::vector<uint32_t> pointIdxEnds;
+    std::vector<uint32_t> pointLineIdxEnds;
+};
+
+// A position in the index buffers of the groups, everything before it is drawn
+struct DrawPos
+{
+    int64_t chunk;
+    uint32_t idx;
+    uint32_t lineIdx;
 };
 
 static GLuint mProgram = 0;
@@ -40,17 +67,42 @@ static GLint mModelUniformLocation = 0;
 static GLint mRadiusUniformLocation = 0;
 static GLint mProjUniformLocation = 0;
 static GLint mColorUniformLocation = 0;
+static GLint mChunkOriginUniformLocation = 0;
+static GLint mChunkScaleUniformLocation = 0;
 static GLint mLineOnlyUnformLocation = 0;
 
 static int64_t curPrintToLine = -1;
 static int64_t targetPrintToLine = -1;
-static int printToChunk = -1;
-static int printToIdx = -1;
-static int printToLineIdx = -1;
+static DrawPos printedTo = { -1, 0, 0 }; // A negative chunk draws everything
+
+// Where every layer starts followed by where the last one ends, so a range of layers
+// can be drawn without touching the chunks outside of it
+static std::vector<DrawPos> layerStarts;
+static int firstShownLayer = -1;
+static int lastShownLayer = -1;
+
+// Without 32 bit index support the chunks have to be small enough to address all their vertices with 16 bits
+static const uint32_t MaxShortIndexVertices = UINT16_MAX;
+static const uint32_t MaxIntIndexVertices = 1 << 18;
+static GLenum indexType = GL_UNSIGNED_SHORT;
+static uint32_t maxChunkVertices = MaxShortIndexVertices;
 
 static GroupGLData *groupDatas = nullptr;
 static std::size_t groupCount = 0;
 
+// The chunks of a new toolpath are calculated on the thread that sets it, so the render thread
+// only has to upload them, the last toolpath that has been set is guarded by the same mutex
+static std::mutex pendingMutex;
+static std::vector<TPDataChunk> *pendingChunks = nullptr;
+static std::shared_ptr<const Toolpath> path;
+
+// The chunks of the new toolpath are uploaded a few per frame, so the preview is built up
+// from the bottom while the interface stays responsive
+static std::vector<TPDataChunk> *uploadingChunks = nullptr;
+
+// The toolpath that the uploaded chunks belong to, which is only used and released on the render thread
+static std::shared_ptr<const Toolpath> loadedPath;
+
 // We need flags to determine when matrices have changed as
 // to be able to give new ones to opengl
 static bool dirtyProjMat = true;
@@ -58,33 +110,67 @@ static bool dirtySceneMat = true;
 static bool dirtyPath = false;
 static bool dirtyColor = true;
 
+// The planes of the view volume, which are used to skip the groups and blocks that are out of view
+static glm::vec4 frustumPlanes[6];
+
+// TODO: derive the layer height from the actual gcode instead
+// or maybe rather use the extrusion diameter
+static const float FilamentRadius = 0.225f; // Almost half 0.5f
+
 static glm::vec3 _color = glm::vec3(0.2f, 0.2f, 0.8f);
 static float opacity = 1.0f;
 
-// If the gcode rendering is becoing too slow then we need to temporarily fall back
-// a simpler rendering method. We then have a flag that redraws the current frame
-// if it has been idle for long enough.
+// The level of detail: the filament itself, its centre lines and then the simplified lines
+// from fine to coarse. The level is chosen by how big the toolpath is on screen, and while
+// the view is moving we go down as many levels as needed to draw the toolpath within a frame.
+// Once it stops moving the detail is restored a level per frame.
+static const int LineLevel = 1;
+static const int CoarsestLevel = LineLevel + TPDataChunk::LineLevelCount;
+
+typedef std::chrono::steady_clock DrawClock;
+static const DrawClock::duration FrameBudget = std::chrono::milliseconds(33);
+static const DrawClock::duration IdleDelay = std::chrono::milliseconds(250);
+
+static const DrawClock::duration UploadBudget = std::chrono::milliseconds(8);
 
-static volatile bool complexify = false;
+static DrawClock::time_point lastDrawTime;
+static int detailDrop = 0;
+// How long drawing the toolpath took the last time it was drawn at each level of detail
+static DrawClock::duration levelCosts[CoarsestLevel + 1];
 
-static clock_t lastDrawTime = clock();
+// Redraws the view once no frames have been drawn for a while, to refine the detail
+static std::mutex refineMutex;
+static std::condition_variable refineCondition;
+static bool refinePending = false;
+static DrawClock::time_point refineTime;
 
-static void checkComplexify()
+static void RefineLoop()
 {
+    std::unique_lock<std::mutex> lock(refineMutex);
     while (true)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        refineCondition.wait(lock, []() { return refinePending; });
 
-        if (complexify)
-        {
-            lastDrawTime = clock();
-            ComboRendering::Update();
-            complexify = false;
-        }
+        // Every frame drawn in the meantime moves the refine time further away
+        while (DrawClock::now() < refineTime)
+            refineCondition.wait_until(lock, refineTime);
+
+        refinePending = false;
+        lock.unlock();
+        ComboRendering::Update();
+        lock.lock();
     }
 }
 
-static std::thread *complexifyThread = nullptr;
+static void RequestRefine()
+{
+    std::lock_guard<std::mutex> lock(refineMutex);
+    refinePending = true;
+    refineTime = DrawClock::now() + IdleDelay;
+    refineCondition.notify_one();
+}
+
+static std::thread *refineThread = nullptr;
 
 void ToolpathRendering::FreeMemory()
 {
@@ -100,51 +186,270 @@ void ToolpathRendering::FreeMemory()
         groupDatas = nullptr;
     }
 
-    if (complexifyThread != nullptr)
-        delete complexifyThread;
+    if (pendingChunks != nullptr)
+    {
+        delete pendingChunks;
+        pendingChunks = nullptr;
+    }
+
+    if (uploadingChunks != nullptr)
+    {
+        delete uploadingChunks;
+        uploadingChunks = nullptr;
+    }
+
+    loadedPath.reset();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        path.reset();
+    }
+
+    if (refineThread != nullptr)
+        delete refineThread;
 }
 
-static Toolpath *path = nullptr;
+static DrawPos PositionAfterPoint(int64_t pointIdx);
+
+// Without 32 bit index support the indices are packed into 16 bits at the start of their own array,
+// which is done on the thread that sets the toolpath
+static void PackShortIndices(uint32_t *indices, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        uint16_t index = indices[i];
+        memcpy((char*)indices + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+    }
+}
+
+static inline std::size_t IndexSize()
+{
+    return (indexType == GL_UNSIGNED_INT) ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+// Upload the (packed) indices to the bound element buffer
+static void UploadIndices(const uint32_t *indices, std::size_t count)
+{
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, IndexSize() * count, indices, GL_STATIC_DRAW);
+}
 
 static void LoadPath()
 {
-    dirtyPath = false;
+    std::vector<TPDataChunk> *chunks = nullptr;
+    std::shared_ptr<const Toolpath> tp;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        std::swap(chunks, pendingChunks);
+        tp = path;
+        dirtyPath = false;
+    }
+
+    if (chunks == nullptr)
+        return;
 
     if (groupDatas != nullptr)
         delete[] groupDatas;
+    if (uploadingChunks != nullptr)
+        delete uploadingChunks;
+
+    // The groups are only drawn once they have been uploaded
+    groupDatas = new GroupGLData[chunks->size()];
+    groupCount = 0;
+    layerStarts.clear();
+
+    // The previous toolpath is released once nothing refers to its chunks anymore
+    uploadingChunks = chunks;
+    loadedPath = std::move(tp);
+}
+
+static void UploadChunk(TPDataChunk *dc, GroupGLData *gd)
+{
+    glGenBuffers(1, &gd->mVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, gd->mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(TPVertex) * dc->vertexCount, dc->vertices, GL_STATIC_DRAW);
+    gd->origin = dc->origin;
+    gd->scale = dc->scale;
+
+    glGenBuffers(1, &gd->mIndexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->mIndexBuffer);
+    UploadIndices(dc->indices, dc->idxCount);
+
+    glGenBuffers(1, &gd->mLineIndexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->mLineIndexBuffer);
+    UploadIndices(dc->lineIdxs, dc->lineIdxCount);
+
+    gd->idxCount = dc->idxCount;
+    gd->lineIdxCount = dc->lineIdxCount;
+
+    gd->firstPoint = dc->firstPoint;
+    gd->pointIdxEnds = std::move(dc->pointIdxEnds);
+    gd->pointLineIdxEnds = std::move(dc->pointLineIdxEnds);
+
+    gd->low = dc->low;
+    gd->high = dc->high;
+    gd->blockBounds = std::move(dc->blockBounds);
 
-    auto chunks = path->CalculateDataChunks();
-    groupCount = chunks->size();
-    groupDatas = new GroupGLData[groupCount];
+    for (std::size_t l = 0; l < TPDataChunk::LineLevelCount; l++)
+    {
+        TPLineLevel &level = dc->lineLevels[l];
+        glGenBuffers(1, &gd->mLevelIndexBuffers[l]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->mLevelIndexBuffers[l]);
+        UploadIndices(level.lineIdxs.data(), level.lineIdxs.size());
+        gd->levelLineIdxEnds[l] = std::move(level.lineIdxEnds);
+    }
+}
 
-    for (std::size_t i = 0; i < groupCount; i++)
+// Upload chunks until the time for this frame is used up, at least one chunk is uploaded every frame
+static void UploadChunks()
+{
+    DrawClock::time_point deadline = DrawClock::now() + UploadBudget;
+    do
     {
-        TPDataChunk *dc = &chunks->at(i);
-        GroupGLData *gd = groupDatas + i;
+        UploadChunk(&uploadingChunks->at(groupCount), groupDatas + groupCount);
+        groupCount++;
+    }
+    while (groupCount < uploadingChunks->size() && DrawClock::now() < deadline);
 
-        glGenBuffers(1, &gd->mCurPosBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, gd->mCurPosBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dc->curFloatCount, dc->curFloats, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-        glGenBuffers(1, &gd->mNextPosBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, gd->mNextPosBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dc->nextFloatCount, dc->nextFloats, GL_STATIC_DRAW);
+    // How much to draw for the print progress depends on the groups that have been uploaded
+    if (targetPrintToLine >= 0)
+        curPrintToLine = -1;
+
+    if (groupCount < uploadingChunks->size())
+    {
+        // Come back for the rest in the next frame
+        ComboRendering::Update();
+        return;
+    }
 
-        glGenBuffers(1, &gd->mPrevPosBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, gd->mPrevPosBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dc->prevFloatCount, dc->prevFloats, GL_STATIC_DRAW);
+    delete uploadingChunks;
+    uploadingChunks = nullptr;
 
-        glGenBuffers(1, &gd->mSideBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, gd->mSideBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dc->sideFloatCount, dc->sides, GL_STATIC_DRAW);
+    const Toolpath *tp = loadedPath.get();
 
-        gd->indices = dc->getIndices();
-        gd->lineIdxs = dc->getLineIdxs();
-        gd->idxCount = dc->idxCount;
-        gd->lineIdxCount = dc->lineIdxCount;
+    // Every layer starts where the points before its first island have been drawn,
+    // the island count and point count at the end of the tables give the end of the last layer
+    layerStarts.clear();
+    if (tp != nullptr)
+    {
+        layerStarts.reserve(tp->LayerCount() + 1);
+        for (std::size_t l = 0; l <= tp->LayerCount(); l++)
+            layerStarts.push_back(PositionAfterPoint((int64_t)tp->islandPoints[tp->layerIslands[l]] - 1));
     }
+}
 
-    delete chunks;
+// Determine how much of which group has to be drawn to show the toolpath up to and including a point
+static DrawPos PositionAfterPoint(int64_t pointIdx)
+{
+    DrawPos pos = { 0, 0, 0 };
+    if (pointIdx < 0 || groupCount == 0)
+        return pos;
+
+    // The groups are in the order of their points
+    GroupGLData *group = std::upper_bound(groupDatas + 1, groupDatas + groupCount, (uint32_t)pointIdx,
+                                          [](uint32_t idx, const GroupGLData &gd) { return idx < gd.firstPoint; }) - 1;
+    pos.chunk = group - groupDatas;
+
+    if (group->pointIdxEnds.empty())
+        return pos;
+
+    std::size_t inGroup = std::min((std::size_t)(pointIdx - group->firstPoint), group->pointIdxEnds.size() - 1);
+    pos.idx = std::min(group->pointIdxEnds[inGroup], group->idxCount);
+    pos.lineIdx = std::min(group->pointLineIdxEnds[inGroup], group->lineIdxCount); // Never draw past the index buffer
+    return pos;
+}
+
+static bool IsBefore(const DrawPos &a, const DrawPos &b)
+{
+    return (a.chunk < b.chunk) || (a.chunk == b.chunk && a.idx < b.idx);
+}
+
+// Get the planes of the view volume from the combined matrix, their normals point inwards
+static void UpdateFrustum()
+{
+    glm::mat4 MVP = ComboRendering::getSceneProj() * ComboRendering::getSceneTrans();
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++)
+        rows[r] = glm::vec4(MVP[0][r], MVP[1][r], MVP[2][r], MVP[3][r]);
+
+    for (int i = 0; i < 3; i++)
+    {
+        frustumPlanes[i * 2] = rows[3] + rows[i];
+        frustumPlanes[i * 2 + 1] = rows[3] - rows[i];
+    }
+}
+
+// Whether any part of a box can be in view, the filament is drawn around the points it is made of
+static bool BoxVisible(const glm::vec3 &low, const glm::vec3 &high)
+{
+    glm::vec3 centre = (low + high) * 0.5f;
+    glm::vec3 halfSize = (high - low) * 0.5f + glm::vec3(FilamentRadius);
+
+    for (const glm::vec4 &plane : frustumPlanes)
+    {
+        float dist = plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w;
+        float reach = std::fabs(plane.x) * halfSize.x + std::fabs(plane.y) * halfSize.y + std::fabs(plane.z) * halfSize.z;
+        if (dist + reach < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+// The least detail that still looks the same at the current zoom
+static int ScreenLevel()
+{
+    float pixelsPerMM = ComboRendering::getZoom();
+
+    // The filament is only worth drawing while it is more than a pixel wide
+    if (FilamentRadius * 2.0f * pixelsPerMM > 1.0f)
+        return 0;
+
+    // The simplified lines can be used as long as they stay within a pixel of the real ones
+    int level = LineLevel;
+    for (std::size_t l = 0; l < TPDataChunk::LineLevelCount; l++)
+    {
+        if (TPDataChunk::LineTolerances[l] * pixelsPerMM <= 1.0f)
+            level = LineLevel + 1 + l;
+    }
+
+    return level;
+}
+
+// Determine the level of detail from the zoom and from how long drawing takes at each level
+static int ChooseLevel()
+{
+    DrawClock::time_point now = DrawClock::now();
+    DrawClock::duration frameGap = now - lastDrawTime;
+    lastDrawTime = now;
+
+    int level = std::min(ScreenLevel() + detailDrop, CoarsestLevel);
+
+    // Frames that follow each other closely are drawn while the view is moving, the detail is then dropped
+    // whilst drawing takes longer than a frame and only raised again once the finer level was drawn in time
+    if (frameGap < IdleDelay)
+    {
+        if (levelCosts[level] > FrameBudget)
+            detailDrop = std::min(detailDrop + 1, CoarsestLevel);
+        else if (detailDrop > 0 && levelCosts[std::max(level - 1, 0)] < FrameBudget)
+            detailDrop--;
+    }
+    else
+        detailDrop = std::max(detailDrop - 1, 0);
+
+    if (detailDrop > 0)
+        RequestRefine();
+
+    return std::min(ScreenLevel() + detailDrop, CoarsestLevel);
+}
+
+// Draw a range of the bound element buffer
+static void DrawRange(GLenum mode, uint32_t start, uint32_t end)
+{
+    if (end <= start)
+        return;
+
+    glDrawElements(mode, end - start, indexType, (void*)(start * IndexSize()));
 }
 
 void ToolpathRendering::SceneMatDirty()
@@ -157,9 +462,27 @@ void ToolpathRendering::ProjMatDirty()
     dirtyProjMat = true;
 }
 
-void ToolpathRendering::SetToolpath(Toolpath *tp)
+void ToolpathRendering::SetToolpath(std::shared_ptr<const Toolpath> tp)
 {
-    path = tp;
+    auto chunks = tp->CalculateDataChunks(maxChunkVertices);
+
+    if (indexType == GL_UNSIGNED_SHORT)
+    {
+        for (TPDataChunk &dc : *chunks)
+        {
+            PackShortIndices(dc.indices, dc.idxCount);
+            PackShortIndices(dc.lineIdxs, dc.lineIdxCount);
+            for (TPLineLevel &level : dc.lineLevels)
+                PackShortIndices(level.lineIdxs.data(), level.lineIdxs.size());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (pendingChunks != nullptr)
+        delete pendingChunks;
+
+    pendingChunks = chunks;
+    path = std::move(tp);
     dirtyPath = true;
 }
 
@@ -169,8 +492,7 @@ void ToolpathRendering::ShowPrintedToLine(int64_t lineNum)
     {
         targetPrintToLine = -1;
         curPrintToLine = -1;
-        printToChunk = -1;
-        printToIdx = -1;
+        printedTo.chunk = -1;
     }
     else
         targetPrintToLine = lineNum;
@@ -178,42 +500,47 @@ void ToolpathRendering::ShowPrintedToLine(int64_t lineNum)
     ComboRendering::Update();
 }
 
-GroupGLData::~GroupGLData()
+void ToolpathRendering::ShowLayerRange(int first, int last)
 {
-    if (mCurPosBuffer != 0)
-    {
-        glDeleteBuffers(1, &mCurPosBuffer);
-        mCurPosBuffer = 0;
-    }
+    firstShownLayer = first;
+    lastShownLayer = last;
 
-    if (mNextPosBuffer != 0)
-    {
-        glDeleteBuffers(1, &mNextPosBuffer);
-        mNextPosBuffer = 0;
-    }
+    ComboRendering::Update();
+}
 
-    if (mPrevPosBuffer != 0)
+int ToolpathRendering::LayerCount()
+{
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    return (path != nullptr) ? path->LayerCount() : 0;
+}
+
+GroupGLData::~GroupGLData()
+{
+    if (mVertexBuffer != 0)
     {
-        glDeleteBuffers(1, &mPrevPosBuffer);
-        mPrevPosBuffer = 0;
+        glDeleteBuffers(1, &mVertexBuffer);
+        mVertexBuffer = 0;
     }
 
-    if (mSideBuffer != 0)
+    if (mIndexBuffer != 0)
     {
-        glDeleteBuffers(1, &mSideBuffer);
-        mSideBuffer = 0;
+        glDeleteBuffers(1, &mIndexBuffer);
+        mIndexBuffer = 0;
     }
 
-    if (indices != nullptr)
+    if (mLineIndexBuffer != 0)
     {
-        free(indices);
-        indices = nullptr;
+        glDeleteBuffers(1, &mLineIndexBuffer);
+        mLineIndexBuffer = 0;
     }
 
-    if (lineIdxs != nullptr)
+    for (GLuint &buffer : mLevelIndexBuffers)
     {
-        free(lineIdxs);
-        lineIdxs = nullptr;
+        if (buffer != 0)
+        {
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+        }
     }
 }
 
@@ -231,15 +558,27 @@ void ToolpathRendering::Init()
     mColorUniformLocation = glGetUniformLocation(mProgram, "uColor");
     mLineOnlyUnformLocation = glGetUniformLocation(mProgram, "uLineOnly");
     mProjUniformLocation = glGetUniformLocation(mProgram, "uProjMatrix");
+    mChunkOriginUniformLocation = glGetUniformLocation(mProgram, "uChunkOrigin");
+    mChunkScaleUniformLocation = glGetUniformLocation(mProgram, "uChunkScale");
+
+    // 32 bit indices allow much bigger chunks, which are always supported by desktop OpenGL
+#ifdef GLES
+    const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+    bool intIndices = (extensions != nullptr && strstr(extensions, "GL_OES_element_index_uint") != nullptr);
+#else
+    bool intIndices = true;
+#endif
+    indexType = intIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    maxChunkVertices = intIndices ? MaxIntIndexVertices : MaxShortIndexVertices;
 
     mCurPosAttribLocation = glGetAttribLocation(mProgram, "aCurPos");
     mNextPosAttribLocation = glGetAttribLocation(mProgram, "aNextPos");
     mPrevPosAttribLocation = glGetAttribLocation(mProgram, "aPrevPos");
     mSideAttribLocation = glGetAttribLocation(mProgram, "aSide");
 
-    // Start the complexifying thread
-    complexifyThread = new std::thread(checkComplexify);
-    complexifyThread->detach();
+    // Start the thread that refines the view once it stops moving
+    refineThread = new std::thread(RefineLoop);
+    refineThread->detach();
 }
 
 void ToolpathRendering::Draw()
@@ -252,6 +591,12 @@ void ToolpathRendering::Draw()
     if (dirtyPath)
         LoadPath();
 
+    if (uploadingChunks != nullptr)
+        UploadChunks();
+
+    if (dirtySceneMat || dirtyProjMat)
+        UpdateFrustum();
+
     if (dirtySceneMat)
     {
         glUniformMatrix4fv(mModelUniformLocation, 1, GL_FALSE, glm::value_ptr(ComboRendering::getSceneTrans()));
@@ -270,62 +615,109 @@ void ToolpathRendering::Draw()
         dirtyColor = false;
     }
 
-    if (path != nullptr && targetPrintToLine != curPrintToLine)
+    if (loadedPath != nullptr && targetPrintToLine != curPrintToLine)
     {
-        printToChunk = path->lineInfos[targetPrintToLine - 1].chunkIdx;
-        printToIdx = path->lineInfos[targetPrintToLine - 1].idxInChunk;
-        printToLineIdx = path->lineInfos[targetPrintToLine - 1].lineIdxInChunk;
+        printedTo = PositionAfterPoint(loadedPath->LastPointOfLine(targetPrintToLine - 1));
         curPrintToLine = targetPrintToLine;
     }
 
-    clock_t now = clock();
-    clock_t deltaTicks = now - lastDrawTime;
-    clock_t fps = 0;
-    if (deltaTicks > 0)
-        fps = CLOCKS_PER_SEC / deltaTicks / 4.0; // Not sure why 4
-    //std::cout << "FPS: " << fps << std::endl;
-    lastDrawTime = now;
-    bool simpleDraw = (fps < 30.0);
+    int level = ChooseLevel();
+    DrawClock::time_point drawStart = DrawClock::now();
 
-    std::size_t target = (printToChunk != -1) ? printToChunk + 1 : groupCount;
-    for (std::size_t i = 0; i < target; i++)
-    {
-        GroupGLData *ld = groupDatas + i;
+    // Only the chunks between the start of the first shown layer and the end of the last one are drawn
+    DrawPos from = { 0, 0, 0 };
+    DrawPos to = { (int64_t)groupCount - 1, UINT32_MAX, UINT32_MAX };
 
-        glBindBuffer(GL_ARRAY_BUFFER, ld->mCurPosBuffer);
-        glEnableVertexAttribArray(mCurPosAttribLocation);
-        glVertexAttribPointer(mCurPosAttribLocation, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    int layers = (int)layerStarts.size() - 1;
+    if (firstShownLayer >= 0 && layers > 0)
+    {
+        int first = std::min(firstShownLayer, layers - 1);
+        int last = (lastShownLayer < 0) ? layers - 1 : std::min(std::max(lastShownLayer, first), layers - 1);
+        from = layerStarts[first];
+        to = layerStarts[last + 1];
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, ld->mNextPosBuffer);
-        glEnableVertexAttribArray(mNextPosAttribLocation);
-        glVertexAttribPointer(mNextPosAttribLocation, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    if (printedTo.chunk >= 0 && IsBefore(printedTo, to))
+        to = printedTo;
 
-        glBindBuffer(GL_ARRAY_BUFFER, ld->mPrevPosBuffer);
-        glEnableVertexAttribArray(mPrevPosAttribLocation);
-        glVertexAttribPointer(mPrevPosAttribLocation, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(mCurPosAttribLocation);
+    glEnableVertexAttribArray(mNextPosAttribLocation);
+    glEnableVertexAttribArray(mPrevPosAttribLocation);
+    glEnableVertexAttribArray(mSideAttribLocation);
 
-        glBindBuffer(GL_ARRAY_BUFFER, ld->mSideBuffer);
-        glEnableVertexAttribArray(mSideAttribLocation);
-        glVertexAttribPointer(mSideAttribLocation, 1, GL_FLOAT, GL_FALSE, 0, 0);
+    for (int64_t i = from.chunk; i <= to.chunk && i < (int64_t)groupCount; i++)
+    {
+        GroupGLData *ld = groupDatas + i;
+        if (!BoxVisible(ld->low, ld->high))
+            continue;
+
+        // All the attributes are interleaved in one buffer, the positions are dequantised by the shader
+        glBindBuffer(GL_ARRAY_BUFFER, ld->mVertexBuffer);
+        glVertexAttribPointer(mCurPosAttribLocation, 3, GL_SHORT, GL_FALSE, sizeof(TPVertex), (void*)offsetof(TPVertex, cur));
+        glVertexAttribPointer(mSideAttribLocation, 1, GL_BYTE, GL_FALSE, sizeof(TPVertex), (void*)offsetof(TPVertex, side));
+        glVertexAttribPointer(mPrevPosAttribLocation, 2, GL_SHORT, GL_FALSE, sizeof(TPVertex), (void*)offsetof(TPVertex, prev));
+        glVertexAttribPointer(mNextPosAttribLocation, 2, GL_SHORT, GL_FALSE, sizeof(TPVertex), (void*)offsetof(TPVertex, next));
+        glUniform3fv(mChunkOriginUniformLocation, 1, glm::value_ptr(ld->origin));
+        glUniform3fv(mChunkScaleUniformLocation, 1, glm::value_ptr(ld->scale));
 
         // TODO: implement line rendering using strips and fix issues
+        glUniform1f(mRadiusUniformLocation, FilamentRadius);
 
-        // TODO: derive the layer height from the actual gcode instead
-        // or maybe rather use the extrusion diameter
-        glUniform1f(mRadiusUniformLocation, 0.225f); // Almost half 0.5f       
+        if (level > LineLevel)
+        {
+            // Draw the simplified lines that end within the range of the full ones
+            const std::vector<uint32_t> &ends = ld->levelLineIdxEnds[level - LineLevel - 1];
+            uint32_t start = (i == from.chunk) ? from.lineIdx : 0;
+            uint32_t end = (i == to.chunk) ? to.lineIdx : ld->lineIdxCount;
+            uint32_t levelStart = std::upper_bound(ends.begin(), ends.end(), start) - ends.begin();
+            uint32_t levelEnd = std::upper_bound(ends.begin(), ends.end(), end) - ends.begin();
 
-        if (simpleDraw)
+            glUniform1i(mLineOnlyUnformLocation, true);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ld->mLevelIndexBuffers[level - LineLevel - 1]);
+            DrawRange(GL_LINES, levelStart * 2, levelEnd * 2);
+        }
+        else if (level == LineLevel)
         {
+            uint32_t start = (i == from.chunk) ? from.lineIdx : 0;
+            uint32_t end = (i == to.chunk) ? std::min(to.lineIdx, ld->lineIdxCount) : ld->lineIdxCount;
+
             glUniform1i(mLineOnlyUnformLocation, true);
-            glDrawElements(GL_LINES, (i == target - 1 && printToChunk != -1) ? printToLineIdx : ld->lineIdxCount, GL_UNSIGNED_SHORT, ld->lineIdxs);
-            complexify = true;
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ld->mLineIndexBuffer);
+            DrawRange(GL_LINES, start, end);
         }
         else
         {
+            uint32_t start = (i == from.chunk) ? from.idx : 0;
+            uint32_t end = (i == to.chunk) ? std::min(to.idx, ld->idxCount) : ld->idxCount;
+
             glUniform1i(mLineOnlyUnformLocation, false);
-            glDrawElements(GL_TRIANGLES, (i == target - 1 && printToChunk != -1) ? printToIdx : ld->idxCount, GL_UNSIGNED_SHORT, ld->indices);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ld->mIndexBuffer);
+
+            // Only the runs of blocks that are in view are drawn
+            uint32_t runStart = start;
+            for (uint32_t b = start / TPDataChunk::BlockIndices; b * TPDataChunk::BlockIndices < end; b++)
+            {
+                uint32_t blockStart = std::max(b * TPDataChunk::BlockIndices, start);
+                uint32_t blockEnd = std::min((b + 1) * TPDataChunk::BlockIndices, end);
+
+                if (!BoxVisible(ld->blockBounds[b * 2], ld->blockBounds[b * 2 + 1]))
+                {
+                    DrawRange(GL_TRIANGLES, runStart, blockStart);
+                    runStart = blockEnd;
+                }
+            }
+            DrawRange(GL_TRIANGLES, runStart, end);
         }
     }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // The draw calls only queue the work, so the embedded GPUs are waited for to know how long they took.
+    // On the desktop that would stall the pipeline every frame so the time to submit the calls is used instead.
+#ifdef GLES
+    glFinish();
+#endif
+    levelCosts[level] = DrawClock::now() - drawStart;
 }
 
 void ToolpathRendering::SetOpacity(float alpha)
@@ -350,5 +742,6 @@ void ToolpathRendering::SetColor(glm::vec3 color)
 
 bool ToolpathRendering::ToolpathLoaded()
 {
+    std::lock_guard<std::mutex> lock(pendingMutex);
     return (path != nullptr);
 }
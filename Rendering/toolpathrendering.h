@@ -7,13 +7,16 @@
 #include "loadedgl.h"
 #endif
 
+#include <memory>
+
 #include "structures.h"
 
 namespace ToolpathRendering {
     void FreeMemory();
     void Draw();
     void Init();
-    void SetToolpath(Toolpath *tp);\
+    // The toolpath is shared with the renderer, which keeps it alive until its chunks have been replaced
+    void SetToolpath(std::shared_ptr<const Toolpath> tp);
     void ProjMatDirty();
     void SceneMatDirty();
     void SetOpacity(float alpha);
@@ -21,6 +24,9 @@ namespace ToolpathRendering {
     void SetColor(glm::vec3 color);
     bool ToolpathLoaded();
     void ShowPrintedToLine(int64_t lineNum);
+    // Only draw the layers from first to last, a negative first layer shows them all
+    void ShowLayerRange(int first, int last);
+    int LayerCount();
 }
 
 #endif // TOOLPATHRENDERER_H
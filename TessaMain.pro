@@ -6,6 +6,7 @@ CONFIG += c++11
 SOURCES += main.cpp \
     ChopperEngine/chopperengine.cpp \
     ChopperEngine/clipper.cpp \
+    ChopperEngine/spillfile.cpp \
     Misc/filebrowser.cpp \
     Misc/globalsettings.cpp \
     Misc/qtsettings.cpp \
@@ -35,6 +36,7 @@ HEADERS += \
     ChopperEngine/chopperengine.h \
     ChopperEngine/clipper.hpp \
     ChopperEngine/pmvector.h \
+    ChopperEngine/spillfile.h \
     Misc/delegate.h \
     Misc/filebrowser.h \
     Misc/globalsettings.h \